@@ -0,0 +1,682 @@
+/** clupatra-batch : multi-threaded batch reconstruction with Clupatra ( w/o the Marlin event loop ).
+ *
+ *  usage:  clupatra-batch [-j nWorkers] [-q maxEventsInFlight] [-k readAhead] [-n maxEvents] steering.xml output.slcio
+ *
+ *  The Marlin steering file is used for the input files ( LCIOInputFiles ), the GEAR file, MaxRecordNumber and
+ *  the active processors. All active processors are initialized as in Marlin ( e.g. the DD4hep geometry ) but only
+ *  the ClupatraProcessor is called for the events - from nWorkers threads concurrently. 
+ *
+ *  Reading, reconstruction and writing are pipelined: a reader thread reads and unpacks ( including the TPC hit 
+ *  collection ) up to readAhead events ahead of the workers, and the main thread writes the finished events in 
+ *  input order while the workers reconstruct the following ones. At most maxEventsInFlight events are read but 
+ *  not yet written. Run headers are not copied to the output. Reading and writing are serialized with a mutex 
+ *  ( the SIO reader and writer are not thread safe in older LCIO releases ). 
+ *
+ *  NConcurrentEvents of the ClupatraProcessor is set to nWorkers unless given in the steering file.
+ *  Events for which the ClupatraProcessor throws an exception are not written - the exit code is 2 then.
+ *
+ *  stream mode:  clupatra-batch -w windowLength [-o overlap] [-t spacing] [-n maxEvents] steering.xml
+ *
+ *  The TPC hits of the events are concatenated into one continuous stream - event i is shifted by i * spacing 
+ *  in z - and reconstructed in sliding windows with the StreamReconstructor ( one thread, no output file ). 
+ *
+ */
+
+#include "ClupatraProcessor.h"
+#include "ClupatraReconstructor.h"
+#include "ClupatraStreamReconstructor.h"
+#include "clupatra_new.h"
+
+#include "marlin/XMLParser.h"
+#include "marlin/StringParameters.h"
+#include "marlin/ProcessorMgr.h"
+#include "marlin/ProcessorLoader.h"
+#include "marlin/Global.h"
+
+#include "gearxml/GearXML.h"
+
+#include "lcio.h"
+#include "IO/LCReader.h"
+#include "IO/LCWriter.h"
+#include "IOIMPL/LCFactory.h"
+#include "EVENT/LCCollection.h"
+
+#include "streamlog/streamlog.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+
+
+namespace{
+
+  /** One event in flight - read by the reader thread, processed by a worker, written by the main thread. */
+  struct EventSlot{
+
+    EventSlot( lcio::LCEvent* e ) : evt( e ), nHits( 0 ), done( false ), failed( false ) {}
+
+    lcio::LCEvent* evt ;
+    unsigned nHits ;
+    bool done ;
+    bool failed ;  // the reconstruction threw an exception - the event is not written
+  } ;
+
+
+  /** The events in flight in input order and the queue of events waiting for a worker. */
+  class EventQueue{
+  public:
+
+    EventQueue( unsigned maxInFlight, unsigned readAhead ) : 
+      _maxInFlight( maxInFlight ), _readAhead( readAhead ), _closed( false ), _aborted( false ) {}
+
+    /** Deletes the events that have not been written ( after abort() ) - the threads must have been joined. */
+    ~EventQueue(){
+      for( unsigned i=0 ; i < _inFlight.size() ; ++i ){
+	delete _inFlight[i]->evt ;
+	delete _inFlight[i] ;
+      }
+    }
+
+    /** Add an event read from the input ( reader thread ) - waits while readAhead events are waiting 
+     *  for a worker or maxInFlight events are not yet written. Returns false ( and deletes the event ) 
+     *  if the queue has been aborted.
+     */
+    bool push( EventSlot* s ){
+      std::unique_lock<std::mutex> lock( _mutex ) ;
+      _spaceCond.wait( lock, [this](){ return _aborted || ( _todo.size() < _readAhead && _inFlight.size() < _maxInFlight ) ; } ) ;
+      if( _aborted ){
+	delete s->evt ;
+	delete s ;
+	return false ;
+      }
+      _inFlight.push_back( s ) ;
+      _todo.push_back( s ) ;
+      _workCond.notify_one() ;
+      return true ;
+    }
+
+    /** No more events will be added - the workers return when the queue is empty. */
+    void close(){
+      std::lock_guard<std::mutex> lock( _mutex ) ;
+      _closed = true ;
+      _workCond.notify_all() ;
+      _doneCond.notify_all() ;
+    }
+
+    /** The events will not be written - the reader stops and the workers return after the current event. */
+    void abort(){
+      std::lock_guard<std::mutex> lock( _mutex ) ;
+      _closed = true ;
+      _aborted = true ;
+      _todo.clear() ;
+      _spaceCond.notify_all() ;
+      _workCond.notify_all() ;
+      _doneCond.notify_all() ;
+    }
+
+    /** Next event for a worker - 0 if the queue is closed and empty. */
+    EventSlot* next(){
+      std::unique_lock<std::mutex> lock( _mutex ) ;
+      _workCond.wait( lock, [this](){ return _closed || !_todo.empty() ; } ) ;
+
+      if( _todo.empty() )
+	return 0 ;
+
+      EventSlot* s = _todo.front() ;
+      _todo.pop_front() ;
+      _spaceCond.notify_one() ;
+      return s ;
+    }
+
+    /** Called by the worker when the event is processed. */
+    void finished( EventSlot* s ){
+      std::lock_guard<std::mutex> lock( _mutex ) ;
+      s->done = true ;
+      _doneCond.notify_all() ;
+    }
+
+    /** Oldest event in flight once it is processed - waits for it - 0 if the queue is closed and 
+     *  all events have been taken.
+     */
+    EventSlot* popOldest(){
+      std::unique_lock<std::mutex> lock( _mutex ) ;
+
+      _doneCond.wait( lock, [this](){ return ( _closed && _inFlight.empty() ) || ( !_inFlight.empty() && _inFlight.front()->done ) ; } ) ;
+
+      if( _inFlight.empty() )
+	return 0 ;
+
+      EventSlot* s = _inFlight.front() ;
+      _inFlight.pop_front() ;
+      _spaceCond.notify_one() ;
+      return s ;
+    }
+
+  protected:
+    std::deque<EventSlot*> _inFlight ;
+    std::deque<EventSlot*> _todo ;
+    unsigned _maxInFlight ;
+    unsigned _readAhead ;
+    bool _closed ;
+    bool _aborted ;
+    std::mutex _mutex ;
+    std::condition_variable _spaceCond ;
+    std::condition_variable _workCond ;
+    std::condition_variable _doneCond ;
+  } ;
+
+  //---------------------------------------------------------------------------------------------
+
+  /** Joins the reader and worker threads when leaving the scope - if the main thread leaves early 
+   *  ( exception ) the queue is aborted first so that the threads return.
+   */
+  class ThreadGuard{
+  public:
+
+    ThreadGuard( EventQueue& q ) : _queue( q ) {}
+
+    ~ThreadGuard(){
+
+      for( unsigned i=0 ; i < _threads.size() ; ++i )
+	if( _threads[i].joinable() ){
+	  _queue.abort() ;
+	  break ;
+	}
+
+      join() ;
+    }
+
+    void add( std::thread&& t ){ _threads.push_back( std::move( t ) ) ; }
+
+    /** Wait for all threads. */
+    void join(){
+      for( unsigned i=0 ; i < _threads.size() ; ++i )
+	if( _threads[i].joinable() )
+	  _threads[i].join() ;
+    }
+
+  protected:
+    ThreadGuard( const ThreadGuard& ) ; // no copy
+    ThreadGuard& operator=( const ThreadGuard& ) ;
+
+    EventQueue& _queue ;
+    std::vector<std::thread> _threads ;
+  } ;
+
+  //---------------------------------------------------------------------------------------------
+
+  void usage( const char* prog ){
+    std::cout << " usage: " << prog << " [-j nWorkers] [-q maxEventsInFlight] [-k readAhead] [-n maxEvents] steering.xml output.slcio \n"
+	      << "        " << prog << " -w windowLength [-o overlap] [-t spacing] [-n maxEvents] steering.xml \n"
+	      << "   -j  number of worker threads calling the ClupatraProcessor         ( default: number of cores ) \n"
+	      << "   -q  maximum number of events read but not yet written ( >= nWorkers, default: 2 * nWorkers ) \n"
+	      << "   -k  maximum number of events read ahead of the workers         ( default: nWorkers ) \n"
+	      << "   -n  maximum number of events to process - overwrites MaxRecordNumber ( default: all ) \n"
+	      << "   -w  stream mode: length of the sliding window [mm]                 ( <=0 : 2 * driftLength ) \n"
+	      << "   -o  stream mode: overlap of the windows [mm]                       ( default: driftLength ) \n"
+	      << "   -t  stream mode: distance of consecutive events in the stream [mm] ( default: driftLength ) \n"
+	      << std::endl ;
+  }
+
+  /** Load the processor libraries given in MARLIN_DLL - as done by Marlin. */
+  void loadMarlinDLLs(){
+
+    const char* dlls = std::getenv( "MARLIN_DLL" ) ;
+    if( dlls == 0 )
+      return ;
+
+    std::vector<std::string> libs ;
+    std::stringstream ss( dlls ) ;
+    std::string lib ;
+    while( std::getline( ss, lib, ':' ) )
+      if( !lib.empty() ) libs.push_back( lib ) ;
+
+    marlin::ProcessorLoader loader( libs.begin() , libs.end() ) ;
+  }
+
+  //---------------------------------------------------------------------------------------------
+
+  /** A hit of the stream that has not yet been added to the StreamReconstructor - the data is copied, 
+   *  so that the events can be deleted right after they are read.
+   */
+  struct PendingHit{
+    double pos[3] ;             // position in the stream coordinate
+    int cellID0 ;
+    int cellID1 ;
+    float cov[6] ;
+    float eDep ;
+  } ;
+
+  /** Stream mode ( -w ): reconstruct the events as one continuous stream in sliding windows - returns the exit 
+   *  code of the job. The stitching of the windows is tested in testStreamStitching.
+   */
+  int runStream( IO::LCReader* rdr, int maxEvents, const std::string& tpcColName, clupatra::Reconstructor& reco,
+		 const clupatra::StreamConfig& scfg, double spacing ){
+
+    const double driftLength = reco.geometry().driftLength ;
+
+    clupatra::StreamReconstructor stream( reco.config(), reco.geometry(), scfg ) ;
+
+    // the windows are reconstructed in this thread - the MarlinTrk systems of the first context can be used
+    const clupatra_new::ClupaEventContext* ctx = reco.contexts().contexts()[0] ;
+    stream.reconstructor().addContext( ctx->trkSystem, ctx->trkSystems ) ;
+
+    std::vector<clupatra::TrackResult> tracks ;
+    std::vector<PendingHit> pending ;
+
+    // buffers for the views
+    std::vector<double> pos ;
+    std::vector<int>    cellIDs ;
+    std::vector<float>  cov ;
+    std::vector<float>  eDep ;
+
+    // add the pending hits below limit to the stream in z order and reconstruct the complete windows
+    auto feed = [&]( double limit ){
+
+      std::sort( pending.begin(), pending.end(), []( const PendingHit& a, const PendingHit& b ){ 
+	  return a.pos[2] < b.pos[2] ; } ) ;
+
+      unsigned n = 0 ;
+      while( n < pending.size() && pending[n].pos[2] < limit )
+	++n ;
+
+      pos.resize( 3 * n ) ;
+      cellIDs.resize( 2 * n ) ;
+      cov.resize( 6 * n ) ;
+      eDep.resize( n ) ;
+
+      for( unsigned j=0 ; j<n ; ++j ){
+
+	const PendingHit& p = pending[j] ;
+
+	std::copy( p.pos, p.pos + 3, &pos[ 3 * j ] ) ;
+	cellIDs[ 2 * j     ] = p.cellID0 ;
+	cellIDs[ 2 * j + 1 ] = p.cellID1 ;
+	std::copy( p.cov, p.cov + 6, &cov[ 6 * j ] ) ;
+	eDep[j] = p.eDep ;
+      }
+
+      clupatra::TPCHitView view ;
+      view.n            = n ;
+      view.pos          = ( n ? &pos[0] : 0 ) ;
+      view.cellID0      = ( n ? &cellIDs[0] : 0 ) ;
+      view.cellID1      = ( n ? &cellIDs[1] : 0 ) ;
+      view.cellIDStride = 2 ;
+      view.cov          = ( n ? &cov[0] : 0 ) ;
+      view.eDep         = ( n ? &eDep[0] : 0 ) ;
+
+      stream.addHits( view ) ;
+      stream.process( tracks ) ;
+
+      pending.erase( pending.begin(), pending.begin() + n ) ;
+    } ;
+
+    //---- read the events and add their hits to the stream
+    unsigned nEvents = 0 ;
+
+    for( int nRead = 0 ; maxEvents < 0 || nRead < maxEvents ; ++nRead ){
+
+      lcio::LCEvent* evt = rdr->readNextEvent( lcio::LCIO::UPDATE ) ;
+      if( evt == 0 )
+	break ;
+
+      lcio::LCCollection* col = 0 ;
+      try{ 
+	col = evt->getCollection( tpcColName ) ; 
+      } catch( lcio::DataNotAvailableException& ) {}
+
+      const double offset = nEvents * spacing ;
+      const unsigned n = ( col ? col->getNumberOfElements() : 0 ) ;
+
+      for( unsigned i=0 ; i<n ; ++i ){
+
+	const lcio::TrackerHit* th = static_cast<lcio::TrackerHit*>( col->getElementAt( i ) ) ;
+
+	PendingHit p ;
+	std::copy( th->getPosition(), th->getPosition() + 3, p.pos ) ;
+	p.pos[2] += offset ;
+	p.cellID0 = th->getCellID0() ;
+	p.cellID1 = th->getCellID1() ;
+	std::copy( th->getCovMatrix().begin(), th->getCovMatrix().begin() + 6, p.cov ) ;
+	p.eDep = th->getEDep() ;
+
+	pending.push_back( p ) ;
+      }
+
+      delete evt ;
+
+      if( n == 0 )
+	continue ;
+
+      ++nEvents ;
+
+      // hits before the first hit of the next event are complete
+      feed( offset + spacing - driftLength ) ;
+    }
+
+    feed( DBL_MAX ) ;
+    stream.flush( tracks ) ;
+
+    std::cout << stream.statistics() << std::endl ;
+
+    std::cout << " clupatra-batch: stream of " << nEvents << " events ( spacing " << spacing << " mm ) - " 
+	      << tracks.size() << " tracks emitted " << std::endl ;
+
+    return 0 ;
+  }
+}
+
+
+int main( int argc, char** argv ){
+
+  unsigned nWorkers = std::thread::hardware_concurrency() ;
+  unsigned maxInFlight = 0 ;
+  unsigned readAhead = 0 ;
+  int maxEvents = -1 ;
+
+  bool streamMode = false ;
+  clupatra::StreamConfig scfg ;
+  double spacing = 0. ;
+
+  std::vector<std::string> args ;
+
+  for( int i=1 ; i < argc ; ++i ){
+
+    if( i+1 < argc && !std::strcmp( argv[i], "-j" ) )       nWorkers    = std::atoi( argv[++i] ) ;
+    else if( i+1 < argc && !std::strcmp( argv[i], "-q" ) )  maxInFlight = std::atoi( argv[++i] ) ;
+    else if( i+1 < argc && !std::strcmp( argv[i], "-k" ) )  readAhead   = std::atoi( argv[++i] ) ;
+    else if( i+1 < argc && !std::strcmp( argv[i], "-n" ) )  maxEvents   = std::atoi( argv[++i] ) ;
+    else if( i+1 < argc && !std::strcmp( argv[i], "-w" ) ){ streamMode = true ; scfg.windowLength = std::atof( argv[++i] ) ; }
+    else if( i+1 < argc && !std::strcmp( argv[i], "-o" ) )  scfg.overlap = std::atof( argv[++i] ) ;
+    else if( i+1 < argc && !std::strcmp( argv[i], "-t" ) )  spacing     = std::atof( argv[++i] ) ;
+    else args.push_back( argv[i] ) ;
+  }
+
+  if( args.size() != ( streamMode ? 1u : 2u ) ){
+    usage( argv[0] ) ;
+    return 1 ;
+  }
+
+  if( nWorkers < 1 ) nWorkers = 1 ;
+
+  if( maxInFlight > 0 && maxInFlight < nWorkers ){
+    std::cerr << " -q " << maxInFlight << " : at least nWorkers = " << nWorkers << " events have to be in flight " << std::endl ;
+    usage( argv[0] ) ;
+    return 1 ;
+  }
+
+  if( maxInFlight == 0 ) maxInFlight = 2 * nWorkers ;
+  if( readAhead < 1 ) readAhead = nWorkers ;
+
+  try{
+
+    streamlog::out.init( std::cout , "clupatra-batch" ) ;
+
+    loadMarlinDLLs() ;
+
+    //-------- read the steering file -----------------------------------------------------------
+
+    marlin::XMLParser parser( args[0] ) ;
+    parser.parse() ;
+
+    marlin::StringParameters* global = parser.getParameters( "Global" ) ;
+    if( global == 0 ){
+      std::cerr << " no <global> section in steering file " << args[0] << std::endl ;
+      return 1 ;
+    }
+    marlin::Global::parameters = global ;
+
+    std::vector<std::string> inputFiles ;
+    global->getStringVals( "LCIOInputFiles" , inputFiles ) ;
+
+    if( maxEvents < 0 && global->isParameterSet( "MaxRecordNumber" ) && global->getIntVal( "MaxRecordNumber" ) > 0 )
+      maxEvents = global->getIntVal( "MaxRecordNumber" ) ;
+
+    // global verbosity for the whole job - the scope resets the level when leaving main
+    streamlog::logscope scope( streamlog::out ) ;
+    if( global->isParameterSet( "Verbosity" ) )
+      scope.setLevel( global->getStringVal( "Verbosity" ) ) ;
+
+    //-------- geometry and processors - same as in Marlin ---------------------------------------
+
+    if( global->isParameterSet( "GearXMLFile" ) && !global->getStringVal( "GearXMLFile" ).empty() ){
+      gear::GearXML gearXML( global->getStringVal( "GearXMLFile" ) ) ;
+      marlin::Global::GEAR = gearXML.createGearMgr() ;
+    }
+
+    std::vector<std::string> procNames ;
+    global->getStringVals( "ActiveProcessors" , procNames ) ;
+
+    std::string clupaName ;
+
+    for( unsigned i=0 ; i < procNames.size() ; ++i ){
+
+      marlin::StringParameters* p = parser.getParameters( procNames[i] ) ;
+      if( p == 0 )
+	continue ;
+
+      const std::string type = p->getStringVal( "ProcessorType" ) ;
+
+      if( type == "ClupatraProcessor" ){
+
+	if( !clupaName.empty() ){
+	  std::cout << " more than one ClupatraProcessor in steering file - only " << clupaName << " is used " << std::endl ;
+	  continue ;
+	}
+	clupaName = procNames[i] ;
+
+	if( !p->isParameterSet( "NConcurrentEvents" ) ){
+	  std::stringstream n ;
+	  n << nWorkers ;
+	  p->add( "NConcurrentEvents" , std::vector<std::string>( 1, n.str() ) ) ;
+	}
+      }
+
+      marlin::ProcessorMgr::instance()->addActiveProcessor( type , procNames[i] , p ) ;
+    }
+
+    ClupatraProcessor* clupa = ( clupaName.empty() ? 0 :
+				 dynamic_cast<ClupatraProcessor*>( marlin::ProcessorMgr::instance()->getActiveProcessor( clupaName ) ) ) ;
+    if( clupa == 0 ){
+      std::cerr << " no active ClupatraProcessor in steering file " << args[0] << std::endl ;
+      return 1 ;
+    }
+
+    marlin::ProcessorMgr::instance()->init() ;
+
+    const std::string tpcColName = clupa->parameters()->getStringVal( "TPCHitCollection" ) ;
+
+    //-------- stream mode ---------------------------------------------------------------------------
+
+    if( streamMode ){
+
+      std::unique_ptr<IO::LCReader> rdr( IOIMPL::LCFactory::getInstance()->createLCReader( IO::LCReader::directAccess ) ) ;
+      rdr->open( inputFiles ) ;
+
+      streamlog::logscope procScope( streamlog::out ) ;
+      procScope.setName( clupa->name() ) ;
+      procScope.setLevel( clupa->logLevelName() ) ;
+
+      clupatra::Reconstructor& reco = *clupa->reconstructor() ;
+
+      const int rc = runStream( rdr.get(), maxEvents, tpcColName, reco, scfg, 
+				( spacing > 0. ? spacing : reco.geometry().driftLength ) ) ;
+      rdr->close() ;
+
+      marlin::ProcessorMgr::instance()->end() ;
+
+      return rc ;
+    }
+
+    //-------- input and output --------------------------------------------------------------------
+
+    // direct access: the reader does not re-use the event - we own (and delete) every event read
+    std::unique_ptr<IO::LCReader> rdr( IOIMPL::LCFactory::getInstance()->createLCReader( IO::LCReader::directAccess ) ) ;
+    rdr->open( inputFiles ) ;
+
+    std::unique_ptr<IO::LCWriter> wrt( IOIMPL::LCFactory::getInstance()->createLCWriter() ) ;
+    wrt->open( args[1] , lcio::LCIO::WRITE_NEW ) ;
+
+    //-------- event loop ------------------------------------------------------------------------
+
+    std::cout << " clupatra-batch: processing with " << nWorkers << " worker threads - read ahead " << readAhead 
+	      << " events - at most " << maxInFlight << " events in flight " << std::endl ;
+
+    EventQueue queue( maxInFlight, readAhead ) ;
+
+    // the verbosity of the ClupatraProcessor for the events - as set by Marlin around processEvent(). The level
+    // of streamlog is global, so it is set once for all workers and not per thread
+    streamlog::logscope procScope( streamlog::out ) ;
+    procScope.setName( clupa->name() ) ;
+    procScope.setLevel( clupa->logLevelName() ) ;
+
+    // declared after the queue: the threads are joined before the queue and the verbosity scope are destroyed
+    ThreadGuard threads( queue ) ;
+
+    const auto start = std::chrono::steady_clock::now() ;
+
+    // the SIO reader and writer of older LCIO releases share static buffers - reading ( and unpacking ) 
+    // and writing are serialized, so that no particular LCIO version is needed
+    std::mutex sioMutex ;
+
+    // ---- reader: read and unpack the events ahead of the workers
+    double readSeconds = 0. ;
+    bool readFailed = false ;
+
+    threads.add( std::thread( [&](){
+
+	try{
+
+	  for( int nRead = 0 ; maxEvents < 0 || nRead < maxEvents ; ++nRead ){
+
+	    const auto t0 = std::chrono::steady_clock::now() ;
+
+	    std::unique_lock<std::mutex> sioLock( sioMutex ) ;
+
+	    lcio::LCEvent* evt = rdr->readNextEvent( lcio::LCIO::UPDATE ) ;
+	    if( evt == 0 )
+	      break ;
+
+	    EventSlot* s = new EventSlot( evt ) ;
+
+	    // make sure all collections are unpacked here ( under the lock ) and not in the worker
+	    const std::vector<std::string>* colNames = evt->getCollectionNames() ;
+	    for( unsigned i=0 ; i < colNames->size() ; ++i )
+	      evt->getCollection( (*colNames)[i] ) ;
+
+	    try{ 
+	      s->nHits = evt->getCollection( tpcColName )->getNumberOfElements() ; 
+
+	    } catch( lcio::DataNotAvailableException& ) {}  // the processor prints a warning
+
+	    sioLock.unlock() ;
+
+	    readSeconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count() ;
+
+	    if( ! queue.push( s ) )
+	      break ;
+	  }
+
+	} catch( std::exception& e ){
+
+	  std::cerr << " clupatra-batch: exception while reading - stop reading : " << e.what() << std::endl ;
+	  readFailed = true ;
+	}
+
+	queue.close() ;
+      } ) ) ;
+
+    // ---- workers: reconstruction 
+    for( unsigned i=0 ; i < nWorkers ; ++i ){
+
+      threads.add( std::thread( [&](){
+
+	    while( EventSlot* s = queue.next() ){
+
+	      try{
+
+		clupa->processEvent( s->evt ) ;
+
+	      } catch( std::exception& e ){
+
+		std::cerr << " clupatra-batch: exception in event " << s->evt->getEventNumber()
+			  << " run " << s->evt->getRunNumber() << " - the event is not written : " << e.what() << std::endl ;
+
+		s->failed = true ;
+	      }
+
+	      queue.finished( s ) ;
+	    }
+	  } ) ) ;
+    }
+
+    // ---- writer ( main thread ): write the finished events in input order
+    unsigned long nEvents = 0 ;
+    unsigned long nFailed = 0 ;
+    unsigned long nHits = 0 ;
+    double writeSeconds = 0. ;
+
+    while( EventSlot* s = queue.popOldest() ){
+
+      const auto t0 = std::chrono::steady_clock::now() ;
+
+      if( s->failed ){
+
+	++nFailed ;
+
+      } else {
+
+	std::lock_guard<std::mutex> sioLock( sioMutex ) ;
+	wrt->writeEvent( s->evt ) ;
+	++nEvents ;
+	nHits += s->nHits ;
+      }
+
+      delete s->evt ;
+      delete s ;
+
+      writeSeconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count() ;
+    }
+
+    threads.join() ;
+
+    const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count() ;
+
+    wrt->close() ;
+    rdr->close() ;
+
+    marlin::ProcessorMgr::instance()->end() ;
+
+    std::cout << " clupatra-batch: processed " << nEvents << " events with " << nHits << " TPC hits in "
+	      << seconds << " s  -  " << ( seconds > 0. ? nEvents / seconds : 0. ) << " events/s , "
+	      << ( seconds > 0. ? nHits / seconds : 0. ) << " hits/s " << std::endl ;
+
+    std::cout << " clupatra-batch: time spent reading " << readSeconds << " s , writing " << writeSeconds 
+	      << " s ( in parallel to the reconstruction ) " << std::endl ;
+
+    if( nFailed > 0 || readFailed ){
+
+      std::cerr << " clupatra-batch: " << nFailed << " events failed and were not written " 
+		<< ( readFailed ? "- reading the input stopped with an error " : "" ) << std::endl ;
+      return 2 ;
+    }
+
+  } catch( std::exception& e ){
+
+    std::cerr << " clupatra-batch: " << e.what() << std::endl ;
+    return 1 ;
+  }
+
+  return 0 ;
+}
@@ -7,9 +7,11 @@
 
 #include "lcio.h"
 
-#include "DDRec/DetectorData.h"
+#include "ClupatraReconstructor.h"
 
 #include <string>
+#include <vector>
+#include <atomic>
 
 
 // forward declarations
@@ -21,6 +23,14 @@ namespace EVENT{
   class Track ;
 }
 
+namespace clupatra_new{
+  struct ClupaWorkspace ;
+  struct ClupaEventContext ;
+  class SiLadderTable ;
+  class SiHitIndex ;
+  struct SiPickUpResult ;
+}
+
 // namespace DD4hep{
 //   namespace DDRec{
 //     struct FixedPadSizeTPCData ;
@@ -64,6 +74,49 @@ namespace EVENT{
  *   @parameter SITHitCollection         name of the SIT hit collections - used to extend TPC tracks if (pickUpSiHits==true)
  *   @parameter VXDHitCollection         name of the VXD hit collections - used to extend TPC tracks if (pickUpSiHits==true)
  * 
+ *   @parameter SegmentMergeMaxDeltaPhi maximum distance in phi [rad] of the closest end points of two split track segments that are tested for merging, pairs with opposite tan lambda are also not tested - <=0 : no cut - the default (1.0) covers the segments of non-curling tracks from the IP ( at most 0.84 rad in the ILD TPC )
+ *   @parameter SegmentMergeGateChi2    maximum chi2 of the analytic helix extrapolation ( with multiple scattering in the TPC gas ) to each of the three probe hits of a split track segment before the Kalman filter is tried - <=0 : no cut ( default 50 )
+ * 
+ *   @parameter AnalyticSiIntersection  if true the intersections of the tracks with the VXD and SIT ladders are computed analytically for the Si hit pick up
+ * 
+ *   @parameter ParallelSiPickUp        if true and NThreads > 1 the Si hits are picked up for all tracks in parallel - conflicts are resolved in the order of pt
+ * 
+ *   @parameter TagLoopers              if true loopers (low pt tracks from the IP with many turns) are found with a Hough transform before the seeding and their hits are removed
+ * 
+ *   @parameter LooperMinHits           minimum number of hits of a looper
+ * 
+ *   @parameter LooperMinHitsPerRow     minimum average number of hits per pad row of a looper (2 per turn)
+ * 
+ *   @parameter NThreads                number of threads used for the parallel parts of the algorithm (e.g. TPC hit ingest) - 1 : run serially
+ * 
+ *   @parameter ParallelMergeVerdicts   if true and NThreads > 1 the merge conditions for the candidate pairs of split and curler segments are evaluated in parallel (one MarlinTrk system per thread)
+ * 
+ *   @parameter NConcurrentEvents       maximum number of events that can be processed concurrently by calling processEvent() from different threads (one MarlinTrk system and workspace per event)
+ * 
+ *   @parameter TimeBudget              maximum wall clock time [s] per event - if exceeded, seeding loops, reclustering and merging are skipped and the output collection gets the parameter ClupatraSkippedStages - <=0 : no limit
+ * 
+ *   @parameter SplitTPCInZ             if true the track segments are found independently in the two TPC halves (in parallel if NThreads > 1)
+ *   @parameter NPhiDomains             number of sectors in phi in which the track segments are found independently (in parallel if NThreads > 1) - 1 : no split
+ *   @parameter DomainMargin            segments from different domains that end within this distance [mm] of the domain boundary are stitched before the general merging of split segments
+ * 
+ *   @parameter DoGlobalReclustering    if true the leftover hits in the outer part of the TPC are reclustered after the seeding
+ *   @parameter MergeSplitSegments      if true track segments that are split along the track are merged
+ *   @parameter MergeCurlerSegments     if true the segments of curling tracks are merged
+ *   @parameter PreviewMode             low latency preview for online monitoring: seeding and extension only - no looper tagging, reclustering, merging, Si hit pick up
+ *                                      and quality tagging, the tracks are not smoothed and have no track state at the calorimeter
+ *
+ *   @parameter ROICones                region of interest: cones around directions from the IP, 3 values [rad] per cone: theta phi halfAngle - empty: all directions
+ *   @parameter ROIZRange               region of interest: zMin zMax [mm] of the TPC hits - empty: no restriction
+ *   @parameter ROISeedCollection       optional collection of ReconstructedParticles ( e.g. jets ) - their momenta are added as cones to the region of interest - events w/o the collection use the region given by ROICones and ROIZRange - if the collection is empty and there are no ROICones no hits are used
+ *   @parameter ROISeedHalfAngle        half opening angle [rad] of the cones around the seed directions
+ *   @parameter ROIMargin               angular margin [rad] added to the half opening angles of all cones
+ *   @parameter ROIZMargin              margin [mm] added to the z range of the region of interest
+ *
+ *   @parameter PadRangeRecluster       number of pad rows in the windows of the global reclustering of leftover hits
+ *   @parameter OccupancyProfiles       parameter profiles chosen per event from the mean number of TPC hits per pad row, 9 values per profile:
+ *                                      name minHitsPerRow NLoopForSeeding PadRowRange NumberOfZBins PadRangeRecluster globalReclustering(0/1) mergeSplitSegments(0/1) mergeCurlerSegments(0/1)
+ *                                      - the profile with the largest minHitsPerRow below the occupancy is used and stored in the output collection parameter ClupatraProfile
+ * 
  *   @parameter Verbosity               verbosity level of this processor ("DEBUG0-4,MESSAGE0-4,WARNING0-4,ERROR0-4,SILENT")
  * 
  * @author F.Gaede, DESY, 2011/2012
@@ -87,7 +140,8 @@ class ClupatraProcessor : public marlin::Processor {
    */
   virtual void processRunHeader( lcio::LCRunHeader* run ) ;
   
-  /** Called for every event - the working horse.
+  /** Called for every event - the working horse. Can be called concurrently for different events
+   *  from up to NConcurrentEvents threads - every event gets its own context with MarlinTrk system(s) and buffers.
    */
   virtual void processEvent( lcio::LCEvent * evt ) ;
 
@@ -101,15 +155,23 @@ class ClupatraProcessor : public marlin::Processor {
    */
   virtual void end() ;
   
+  /** The pattern recognition with the parameters of the processor - created in init(), deleted in end(). */
+  clupatra::Reconstructor* reconstructor() const { return _reco ; }
   
  protected:
 
-  /** helper method to compute a few track segment parameters (start and end points, z spread,...) 
-   */
-  void computeTrackInfo(  lcio::Track* lTrk  ) ;
+  void pickUpSiTrackerHits( EVENT::LCCollection* trackCol , LCEvent* evt, clupatra_new::ClupaEventContext& ctx ) ;
 
+  /** Create and initialize a new MarlinTrk system and add it to 'existing' - returns 0 if the factory 
+   *  does not provide a system that is different from the ones in 'existing'.
+   */
+  MarlinTrk::IMarlinTrkSystem* newTrkSystem( std::vector<MarlinTrk::IMarlinTrkSystem*>& existing ) ;
 
-  void pickUpSiTrackerHits( EVENT::LCCollection* trackCol , LCEvent* evt) ;
+  /** Pick up the Si hits for one track w/o modifying the track or the hits - can be called concurrently 
+   *  with different MarlinTrk systems.
+   */
+  void pickUpSiHitsForTrack( EVENT::Track* trk, MarlinTrk::IMarlinTrkSystem* trkSystem, clupatra_new::SiHitIndex& siHits,
+			     int nVXDLayers, int nLayers, bool useLadders, double maxDist, clupatra_new::SiPickUpResult& res ) const ;
 
   /** Input collection name.
    */
@@ -119,47 +181,40 @@ class ClupatraProcessor : public marlin::Processor {
   std::string _outColName ;
   std::string  _segmentsOutColName ;
 
-  float _distCut ;
-  float _cosAlphaCut ;
+  clupatra::ReconstructorConfig _cfg ; // the parameters of the pattern recognition
 
-  float _duplicatePadRowFraction ;
-  float _bfield ;
-  
-  float  _dChi2Max ;
-  float  _chi2Cut ;
-  int    _maxStep ; 
+  EVENT::StringVec _occupancyProfiles ;// profiles as given in the steering file - parsed into _cfg.profiles in init()
 
-  float _minLayerFractionWithMultiplicity ;
-  int   _minLayerNumberWithMultiplicity ;
-  int   _nLoop ;
-  
-  float _trackStartsInnerDist ;
-  float _trackEndsOuterCentralDist ;
-  float _trackEndsOuterForwardDist ;
-  float _trackIsCurlerOmega ;
-  
-  int   _minCluSize ;
-  int   _padRowRange ; 
-  int   _nZBins ;
+  EVENT::FloatVec _roiCones ;          // region of interest: theta phi halfAngle per cone
+  EVENT::FloatVec _roiZRange ;
+  std::string _roiSeedColName ;
+  float _roiSeedHalfAngle ;
+  float _roiMargin ;
+  float _roiZMargin ;
+
+  float _bfield ;
 
   bool _MSOn ;
   bool _ElossOn ;
   bool _SmoothOn ;
   bool _pickUpSiHits ;
+  bool _analyticSiIntersection ;
 
-  bool _createDebugCollections ;
-
-  int _caloFaceBarrelID ;
-  int _caloFaceEndcapID ;
+  int _nConcurrentEvents ;
+  bool _parallelSiPickUp ;
 
 
   int _nRun ;
-  int _nEvt ;
+  std::atomic<int> _nEvt ;
 
-  MarlinTrk::IMarlinTrkSystem* _trksystem ;
   std::string _trkSystemName ;
 
-  const DD4hep::DDRec::FixedPadSizeTPCData*  _tpc ;
+  // the Marlin independent pattern recognition - holds one context ( MarlinTrk system(s) and buffers ) per concurrent event
+  clupatra::Reconstructor* _reco ;
+
+  std::vector<MarlinTrk::IMarlinTrkSystem*> _trkSystems ; // all MarlinTrk systems created in init() - owned, deleted in end()
+
+  clupatra_new::SiLadderTable* _siLadders ; // VXD and SIT ladders for the analytic intersections ( 0 : use MarlinTrk )
 
 } ;
 
@@ -0,0 +1,332 @@
+#ifndef ClupatraReconstructor_h
+#define ClupatraReconstructor_h 1
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <cfloat>
+
+#include "lcio.h"
+#include "IMPL/LCCollectionVec.h"
+
+
+// forward declarations
+namespace MarlinTrk{
+  class IMarlinTrkSystem ;
+}
+
+namespace clupatra_new{
+  struct ClupaEventContext ;
+  class ClupaContextPool ;
+  class TPCDomains ;
+}
+
+
+/** Clupatra pattern recognition for the TPC w/o Marlin: the algorithm is configured with plain structs and
+ *  runs on a non-owning view of the TPC hits. The ClupatraProcessor is an adapter for Marlin.
+ *
+ *  The hits are fitted with a MarlinTrk system, which works on EVENT::TrackerHits: these are either given as 
+ *  hit handles in the view or created by the Reconstructor from the arrays of the view. The output tracks are 
+ *  also available as LCIO tracks ( no LCIO I/O or Marlin is needed ).
+ */
+namespace clupatra{
+
+  /** Region of interest: only TPC hits inside one of the cones around directions from the IP and inside the 
+   *  z range are used for the reconstruction - no cones : all directions. Margins have to be included in 
+   *  the cone opening angles and the z range ( e.g. for low pt tracks that curl out of the cone ).
+   */
+  struct RegionOfInterest{
+
+    RegionOfInterest() : zMin( -DBL_MAX ), zMax( DBL_MAX ), excludeAll( false ) {}
+
+    /** Add a cone around the direction (theta,phi) with the half opening angle [rad]. */
+    void addCone( double theta, double phi, double halfAngle ) ;
+
+    /** Add a cone with the half opening angle [rad] around each of the n seed momenta ( px,py,pz of seed i at 
+     *  p[ i * stride ] ). Without seeds and without other cones no hit is inside ( excludeAll ) - an empty list 
+     *  of cones would mean all directions.
+     */
+    void addSeeds( unsigned n, const double* p, unsigned stride, double halfAngle ) ;
+
+    /** True if all hits are inside. */
+    bool empty() const { return !excludeAll && cones.empty() && zMin <= -DBL_MAX && zMax >= DBL_MAX ; }
+
+    /** True if the position is inside the region. */
+    inline bool contains( const double* pos ) const {
+
+      if( excludeAll || pos[2] < zMin || pos[2] > zMax ) 
+	return false ;
+
+      if( cones.empty() ) 
+	return true ;
+
+      double r = std::sqrt( pos[0] * pos[0] + pos[1] * pos[1] + pos[2] * pos[2] ) ;
+
+      for( unsigned i=0 ; i < cones.size() ; ++i ){
+
+	const Cone& c = cones[i] ;
+
+	if( c.dir[0] * pos[0] + c.dir[1] * pos[1] + c.dir[2] * pos[2] >= c.cosMax * r )
+	  return true ;
+      }
+      return false ;
+    }
+
+    struct Cone{
+      double dir[3] ;  // unit vector of the axis
+      double cosMax ;  // cosine of the half opening angle
+    } ;
+
+    std::vector<Cone> cones ;
+    double zMin ;
+    double zMax ;
+    bool   excludeAll ;  // no hit is inside - e.g. an event w/o seed directions ( not the same as no cones )
+  } ;
+
+  /** Parameters that are adapted to the occupancy of the TPC in the event: the profile with the largest
+   *  minHitsPerRow that does not exceed the mean number of hits per pad row of the event replaces the
+   *  corresponding parameters of the ReconstructorConfig.
+   */
+  struct OccupancyProfile{
+
+    OccupancyProfile() ;
+
+    std::string name ;
+    float minHitsPerRow ;      // used for events with at least this mean number of hits per pad row
+    int   nLoop ;
+    int   padRowRange ;
+    int   nZBins ;             // binning in z of the hit buckets and of the z index
+    int   padRangeRecluster ;
+    bool  globalReclustering ;
+    bool  mergeSplitSegments ;
+    bool  mergeCurlerSegments ;
+  } ;
+
+  /** Parameters of the pattern recognition - see the ClupatraProcessor for their description. The defaults
+   *  are the same as for the processor.
+   */
+  struct ReconstructorConfig{
+
+    ReconstructorConfig() ;
+
+    float distCut ;
+    float cosAlphaCut ;
+    int   nLoop ;
+    int   minCluSize ;
+    float duplicatePadRowFraction ;
+    float dChi2Max ;
+    float chi2Cut ;
+    int   maxStep ;
+    int   padRowRange ;
+    int   nZBins ;
+    float minLayerFractionWithMultiplicity ;
+    int   minLayerNumberWithMultiplicity ;
+    int   padRangeRecluster ;   // number of pad rows in the windows of the global reclustering
+
+    bool  globalReclustering ;  // recluster the leftover hits in the outer part of the TPC
+    bool  mergeSplitSegments ;
+    bool  mergeCurlerSegments ;
+
+    float trackStartsInnerDist ;
+    float trackEndsOuterCentralDist ;
+    float trackEndsOuterForwardDist ;
+    float trackIsCurlerOmega ;
+
+    float segmentMergeMaxDeltaPhi ;
+    float segmentMergeGateChi2 ;
+
+    bool  tagLoopers ;
+    int   looperMinHits ;
+    float looperMinHitsPerRow ;
+
+    int   caloFaceBarrelID ;
+    int   caloFaceEndcapID ;
+
+    int   nThreads ;
+    bool  parallelMergeVerdicts ;
+
+    float timeBudget ;      // wall clock time [s] per event before stages are degraded - <=0 : no limit
+
+    bool  splitZHalves ;    // find the segments independently in the two TPC halves
+    int   nPhiDomains ;     // ... and/or in nPhiDomains sectors in phi 
+    float domainMargin ;    // segments ending closer to a domain boundary [mm] are stitched first
+
+    bool  createDebugCollections ;
+
+    bool  previewMode ;     // low latency: seeding and extension only, light conversion w/o smoothing and propagation
+
+    bool  streamWindow ;    // the hits are a window of a continuous stream shifted into the TPC ( StreamReconstructor ): 
+                            // z is not the position in the TPC - no forward classification, radial cut only in the reclustering
+
+    RegionOfInterest roi ;  // hits outside are ignored - can be replaced per event in the TPCHitView
+
+    std::vector<OccupancyProfile> profiles ; // optional parameters per occupancy - empty : use the above for all events
+
+    /** Replace the occupancy dependent parameters with the ones of the profile. */
+    void apply( const OccupancyProfile& p ) ;
+
+    /** Predefined low latency configuration for online monitoring: switches off the looper tagging, 
+     *  the global reclustering and the merging of segments - the segments are fitted w/o smoothing and 
+     *  converted w/o propagation ( track states at the IP, first and last hit only ).
+     */
+    void setPreviewMode() ;
+  } ;
+
+  /** TPC geometry and magnetic field - lengths in mm, field in Tesla. */
+  struct TPCGeometry{
+
+    TPCGeometry() : rMin(0.), rMax(0.), driftLength(0.), nPadRows(0), bField(0.) {}
+
+    double   rMin ;         // inner radius of the readout
+    double   rMax ;         // outer radius of the readout
+    double   driftLength ;  // maximum |z| of the hits
+    unsigned nPadRows ;
+    double   bField ;       // z-component at the origin
+  } ;
+
+  /** Non-owning view of the TPC hits of one event. Positions, cellIDs, covariances and energy deposits are 
+   *  read from the arrays if given ( with strides in units of the element type ), otherwise from the hit handles.
+   *  The handles are optional: w/o handles pos, cellID0 and cov are required and the Reconstructor fits  
+   *  LCIO hits of its own that are re-used between events - the LCIO tracks of the result then point to these 
+   *  hits, which are only valid until the next event, and the tracks should be used via the hit indices.
+   */
+  struct TPCHitView{
+
+    TPCHitView() : n(0), pos(0), posStride(3), cellID0(0), cellID1(0), cellIDStride(1), cov(0), covStride(6), 
+		   eDep(0), eDepStride(1), handle(0), roi(0) {}
+
+    unsigned n ;
+    const double* pos ;               // x,y,z of hit i at pos[ i * posStride ]
+    unsigned      posStride ;
+    const int*    cellID0 ;           // cellID0 of hit i at cellID0[ i * cellIDStride ]
+    const int*    cellID1 ;           // optional upper 32 bits of the cellID
+    unsigned      cellIDStride ;
+    const float*  cov ;               // covariance xx, yx, yy, zx, zy, zz of hit i at cov[ i * covStride ] ( as in LCIO )
+    unsigned      covStride ;
+    const float*  eDep ;              // optional energy deposit of hit i at eDep[ i * eDepStride ]
+    unsigned      eDepStride ;
+    EVENT::TrackerHit* const* handle ; // optional - hit i as used by the Kalman filter
+    const RegionOfInterest*   roi ;    // region of interest for the event - 0 : the one of the ReconstructorConfig
+  } ;
+
+  /** Track parameters at one of the canonical LCIO track state locations. */
+  struct TrackParameters{
+
+    int   location ;  // lcio::TrackState::AtIP, AtFirstHit, AtLastHit or AtCalorimeter
+    float d0, phi, omega, z0, tanLambda ;
+    float referencePoint[3] ;
+    float covMatrix[15] ;
+  } ;
+
+  /** A reconstructed track: indices of its hits in the TPCHitView plus the fitted track states. */
+  struct TrackResult{
+
+    std::vector<unsigned>        hits ;
+    std::vector<TrackParameters> states ;
+    float chi2 ;
+    int   ndf ;
+  } ;
+
+  /** Output of the reconstruction of one event. The LCIO collections are owned by the result and deleted
+   *  in clear() or the d'tor unless they have been taken ( pointer set to 0 ).
+   */
+  struct ReconstructionResult{
+
+    ReconstructionResult() : fillTrackResults( true ), tracks(0), segments(0), skippedStages(0), 
+			     hitsPerRow(0.), maxHitsPerZBin(0) {}
+    ~ReconstructionResult() { clear() ; }
+
+    /** Delete all LCIO collections that have not been taken and clear the track results. */
+    void clear() ;
+
+    bool fillTrackResults ;                  // set to false if only the LCIO tracks are needed
+
+    std::vector<TrackResult> trackResults ;  // the final tracks - same order as in tracks
+
+    lcio::LCCollectionVec* tracks ;          // final tracks - parameter ClupatraSkippedStages if the time budget was exceeded
+    lcio::LCCollectionVec* segments ;        // track segments that are not final tracks
+
+    std::vector< std::pair< std::string, lcio::LCCollectionVec* > > debugCollections ; // if createDebugCollections
+
+    unsigned skippedStages ;  // stages degraded because of the time budget - bits of clupatra_new::TimeBudget::Stage
+
+    std::string profile ;     // name of the occupancy profile used for the event ( "default" if none )
+    float    hitsPerRow ;     // mean number of TPC hits per pad row
+    unsigned maxHitsPerZBin ; // maximum number of hits in one pad row and z bin
+
+  private:
+    ReconstructionResult( const ReconstructionResult& ) ; // no copy
+    ReconstructionResult& operator=( const ReconstructionResult& ) ;
+  } ;
+
+
+  /** The Clupatra pattern recognition. Events can be reconstructed concurrently from different threads - one
+   *  event context ( MarlinTrk system(s) and buffers ) per concurrent event has to be added with addContext().
+   */
+  class Reconstructor{
+  public:
+
+    Reconstructor( const ReconstructorConfig& cfg, const TPCGeometry& geo ) ;
+    ~Reconstructor() ;
+
+    /** Add an event context with the MarlinTrk system used for the event and optionally one system per
+     *  thread for the parallel stages ( the first one should be trkSystem ). The systems are not owned.
+     */
+    void addContext( MarlinTrk::IMarlinTrkSystem* trkSystem,
+		     const std::vector<MarlinTrk::IMarlinTrkSystem*>& threadSystems = std::vector<MarlinTrk::IMarlinTrkSystem*>() ) ;
+
+    /** The event contexts - e.g. for running additional steps with the same context after reconstruct(). */
+    clupatra_new::ClupaContextPool& contexts() { return *_contexts ; }
+
+    /** Reconstruct the tracks for the hits in the view - waits for a free event context. */
+    void reconstruct( const TPCHitView& view, ReconstructionResult& result ) ;
+
+    /** Reconstruct the tracks with the given context ( obtained from contexts() ). */
+    void reconstruct( const TPCHitView& view, ReconstructionResult& result, clupatra_new::ClupaEventContext& ctx ) ;
+
+    const ReconstructorConfig& config() const { return _cfg ; }
+
+    const TPCGeometry& geometry() const { return _geo ; }
+
+    /** Index of the occupancy profile for the given mean number of hits per pad row - -1 : no profile. */
+    int selectProfile( float hitsPerRow ) const ;
+
+    /** Summary of the segment merging, the occupancy profiles and of the buffers of all contexts. */
+    std::string statistics() const ;
+
+  protected:
+
+    /** helper method to compute a few track segment parameters (start and end points, z spread,...) - and the 
+     *  geometric domain if the TPC is split into domains 
+     */
+    void computeTrackInfo( lcio::Track* lTrk, const clupatra_new::TPCDomains* domains=0 ) const ;
+
+    /** Create a track collection and add it to the debug collections of the result. */
+    lcio::LCCollectionVec* newDebugCol( const std::string& name, ReconstructionResult& result, bool isSubset=false ) const ;
+
+    /** Fill the hit indices and track states of the final tracks. */
+    void fillTrackResults( ReconstructionResult& result, clupatra_new::ClupaEventContext& ctx ) const ;
+
+    ReconstructorConfig _cfg ;
+    TPCGeometry         _geo ;
+
+    std::vector<ReconstructorConfig> _profileCfgs ; // _cfg with the occupancy profile applied - one per profile
+
+    clupatra_new::ClupaContextPool* _contexts ;
+
+    // counters are updated concurrently from different events
+    std::atomic<unsigned long> _nSegPairsTested ;
+    std::atomic<unsigned long> _nSegPairsPruned ;
+    std::atomic<unsigned long> _nSegPairsMemo ;
+    std::atomic<unsigned long> _nOverBudget ;
+    std::vector< std::atomic<unsigned long> > _nProfileEvents ; // events per profile - last: no profile
+
+  private:
+    Reconstructor( const Reconstructor& ) ; // no copy
+    Reconstructor& operator=( const Reconstructor& ) ;
+  } ;
+
+}
+
+#endif
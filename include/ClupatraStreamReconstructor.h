@@ -0,0 +1,142 @@
+#ifndef ClupatraStreamReconstructor_h
+#define ClupatraStreamReconstructor_h 1
+
+#include <string>
+#include <vector>
+
+#include "ClupatraReconstructor.h"
+
+namespace clupatra{
+
+  /** Parameters of the streaming mode - lengths in mm in the stream coordinate z ( drift time times drift velocity ). */
+  struct StreamConfig{
+
+    StreamConfig() : windowLength(0.), overlap(0.) {}
+
+    double windowLength ;  // length of the sliding window - at most 2 * driftLength, <=0 : 2 * driftLength
+    double overlap ;       // tracks reaching into the last 'overlap' mm of the window are not final - <=0 : driftLength
+  } ;
+
+
+  /** Clupatra pattern recognition for a continuous, time ordered stream of TPC hits. The hits are given in
+   *  arbitrary slices with addHits(), the stream coordinate z of the hits ( drift time times drift velocity )
+   *  can grow without limit. The tracks are found in a sliding window of windowLength in z that is shifted
+   *  into the TPC ( window center at z=0 ) for the reconstruction:
+   *
+   *  - tracks that end before the overlap region at the end of the window are final and are emitted
+   *  - the hits of tracks reaching into the overlap region ( unfinished candidates ) and the free hits in the
+   *    overlap region are carried into the next window, which starts at the first hit of the unfinished
+   *    candidates ( but advances by at least half of windowLength-overlap ) - the candidates are found again
+   *    with the hits of the next slice
+   *  - all other hits are dropped, i.e. the memory is bounded by the number of hits in a window
+   *
+   *  NB: only the hits of the unfinished candidates are carried forward, not the candidates and their fit state:
+   *  they are found and fitted from scratch in the next window, so the hits in the overlap are reconstructed 
+   *  ( at least ) twice.
+   *
+   *  The overlap should be larger than the extent of a track in z ( the drift length ) - longer candidates
+   *  are emitted incomplete when the window would not advance otherwise ( counted in statistics() ).
+   *  The Kalman filter needs hits at their position in the TPC: the position, cellIDs, covariance and energy
+   *  deposit of the stream hits are copied and given to the windows with the shifted z position - no hit 
+   *  handles are needed.
+   *  Windows are reconstructed sequentially - one event context has to be added to reconstructor().
+   *
+   *  The z of a hit in the window is not its position in the TPC, so the stages that depend on it are changed
+   *  in the configuration of the windows ( ReconstructorConfig::streamWindow ): no tracks are classified as 
+   *  forward ( they are merged as incomplete segments ), the global reclustering excludes the inner hits by 
+   *  radius only, the TPC is not split in z ( splitZHalves ) and the region of interest is not used.
+   */
+  class StreamReconstructor{
+  public:
+
+    StreamReconstructor( const ReconstructorConfig& cfg, const TPCGeometry& geo, const StreamConfig& scfg ) ;
+    virtual ~StreamReconstructor() ;
+
+    /** The reconstructor used for the windows - e.g. to add the event context. */
+    Reconstructor& reconstructor() { return _reco ; }
+
+    /** Add the next slice of hits to the stream - the hits get consecutive stream indices starting at the number
+     *  of hits added before. Hits before the start of the current window are too late and are ignored.
+     *  The data of the hits is copied - w/o hit handles the view needs the positions, cellIDs and covariances.
+     */
+    void addHits( const TPCHitView& view ) ;
+
+    /** Reconstruct all complete windows and add the final tracks to 'tracks': the hit indices are stream
+     *  indices and the track states are in the stream coordinate. Returns the number of tracks added.
+     */
+    unsigned process( std::vector<TrackResult>& tracks ) ;
+
+    /** Reconstruct all remaining hits at the end of the stream - all tracks are final. */
+    unsigned flush( std::vector<TrackResult>& tracks ) ;
+
+    /** Start of the current window in the stream coordinate. */
+    double windowStart() const { return _windowStart ; }
+
+    /** Number of windows reconstructed so far. */
+    unsigned long nWindows() const { return _nWindows ; }
+
+    /** Start of the last reconstructed window in the stream coordinate. */
+    double lastWindowStart() const { return _lastWindowStart ; }
+
+    /** Number of tracks emitted before they were complete ( longer than the overlap ). */
+    unsigned long nForced() const { return _nForced ; }
+
+    /** Number of hits held in the window buffer. */
+    unsigned nBuffered() const { return _hits.size() ; }
+
+    /** Summary of the windows, emitted tracks and late hits. */
+    std::string statistics() const ;
+
+  protected:
+
+    /** hit of the stream as buffered for the windows */
+    struct StreamHit{
+      unsigned index ;            // stream index
+      double   pos[3] ;           // position in the stream coordinates
+      int      cellID0 ;
+      int      cellID1 ;
+      float    cov[6] ;
+      float    eDep ;
+    } ;
+
+    /** Reconstruct the current window and shift it - if 'last' all tracks are final. */
+    unsigned reconstructWindow( std::vector<TrackResult>& tracks, bool last ) ;
+
+    /** Find the tracks in the hits of a window ( at their position in the TPC ) - the track results have to 
+     *  be filled with the hit indices in the view. Calls the Reconstructor - can be overwritten, e.g. for tests.
+     */
+    virtual void reconstructWindowHits( const TPCHitView& view, ReconstructionResult& result ) ;
+
+    Reconstructor _reco ;
+
+    double _length ;
+    double _overlap ;
+
+    double _windowStart ;
+    double _lastWindowStart ;
+    bool   _started ;
+    unsigned _nHits ;              // number of hits added - stream index of the next hit
+
+    std::vector<StreamHit> _hits ; // hits of the current and the following windows
+
+    // buffers for the hit view of a window ( position in the TPC ) - kept between windows
+    std::vector<double>    _localPos ;
+    std::vector<int>       _localCellIDs ;
+    std::vector<float>     _localCov ;
+    std::vector<float>     _localEDep ;
+    std::vector<char>      _hitState ;
+    ReconstructionResult   _result ;
+
+    unsigned long _nWindows ;
+    unsigned long _nTracks ;
+    unsigned long _nForced ;
+    unsigned long _nLate ;
+
+  private:
+    StreamReconstructor( const StreamReconstructor& ) ; // no copy
+    StreamReconstructor& operator=( const StreamReconstructor& ) ;
+  } ;
+
+}
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <list>
 #include <vector>
+#include <atomic>
 
 #include "LCRTRelations.h"
 
@@ -28,6 +29,24 @@ namespace nnclu {
   class Cluster ;
 
 
+  /** Summary information of a cluster that is updated incrementally whenever elements are added 
+   *  to the cluster or clusters are merged. The default implementation does nothing - specialize it
+   *  for the element type T to keep e.g. histograms of the elements.
+   *
+   *  @see Cluster
+   */
+  template <class T>
+  struct ClusterSummary{
+    void add( const T* ) {}
+    void merge( const ClusterSummary<T>& ) {}
+    void clear() {}
+    /** called after the elements in [first,last) have been reordered */
+    template <class It> 
+    void reorder( It, It ) {}
+  } ;
+
+
+
   /** Wrapper class for elements that are clustered, holding a pointer to the actual 
    *  object "->first"  and a pointer to the cluster this obejct belongs to "->second". 
    *  
@@ -116,25 +135,43 @@ namespace nnclu {
 
   /** Templated class for generic clusters  of Elements that are clustered with
    *  an NN-like clustering algorithm. Effectively this is just a list of elements.
+   *  The list is private so that the summary can not get out of sync: elements are added with addElement() 
+   *  or mergeClusters() and removed with clear(), the list can be reordered with sort() and reverse().
    * 
    *  @see Element
    *  @author F.Gaede (DESY)
    *  @version $Id$
    */
   template <class T >
-  class Cluster : public std::list< Element<T> * >, public lcrtrel::LCRTRelations {
+  class Cluster : private std::list< Element<T> * >, public lcrtrel::LCRTRelations {
   
   public :
     typedef Element<T> element_type ; 
     typedef std::list< Element<T> * > base ;
 
+    typedef typename base::value_type value_type ;
+    typedef typename base::iterator iterator ;
+    typedef typename base::const_iterator const_iterator ;
+    typedef typename base::reverse_iterator reverse_iterator ;
+    typedef typename base::const_reverse_iterator const_reverse_iterator ;
+    typedef typename base::size_type size_type ;
+
+    using base::begin ;
+    using base::end ;
+    using base::rbegin ;
+    using base::rend ;
+    using base::front ;
+    using base::back ;
+    using base::size ;
+    using base::empty ;
+
     int ID ; //DEBUG
-  
+
     Cluster() : ID(0) {}
   
     /** C'tor that takes the first element */
     Cluster( Element<T>* element)  {
-      static int SID=0 ;  //DEBUG
+      static std::atomic<int> SID(0) ;  //DEBUG
       ID = SID++ ;      //DEBUG
       addElement( element ) ;
     }
@@ -144,8 +181,31 @@ namespace nnclu {
     
       element->second = this ;
       base::push_back( element ) ;
+      _summary.add( element->first ) ;
     }
 
+    /** Remove all elements from the list (w/o changing their cluster association) and reset the summary */
+    void clear() {
+      base::clear() ;
+      _summary.clear() ;
+    }
+
+    /** Sort the elements with the given comparison of element pointers */
+    template <class Compare>
+    void sort( Compare comp ) {
+      base::sort( comp ) ;
+      _summary.reorder( base::begin(), base::end() ) ;
+    }
+
+    /** Reverse the order of the elements */
+    void reverse() {
+      base::reverse() ;
+      _summary.reorder( base::begin(), base::end() ) ;
+    }
+
+    /** Summary of the elements in the cluster - updated by all methods that change the elements or their order */
+    const ClusterSummary<T>& summary() const { return _summary ; }
+
     // /** Remove all elements from the cluster and reset the cluster association, i.e. elements can be
     //  *  used for another clustering procedure.
     //  */
@@ -164,7 +224,7 @@ namespace nnclu {
      */
     void freeElements(){
       
-      for( typename Cluster<T>::iterator it = this->begin(), end = this->end() ; it != end ; it++ ){
+      for( typename Cluster<T>::iterator it = this->begin(), itEnd = this->end() ; it != itEnd ; it++ ){
         (*it)->second = 0 ;
       }
       
@@ -178,10 +238,12 @@ namespace nnclu {
     /** Merges all elements from the other cluster cl into this cluster */
     void mergeClusters( Cluster<T>* cl ) {
       
-      for( typename Cluster<T>::iterator it = cl->begin(), end = cl->end() ; it != end ; it++ ){
+      for( typename Cluster<T>::iterator it = cl->begin(), itEnd = cl->end() ; it != itEnd ; it++ ){
         (*it)->second = this  ;
       }
-      this->merge( *cl ) ;
+      _summary.merge( cl->_summary ) ;
+      cl->_summary.clear() ;
+      base::merge( *cl ) ;
     }
   
     /** D'tor frees all remaining elements that still belong to this cluster */
@@ -190,7 +252,7 @@ namespace nnclu {
       //  typename Cluster<T>::iterator it = this->begin() ;
       //  while( it !=  this->end()  )
     
-      for( typename Cluster<T>::iterator it = this->begin() , end =  this->end()  ;  it != end ; ++it ){
+      for( typename Cluster<T>::iterator it = this->begin() , itEnd =  this->end()  ;  it != itEnd ; ++it ){
       
         typename Cluster<T>::value_type h = *it ; 
       
@@ -199,6 +261,9 @@ namespace nnclu {
       
       }
     }
+
+  private:
+    ClusterSummary<T> _summary ;
   } ;
 
 
@@ -236,51 +301,13 @@ namespace nnclu {
       
         for( In other = first+1 ;   other != last ; other ++ ) {
         
-          if( pred( (*first) , (*other) ) ) {
-          
-            if( (*first)->second == 0 && (*other)->second == 0 ) {  // no cluster exists
-            
-              cluster_type* cl = new cluster_type( (*first) ) ;
-            
-              cl->addElement( (*other) ) ;
-            
-              tmp.push_back( cl ) ;
-            
-            }
-            else if( (*first)->second != 0 && (*other)->second != 0 ) { // two clusters
-            
-              if(  (*first)->second != (*other)->second )  // don't call merge on identical clusters
-                (*first)->second->mergeClusters( (*other)->second ) ;
-            
-            } else {  // one cluster exists
-            
-              if( (*first)->second != 0 ) {
-              
-                (*first)->second->addElement( (*other)  ) ;
-              
-              } else {                           
-              
-                (*other)->second->addElement( (*first)  ) ;
-              }
-            }
-          
-          }
+          if( pred( (*first) , (*other) ) ) 
+            link( *first, *other, tmp ) ;
         }
         ++first ;
       }
     
-      // remove empty clusters 
-      for( typename cluster_vector::iterator i = tmp.begin(); i !=  tmp.end() ; i++ ){
-      
-        if( (*i)->size() > minSize-1 ) {
-        
-          result++ = *i ;
-        } 
-        else {  
-        
-          delete *i ; 
-        }
-      }
+      collect( tmp, result, minSize ) ;
     }
 
 
@@ -301,40 +328,103 @@ namespace nnclu {
           if( notInRange<-1,1>(   (*first)->Index0 - (*other)->Index0  )   ) 
             break ;
 
-          if( pred( (*first) , (*other) ) ) {
-            
-            if( (*first)->second == 0 && (*other)->second == 0 ) {  // no cluster exists
-              
-              cluster_type* cl = new cluster_type( (*first) ) ;
-              
-              cl->addElement( (*other) ) ;
-              
-              tmp.push_back( cl ) ;
-              
-            }
-            else if( (*first)->second != 0 && (*other)->second != 0 ) { // two clusters
-              
-              if(  (*first)->second != (*other)->second )  // don't call merge on identical clusters
-                (*first)->second->mergeClusters( (*other)->second ) ;
-              
-            } else {  // one cluster exists
-              
-              if( (*first)->second != 0 ) {
-                
-                (*first)->second->addElement( (*other)  ) ;
-                
-              } else {                           
-                
-                (*other)->second->addElement( (*first)  ) ;
-              }
-            }
-            
-          }
+          if( pred( (*first) , (*other) ) ) 
+            link( *first, *other, tmp ) ;
         }
         ++first ;
       }
       
-      // remove empty clusters 
+      collect( tmp, result, minSize ) ;
+    }
+
+
+    /** Same as cluster() - but the predicate is only evaluated for the given candidate pairs of indices (i,j) 
+     *  of elements in the range starting at first. If the pairs are sorted in (i,j) with i<j, the result is 
+     *  identical to cluster() for predicates that are false for all other pairs.
+     */
+    template <class In, class PairIt, class Out, class Pred > 
+    void cluster_candidates( In first, PairIt pFirst, PairIt pLast, Out result, Pred& pred , const unsigned minSize=1) {
+      
+      cluster_vector tmp ; 
+      tmp.reserve( 1024 ) ;
+      
+      for(  ; pFirst != pLast ; ++pFirst ) {
+        
+        element_type* e0 = *( first + pFirst->first ) ;
+        element_type* e1 = *( first + pFirst->second ) ;
+        
+        if( pred( e0 , e1 ) ) 
+          link( e0, e1, tmp ) ;
+      }
+      
+      collect( tmp, result, minSize ) ;
+    }
+
+    /** Same as cluster_candidates() - but with the verdicts of the predicate already computed for all candidate
+     *  pairs (e.g. in parallel). The matching pairs are linked in the given order. If exclusive is true, a pair
+     *  is only linked if none of its elements is in a cluster yet - this is equivalent to a predicate that
+     *  rejects elements that have already been clustered (as the TrackSegmentMerger does).
+     */
+    template <class In, class PairIt, class VerdictIt, class Out >
+    void cluster_verdicts( In first, PairIt pFirst, PairIt pLast, VerdictIt verdict, Out result,
+			   bool exclusive, const unsigned minSize=1) {
+
+      cluster_vector tmp ;
+      tmp.reserve( 1024 ) ;
+
+      for(  ; pFirst != pLast ; ++pFirst, ++verdict ) {
+
+        if( ! *verdict )
+          continue ;
+
+        element_type* e0 = *( first + pFirst->first ) ;
+        element_type* e1 = *( first + pFirst->second ) ;
+
+        if( exclusive && ( e0->second != 0 || e1->second != 0 ) )
+          continue ;
+
+        link( e0, e1, tmp ) ;
+      }
+
+      collect( tmp, result, minSize ) ;
+    }
+
+  protected:
+
+    /** Put the two (matching) elements into the same cluster - creates a new cluster or merges existing ones */
+    void link( element_type* e0, element_type* e1, cluster_vector& tmp ) {
+      
+      if( e0->second == 0 && e1->second == 0 ) {  // no cluster exists
+        
+        cluster_type* cl = new cluster_type( e0 ) ;
+        
+        cl->addElement( e1 ) ;
+        
+        tmp.push_back( cl ) ;
+        
+      }
+      else if( e0->second != 0 && e1->second != 0 ) { // two clusters
+        
+        if(  e0->second != e1->second )  // don't call merge on identical clusters
+          e0->second->mergeClusters( e1->second ) ;
+        
+      } else {  // one cluster exists
+        
+        if( e0->second != 0 ) {
+          
+          e0->second->addElement( e1  ) ;
+          
+        } else {                           
+          
+          e1->second->addElement( e0  ) ;
+        }
+      }
+    }
+
+    /** Copy the clusters with at least minSize elements to result - delete all others (e.g. emptied by merging) */
+    template <class Out>
+    void collect( cluster_vector& tmp, Out result, const unsigned minSize ) {
+
       for( typename cluster_vector::iterator i = tmp.begin(); i !=  tmp.end() ; i++ ){
         
         if( (*i)->size() > minSize-1 ) {
@@ -2,11 +2,20 @@
 #define clupatra_new_h
 
 #include <cmath>
+#include <cfloat>
 #include <algorithm>
 #include <time.h>
 #include <math.h>
 #include <sstream>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+#include <map>
+#include <deque>
 #include "assert.h"
 
 #include "NNClusterer.h"
@@ -15,10 +24,14 @@
 #include "DD4hep/LCDD.h"
 #include "DDSurfaces/Vector3D.h"
 #include "DD4hep/DD4hepUnits.h" 
+#include "DDRec/DetectorData.h"
+#include "DDRec/SurfaceManager.h"
 
 #include "lcio.h"
 #include "EVENT/TrackerHit.h"
 #include "IMPL/TrackImpl.h"
+#include "IMPL/TrackerHitImpl.h"
+#include "IMPL/TrackStateImpl.h"
 #include "UTIL/Operators.h"
 #include "UTIL/CellIDDecoder.h"
 #include "UTIL/LCTrackerConf.h"
@@ -28,8 +41,9 @@
 #include "MarlinTrk/IMarlinTrack.h"
 #include "MarlinTrk/IMarlinTrkSystem.h"
 
-// ----- include for verbosity dependend logging ---------
-#include "marlin/VerbosityLevels.h"
+// ----- logging w/o Marlin ---------
+#include "streamlog/streamlog.h"
+#include "streamlog/loglevels.h"
 
 
 /** Helper structs that should go to LCIo to make extraction of layer (and subdetector etc easier )
@@ -40,7 +54,7 @@ namespace lcio{
   } ;
 
   static const BitField64& ILD_cellID( TrackerHit* th ){
-    static ILDDecoder encoder;
+    static thread_local ILDDecoder encoder; // the decoder keeps the last value - one per thread
     return encoder( th );
   }
 
@@ -50,8 +64,37 @@ namespace lcio{
   } ;
 } 
 
+namespace clupatra{
+  struct TPCHitView ;
+  struct RegionOfInterest ;
+}
+
 namespace clupatra_new{
-  
+
+  /** Lock for the log messages: streamlog keeps the level and prefix of the current message in global state
+   *  and is not thread safe. Code that runs in worker threads or for concurrent events writes with
+   *  clupa_out( LEVEL ) instead of streamlog_out( LEVEL ) - the global lock is only taken if the level is active
+   *  and held until the message is written.
+   */
+  class LogLock{
+  public:
+    explicit LogLock( bool active ) : _lock( mutex(), std::defer_lock ), _first( active ) {
+      if( active ) _lock.lock() ;
+    }
+    /** true only for the first call - the body of the clupa_out loop is executed once */
+    bool first() { bool f = _first ; _first = false ; return f ; }
+
+    static std::recursive_mutex& mutex() ;
+
+  private:
+    std::unique_lock<std::recursive_mutex> _lock ;
+    bool _first ;
+  } ;
+
+#define clupa_out( VLEVEL ) for( clupatra_new::LogLock clupa_log_lock( streamlog_level( VLEVEL ) ) ; \
+				 clupa_log_lock.first() && streamlog::out.write< streamlog::VLEVEL >() ; ) streamlog::out()
+
+
   /** Small wrapper extension of the LCIO Hit
    */
   struct ClupaHit {
@@ -71,6 +114,171 @@ namespace clupatra_new{
   
   //  inline lcio::TrackerHit* lcioHit( const ClupaHit* h) { return h->lcioHit ; }
 
+}
+
+namespace nnclu{
+
+  /** Running summary of the hits in a clupatra cluster: number of hits per layer, the number of layers 
+   *  with a given multiplicity, first and last layer, z extent and whether the hits are (still) sorted 
+   *  outwards or inwards in layer.
+   *  The hits per layer are kept sparse, only for the layers with hits ( sorted in layer, i.e. at most the
+   *  number of pad rows ), the multiplicity histogram up to the largest multiplicity. Hits are usually added 
+   *  in the order of the layers, so that add() appends or increments the last entry. 
+   *  NB: the summary is updated by the Cluster - it can not be modified from the outside.
+   */
+  template <>
+  struct ClusterSummary<clupatra_new::ClupaHit>{
+
+    typedef std::pair<int,unsigned> LayerCount ;   // layer and number of hits in the layer
+
+    ClusterSummary() { clear() ; }
+
+    std::vector<LayerCount> layerCounts ;  // layers with hits, sorted in layer
+    std::vector<unsigned> layersWithNHits ; // number of layers with exactly n hits, n < layersWithNHits.size()
+    unsigned nHit ;
+    int firstLayer ;
+    int lastLayer ;
+    int backLayer ;  // layer of the last hit in the list
+    double zMin ;
+    double zMax ;
+    bool sortedOut ;
+    bool sortedIn ;
+
+    void clear() {
+      layerCounts.clear() ;
+      layersWithNHits.clear() ;
+      nHit = 0 ;
+      firstLayer = lastLayer = backLayer = -1 ;
+      zMin =  DBL_MAX ; 
+      zMax = -DBL_MAX ;
+      sortedOut = sortedIn = true ;
+    }
+
+    void add( const clupatra_new::ClupaHit* h ) {
+
+      int l = h->layer ;
+
+      if( nHit == 0 ){
+	firstLayer = lastLayer = l ;
+      } else {
+	sortedOut = sortedOut && l >= backLayer ;
+	sortedIn  = sortedIn  && l <= backLayer ;
+	if( l < firstLayer ) firstLayer = l ;
+	if( l > lastLayer  ) lastLayer  = l ;
+      }
+      backLayer = l ;
+      ++nHit ;
+
+      double z = h->pos.z() ;
+      if( z < zMin ) zMin = z ;
+      if( z > zMax ) zMax = z ;
+
+      std::vector<LayerCount>::iterator it = layerCounts.end() ;
+
+      if( layerCounts.empty() || layerCounts.back().first < l ) 
+	it = layerCounts.insert( layerCounts.end(), LayerCount( l, 0 ) ) ;
+      else if( layerCounts.back().first == l ) 
+	it = layerCounts.end() - 1 ;
+      else {
+	it = std::lower_bound( layerCounts.begin(), layerCounts.end(), LayerCount( l, 0 ) ) ;
+	if( it->first != l ) 
+	  it = layerCounts.insert( it, LayerCount( l, 0 ) ) ;
+      }
+
+      countLayer( it->second , 1 ) ;
+      ++it->second ;
+    }
+
+    void merge( const ClusterSummary& o ) {
+
+      if( o.nHit == 0 ) 
+	return ;
+
+      if( nHit == 0 ){ // merging into an empty list preserves the order
+	*this = o ;
+	return ;
+      }
+
+      // merge the sorted layer lists 
+      std::vector<LayerCount> merged ;
+      merged.reserve( layerCounts.size() + o.layerCounts.size() ) ;
+
+      std::vector<LayerCount>::const_iterator a = layerCounts.begin(), b = o.layerCounts.begin() ;
+
+      while( a != layerCounts.end() || b != o.layerCounts.end() ){
+
+	if( b == o.layerCounts.end() || ( a != layerCounts.end() && a->first < b->first ) )
+	  merged.push_back( *a++ ) ;
+	else if( a == layerCounts.end() || b->first < a->first ){
+	  countLayer( 0, b->second ) ;
+	  merged.push_back( *b++ ) ;
+	} else {
+	  countLayer( a->second, b->second ) ;
+	  merged.push_back( LayerCount( a->first, a->second + b->second ) ) ;
+	  ++a ; ++b ;
+	}
+      }
+      layerCounts.swap( merged ) ;
+
+      nHit += o.nHit ;
+      if( o.firstLayer < firstLayer ) firstLayer = o.firstLayer ;
+      if( o.lastLayer  > lastLayer  ) lastLayer  = o.lastLayer ;
+      if( o.zMin < zMin ) zMin = o.zMin ;
+      if( o.zMax > zMax ) zMax = o.zMax ;
+
+      // std::list::merge does not preserve any layer ordering
+      sortedOut = sortedIn = false ;
+      backLayer = -1 ;
+    }
+
+    /** Check the layer order of the hits after the list has been reordered */
+    template <class It>
+    void reorder( It first, It last ) {
+
+      sortedOut = sortedIn = true ;
+      backLayer = -1 ;
+
+      for( It it = first ; it != last ; ++it ){
+
+	int l = (*it)->first->layer ;
+
+	if( it != first ){
+	  sortedOut = sortedOut && l >= backLayer ;
+	  sortedIn  = sortedIn  && l <= backLayer ;
+	}
+	backLayer = l ;
+      }
+    }
+
+    /** Number of hits in layer l */
+    unsigned hitsInLayer( int l ) const {
+      std::vector<LayerCount>::const_iterator it = std::lower_bound( layerCounts.begin(), layerCounts.end(), LayerCount( l, 0 ) ) ;
+      return ( it != layerCounts.end() && it->first == l ? it->second : 0 ) ;
+    }
+
+    /** Number of layers with exactly n hits */
+    unsigned nLayersWithNHits( unsigned n ) const {
+      return ( n < layersWithNHits.size() ? layersWithNHits[n] : 0 ) ;
+    }
+
+    /** Number of hits in layers with more than one hit */
+    unsigned nDuplicate() const { 
+      return nHit - nLayersWithNHits( 1 ) ; 
+    }
+
+  private:
+    /** move one layer with currently m hits to m+n hits in the multiplicity histogram */
+    void countLayer( unsigned m, unsigned n ){
+      if( layersWithNHits.size() <= m + n ) 
+	layersWithNHits.resize( m + n + 1 ) ;
+      if( m ) --layersWithNHits[ m ] ;
+      ++layersWithNHits[ m + n ] ;
+    }
+  } ;
+}
+
+namespace clupatra_new{
+
   
 //------------------ typedefs for elements and clusters ---------
 
@@ -82,9 +290,333 @@ namespace clupatra_new{
   typedef Clusterer::element_vector HitVec ;
   typedef Clusterer::cluster_vector CluTrackVec ;
   
-  typedef std::list<Hit*>        HitList ;
+  typedef std::vector<Hit*>      HitList ;
   typedef std::vector< HitList > HitListVector ;
   
+  /** Remove the hit from the list (if present) - keeps the order of the remaining hits. */
+  inline void removeHit( HitList& hL, Hit* h ){
+    hL.erase( std::remove( hL.begin(), hL.end(), h ), hL.end() ) ;
+  }
+
+  /** Resize the HitListVector to n layers and clear all lists - the lists keep their capacity. */
+  inline void resetHitListVector( HitListVector& hLV, unsigned n ){
+    hLV.resize( n ) ;
+    for( unsigned i=0 ; i<n ; ++i ) 
+      hLV[i].clear() ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  /** Lookup of the silicon hits per sensor (cellID0) for the pick up of Si hits: the hits of every sensor are 
+   *  stored in one contiguous range, sorted into a grid in the local (u,v) coordinates of the sensor, so 
+   *  that only the hits close to an intersection point are tested. The measurement direction u of every 
+   *  hit is precomputed. Sensors with hits that are not TrackerHitPlanes or have different u directions 
+   *  are searched linearly. Ties are resolved in the order the hits were added.
+   */
+  class SiHitIndex{
+  public:
+
+    struct SiHit{
+      lcio::TrackerHit* hit ;
+      double pos[3] ;
+      double dir[3] ;   // measurement direction u (strips)
+      double u, v ;     // local coordinates on the sensor
+      unsigned order ;  // order in which the hit was added
+      bool taken ;
+    } ;
+
+    /** Remove all hits - keeps the allocated memory. */
+    void clear() ;
+
+    /** Add a hit - call build() after all hits have been added. */
+    void add( lcio::TrackerHit* hit ) { _input.push_back( hit ) ; }
+
+    /** Sort the hits into the sensor ranges and the (u,v) grids - cellSize should be the search distance. */
+    void build( double cellSize ) ;
+
+    /** The closest hit on the sensor that has not been taken yet - the distance is measured along u for 
+     *  strip hits and in 3D otherwise. Returns 0 if there is no hit with a squared distance <= maxDist2.
+     */
+    SiHit* closest( int sensorID, const double* point, bool isStrip, double maxDist2, double& dist2 ) ;
+
+    /** Same as closest() but searches all sensors of the ladder given by ladderKey( cellID0 ). */
+    SiHit* closestOnLadder( int ladderKey, const double* point, bool isStrip, double maxDist2, double& dist2 ) ;
+
+    /** The cellID0 w/o the side and sensor fields, i.e. subdetector, layer and module (ladder). */
+    static int ladderKey( int cellID0 ) ;
+
+    /** Sensor IDs and number of hits per sensor, in the order of the first hit. */
+    const std::vector<int>& sensors() const { return _sensorIDs ; }
+    unsigned nHits( int sensorID ) const ;
+
+  protected:
+
+    struct Sensor{
+      unsigned first, n ;     // range in _hits
+      bool indexed ;          // grid available
+      double origin[3], u[3], v[3] ;
+      double uMin, vMin, cell ;
+      int nu, nv ;
+      unsigned cellOffset ;   // start of the cells in _cellStart
+      int nextOnLadder ;      // next sensor with hits on the same ladder ( -1 : none )
+    } ;
+
+    void searchSensor( const Sensor& sen, const double* point, bool isStrip, double maxDist2, SiHit*& best, double& dist2 ) ;
+
+    std::vector<lcio::TrackerHit*> _input ;
+    std::vector<SiHit>             _hits ;
+    std::vector<unsigned>          _cellStart ;
+    std::vector<int>               _sensorIDs ;
+    std::vector<Sensor>            _sensorVec ;
+    std::unordered_map<int,unsigned> _sensorIndex ; 
+    std::unordered_map<int,unsigned> _ladderIndex ;  // first sensor on the ladder
+    std::vector<unsigned>          _tmp ;
+    std::vector<SiHit>             _buf ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Result of the Si hit pick up for one track: computed w/o modifying the track or the SiHitIndex, 
+   *  so that it can be done for several tracks concurrently and applied later.
+   */
+  struct SiPickUpResult{
+
+    SiPickUpResult() : ok(false), tsIP(0), chi2(0.), ndf(0) {}
+    ~SiPickUpResult() { delete tsIP ; }
+
+    bool ok ;                                  // the MarlinTrk track could be created 
+    std::vector<SiHitIndex::SiHit*> added ;    // hits added to the track
+    std::vector<SiHitIndex::SiHit*> selected ; // best matching hits - added or not
+    lcio::TrackStateImpl* tsIP ;               // new track state at the IP ( owned until applied )
+    double chi2 ;
+    int ndf ;
+
+    /** True if one of the selected hits has been taken (by another track) in the meantime. */
+    bool conflicts() const {
+      for( unsigned i=0 ; i<selected.size() ; ++i ) 
+	if( selected[i]->taken ) return true ;
+      return false ;
+    }
+
+    void clear(){ 
+      ok = false ; added.clear() ; selected.clear() ; 
+      delete tsIP ; tsIP = 0 ; chi2 = 0. ; ndf = 0 ; 
+    }
+
+  private:
+    SiPickUpResult( const SiPickUpResult& ) ;
+    SiPickUpResult& operator=( const SiPickUpResult& ) ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Table of the ladders of the ZPlanar Si trackers (VXD, SIT) for the analytic intersection of tracks 
+   *  with the layers. Layers are numbered in the order they are added (VXD first in Clupatra), the ladders
+   *  of a layer are keyed by the module field of the cellID.
+   */
+  class SiLadderTable{
+  public:
+
+    struct Ladder{
+      double nx, ny ;     // normal of the ladder plane
+      double dist ;       // distance of the (middle of the) sensitive plane from the origin 
+      double offset ;     // offset of the center of the sensitive area in the plane ( along ( -ny, nx ) )
+      double halfWidth ;  
+      double zMin, zMax ;
+    } ;
+
+    /** Add the layers of the detector with the ILDDetID detID from its sensitive DDRec surfaces - the 
+     *  sensors of a ladder are combined, the ladders are keyed by the decoded module field of the surface ID.
+     */
+    void addLayers( const DD4hep::DDRec::SurfaceMap& surfaces, int detID ) ;
+
+    unsigned nLayers() const { return _layers.size() ; }
+    int detID( unsigned lx ) const { return _detIDs[lx] ; }
+    int layer( unsigned lx ) const { return _layerNums[lx] ; }
+
+    /** The closest intersection (in path length) of the helix given by the track state with a ladder of 
+     *  layer lx in the given direction ( +1 along the momentum, -1 backwards ) - the ladder boundaries are 
+     *  extended by tolerance. Returns the module number and the intersection point or -1 if there is no 
+     *  intersection. Neglects material and field inhomogeneities.
+     */
+    int intersect( const lcio::TrackState& ts, unsigned lx, int direction, double tolerance, double* point ) const ;
+
+    /** Direction of the extrapolation from the track state towards the IP ( +1 or -1 ). */
+    static int inwardDirection( const lcio::TrackState& ts ) ;
+
+  protected:
+    std::vector< std::map<int,Ladder> > _layers ;
+    std::vector<int> _detIDs ;
+    std::vector<int> _layerNums ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Geometric decomposition of the TPC into independent domains for the segment finding: the two 
+   *  halves in z ( split at the cathode ) and/or nPhi sectors in phi. Every hit belongs to exactly one 
+   *  domain - segments that end within 'margin' [mm] of a domain boundary are candidates for stitching.
+   */
+  class TPCDomains{
+  public:
+    TPCDomains( bool splitZ, unsigned nPhi, double margin ) : 
+      _nZ( splitZ ? 2 : 1 ), _nPhi( nPhi > 0 ? nPhi : 1 ), _margin( margin ) {}
+
+    /** Number of domains - 1 if the TPC is not split. */
+    unsigned size() const { return _nZ * _nPhi ; }
+
+    /** Index of the domain that contains the point. */
+    unsigned index( const DDSurfaces::Vector3D& pos ) const ;
+
+    /** Distance [mm] of the point to the closest domain boundary ( large if the TPC is not split ). */
+    double boundaryDistance( const DDSurfaces::Vector3D& pos ) const ;
+
+    /** True if the point is within the margin of a domain boundary. */
+    bool nearBoundary( const DDSurfaces::Vector3D& pos ) const { return boundaryDistance( pos ) < _margin ; }
+
+  protected:
+    unsigned _nZ ;
+    unsigned _nPhi ;
+    double   _margin ;
+  } ;
+
+  struct ClupaWorkspace ;
+
+  /** Distribute the hits in the pad rows to the hit lists of the domains in ws.domains - the order of 
+   *  the hits within a pad row is kept.
+   */
+  void splitIntoDomains( const HitListVector& hitsInLayer, const TPCDomains& domains, ClupaWorkspace& ws ) ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Counts how often the capacity of re-used buffers was sufficient. */
+  struct ClupaBuffers{
+
+    ClupaBuffers() : nReused(0), nGrown(0) {}
+
+    unsigned nReused ;
+    unsigned nGrown ;
+
+    /** Clear the vector and make sure it has a capacity of at least n - counts whether the existing 
+     *  capacity could be re-used.
+     */
+    template <class V>
+    void prepare( V& v, size_t n ){
+      if( v.capacity() >= n ) ++nReused ; else ++nGrown ;
+      v.clear() ;
+      v.reserve( n ) ;
+    }
+
+    /** Clear the hit lists and resize to n layers. */
+    void prepareLayers( HitListVector& hLV, unsigned n ){
+      if( hLV.size() == n ) ++nReused ; else ++nGrown ;
+      resetHitListVector( hLV, n ) ;
+    }
+  } ;
+
+  /** Hit lists for the segment finding in one geometric domain of the TPC ( see TPCDomains ) - the 
+   *  domains are processed concurrently, so every domain has its own buffers.
+   */
+  struct ClupaDomainBuffers : ClupaBuffers {
+
+    HitListVector hitsInLayer ; // hits of the domain per pad row
+    HitVec        windowHits ;  
+    HitVec        seedHits ;    
+  } ;
+
+  /** Buffers for the pattern recognition that are kept by the processor and re-used between events
+   *  (and between pad row windows): they are cleared but keep their capacity, so that in steady state
+   *  no heap allocation is needed for the hits and hit lists. 
+   */
+  struct ClupaWorkspace : ClupaBuffers {
+
+    ClupaWorkspace() : nEvents(0) {}
+
+    std::vector<EVENT::TrackerHit*> hitHandles ; // LCIO hits of the event for the hit view
+    std::deque<IMPL::TrackerHitImpl> viewHits ;  // LCIO hits created for hit views w/o handles ( stable addresses )
+    std::vector<ClupaHit> clupaHits ;   // wrapper hits for all TPC hits
+    std::vector<Hit>      hitStore ;    // the nnclu elements - owns the hits in nncluHits
+    HitVec                nncluHits ;   // pointers into hitStore
+    HitListVector         hitsInLayer ; // hits per pad row
+    HitVec                windowHits ;  // hits in current pad row window (seeding/reclustering)
+    HitVec                seedHits ;    // hits of rejected seed clusters
+    std::vector<int>      hitKey ;      // (layer,zIndex) bucket of every input hit (-1: not used)
+    std::vector<unsigned> hitOrder ;    // input hit indices sorted in (layer,zIndex) buckets
+    std::vector<unsigned> bucketStart ; // start of the (layer,zIndex) buckets in hitOrder
+    SiHitIndex            siHits ;      // silicon hits per sensor for the Si hit pick up
+    std::vector<unsigned> houghVotes ;  // accumulator for the looper finding
+    std::vector<ClupaDomainBuffers> domains ; // hit lists per geometric domain ( if the TPC is split )
+
+    unsigned nEvents ;
+
+    /** Summary of buffer re-use and memory held by the workspace. */
+    std::string statistics() const ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** All mutable state needed for the reconstruction of one event: the tracking system(s) - the Kalman
+   *  filter keeps state in there - and the workspace buffers. Events that are processed concurrently
+   *  use different contexts.
+   */
+  struct ClupaEventContext{
+
+    ClupaEventContext() : trkSystem(0) {}
+
+    MarlinTrk::IMarlinTrkSystem* trkSystem ;                // used for all serial fits of the event
+    std::vector<MarlinTrk::IMarlinTrkSystem*> trkSystems ;  // one per thread for the parallel stages - [0] is trkSystem
+    ClupaWorkspace ws ;                                     // buffers re-used between events
+  } ;
+
+  /** Fixed set of event contexts shared by concurrent calls of the reconstruction - acquire() blocks
+   *  until a context is free. The pool owns the contexts, but not their tracking systems.
+   */
+  class ClupaContextPool{
+  public:
+    ClupaContextPool() {}
+    ~ClupaContextPool() { clear() ; }
+
+    /** Add a context - takes ownership. */
+    void add( ClupaEventContext* ctx ) ;
+
+    /** Get a free context - waits if all contexts are in use. */
+    ClupaEventContext* acquire() ;
+
+    /** Return a context obtained with acquire() to the pool. */
+    void release( ClupaEventContext* ctx ) ;
+
+    /** Delete all contexts - must not be called while contexts are in use. */
+    void clear() ;
+
+    unsigned size() const { return _all.size() ; }
+
+    const std::vector<ClupaEventContext*>& contexts() const { return _all ; }
+
+  protected:
+    ClupaContextPool( const ClupaContextPool& ) ; // no copy
+    ClupaContextPool& operator=( const ClupaContextPool& ) ;
+
+    std::vector<ClupaEventContext*> _all ;
+    std::vector<ClupaEventContext*> _free ;
+    std::mutex _mutex ;
+    std::condition_variable _cond ;
+  } ;
+
+  /** Holds a context from the pool for the lifetime of the object. */
+  class ClupaContextLock{
+  public:
+    ClupaContextLock( ClupaContextPool& pool ) : _pool( pool ), _ctx( pool.acquire() ) {}
+    ~ClupaContextLock() { _pool.release( _ctx ) ; }
+
+    ClupaEventContext& context() { return *_ctx ; }
+
+  protected:
+    ClupaContextLock( const ClupaContextLock& ) ; // no copy
+    ClupaContextLock& operator=( const ClupaContextLock& ) ;
+
+    ClupaContextPool&  _pool ;
+    ClupaEventContext* _ctx ;
+  } ;
+  
 
   // typedef GenericHitVec<ClupaHit>      GHitVec ;
   // typedef GenericClusterVec<ClupaHit>  GClusterVec ;
@@ -92,6 +624,112 @@ namespace clupatra_new{
   //------------------------------------------------------------------------------------------
  
   struct GHit : lcrtrel::LCExtension<GHit, Hit > {} ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Fast decoding of one field of the cellID of tracker hits with precomputed mask and offset 
+   *  (instead of setting the full value of a BitField64 via a CellIDDecoder).
+   */
+  class CellIDField{
+  public:
+    CellIDField( const std::string& encoding, size_t index ){
+      UTIL::BitField64 bf( encoding ) ;
+      const UTIL::BitFieldValue& bfv = bf[ index ] ;
+      _mask   = bfv.mask() ;
+      _offset = bfv.offset() ;
+      _width  = bfv.width() ;
+      _signed = bfv.isSigned() ;
+    }
+
+    inline int operator()( const lcio::TrackerHit* th ) const {
+      
+      lcio::long64 id = ( lcio::long64( th->getCellID1() ) << 32 ) | lcio::long64( unsigned( th->getCellID0() ) ) ;
+      lcio::long64 val = ( id & _mask ) >> _offset ;
+
+      if( _signed && ( val & ( 1LL << ( _width - 1 ) ) ) ) 
+	val -= ( 1LL << _width ) ;
+
+      return int( val ) ;
+    }
+
+    inline int operator()( int cellID0, int cellID1 ) const {
+      
+      lcio::long64 id = ( lcio::long64( cellID1 ) << 32 ) | lcio::long64( unsigned( cellID0 ) ) ;
+      lcio::long64 val = ( id & _mask ) >> _offset ;
+
+      if( _signed && ( val & ( 1LL << ( _width - 1 ) ) ) ) 
+	val -= ( 1LL << _width ) ;
+
+      return int( val ) ;
+    }
+
+  protected:
+    lcio::long64 _mask ;
+    unsigned _offset ;
+    unsigned _width ;
+    bool _signed ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Call f( begin, end ) for nThreads contiguous chunks of the index range [0,n) in parallel - the first 
+   *  chunk is processed in the calling thread. Runs serially if nThreads < 2 or n is small.
+   */
+  template <class F>
+  void parallel_for_chunks( unsigned n, unsigned nThreads, F f ){
+
+    if( nThreads < 2 || n < 2 * nThreads ) {
+      f( 0, n ) ;
+      return ;
+    }
+
+    unsigned chunk = ( n + nThreads - 1 ) / nThreads ;
+
+    std::vector<std::thread> threads ;
+    threads.reserve( nThreads - 1 ) ;
+
+    for( unsigned b = chunk ; b < n ; b += chunk )
+      threads.push_back( std::thread( f, b, std::min( n, b + chunk ) ) ) ;
+
+    f( 0, chunk ) ;
+
+    for( unsigned i=0 ; i < threads.size() ; ++i ) 
+      threads[i].join() ;
+  }
+  
+  //------------------------------------------------------------------------------------------
+
+  /** Call f( i, iThread ) for every index i in [0,n) using nThreads threads, where iThread in [0,nThreads) 
+   *  identifies the calling thread (e.g. for per thread resources). Indices are handed out one by one, 
+   *  so that the load is balanced for tasks of very different cost. Runs serially if nThreads < 2.
+   */
+  template <class F>
+  void parallel_for_each_index( unsigned n, unsigned nThreads, F f ){
+
+    if( nThreads < 2 || n < 2 ) {
+      for( unsigned i=0 ; i<n ; ++i ) 
+	f( i, 0 ) ;
+      return ;
+    }
+
+    std::atomic<unsigned> next( 0 ) ;
+
+    auto work = [&]( unsigned iThread ){
+      for( unsigned i = next++ ; i < n ; i = next++ ) 
+	f( i, iThread ) ;
+    } ;
+
+    std::vector<std::thread> threads ;
+    threads.reserve( nThreads - 1 ) ;
+
+    for( unsigned t=1 ; t < nThreads ; ++t )
+      threads.push_back( std::thread( work, t ) ) ;
+
+    work( 0 ) ;
+
+    for( unsigned i=0 ; i < threads.size() ; ++i ) 
+      threads[i].join() ;
+  }
   
   //------------------------------------------------------------------------------------------
 
@@ -101,6 +739,36 @@ namespace clupatra_new{
   
   struct DChi2 : lcrtrel::LCFloatExtension<DChi2> {} ; 
 
+  //------------------------------------------------------------------------------------------
+
+  /** Compact snapshot of a fitted track segment that is kept with the LCIO track after the
+   *  MarlinTrk (KalTest track ~1MByte) has been deleted: the track states (w/ covariance) at the
+   *  first and last hit, the corresponding hits and the hits used in the fit with their delta chi2.
+   */
+  struct TrackFitSnapshot{
+    TrackFitSnapshot() : firstHit(0), lastHit(0), chi2(0.), ndf(0) {}
+    IMPL::TrackStateImpl atFirstHit ;
+    IMPL::TrackStateImpl atLastHit ;
+    lcio::TrackerHit* firstHit ;
+    lcio::TrackerHit* lastHit ;
+    std::vector<std::pair<lcio::TrackerHit*, double> > hitsInFit ; // in fit order, i.e. inwards
+    double chi2 ;
+    int ndf ;
+  } ;
+  struct FitSnapshot : lcrtrel::LCOwnedExtension<FitSnapshot, TrackFitSnapshot> {} ;
+
+  /** Create a new MarlinTrk from the snapshot that is initialised with the track state at the first (last) hit - 
+   *  the hit itself is added as (dummy) hit. Returns 0 if this fails.
+   */
+  MarlinTrk::IMarlinTrack* createTrackFromSnapshot( MarlinTrk::IMarlinTrkSystem* trkSys, const TrackFitSnapshot& snap, 
+						    bool atFirstHit, double bfield, bool fitDirection=MarlinTrk::IMarlinTrack::backward ) ;
+
+  /** Create a new MarlinTrk initialised with the given track state of the LCIO track - the first hit of the track
+   *  is added as (dummy) hit. Used for tracks w/o a fit snapshot. Returns 0 if this fails.
+   */
+  MarlinTrk::IMarlinTrack* createTrackFromState( MarlinTrk::IMarlinTrkSystem* trkSys, const lcio::Track* trk, 
+						 int location, double bfield ) ;
+
   //----------------------------------------------------------------
 
   /** Simple predicate class for computing an index from N bins of the z-coordinate of LCObjects
@@ -154,7 +822,7 @@ namespace clupatra_new{
     
     while( first != last ){
 
-      streamlog_out( DEBUG ) << "  add hit << "  <<   *first << " to layer " <<  (*first)->first->layer  << std::endl ;
+      clupa_out( DEBUG ) << "  add hit << "  <<   *first << " to layer " <<  (*first)->first->layer  << std::endl ;
 
       hLV[ (*first)->first->layer ].push_back( *first )  ;
       ++first ;
@@ -163,6 +831,24 @@ namespace clupatra_new{
 
   //------------------------------------------------------------------------------------------
 
+  /** Create the clupa hits and the clustering hits in the workspace for all hits in the view 
+   *  with |z| <= driftLength ( and inside the region of interest if given ) and fill ws.hitsInLayer 
+   *  with the hits sorted in z per layer. For a view w/o hit handles the LCIO hits are filled in ws.viewHits. 
+   *  The cellIDs are decoded and the positions copied in nThreads parallel chunks - the hits are then sorted 
+   *  into (layer,zIndex) buckets with a counting sort. The clupa hit i belongs to hit i of the view.
+   *  Returns the number of hits used.
+   */
+  unsigned ingestTPCHits( const clupatra::TPCHitView& view, ClupaWorkspace& ws, unsigned nLayers, double driftLength, 
+			  int nZBins, unsigned nThreads=1, const clupatra::RegionOfInterest* roi=0 ) ;
+
+  /** Change the binning in z of the hits created by ingestTPCHits in place: recomputes the zIndex of the 
+   *  hits and the (layer,zIndex) buckets - the hits are already sorted in (layer,z) which does not depend 
+   *  on the number of bins, so neither the hits nor their order change.
+   */
+  void rebinTPCHits( ClupaWorkspace& ws, unsigned nLayers, double driftLength, int nZBins ) ;
+
+  //------------------------------------------------------------------------------------------
+
   /** Predicate class for 'distance' of NN clustering. */
   class HitDistance{
   public:
@@ -219,12 +905,14 @@ namespace clupatra_new{
   struct LCIOTrackConverter{
     
     bool UsePropagate ;
+    bool Light ;                             // only the fitted states at the hits and the extrapolation to the IP - no smoothing, no calo state
     unsigned CaloFaceBarrelID ; 
     unsigned CaloFaceEndcapID ; 
 
     LCIOTrackConverter() : UsePropagate(false ) , 
+			   Light( false ),
 			   CaloFaceBarrelID( lcio::ILDDetID::ECAL) , 
-			   CaloFaceEndcapID( lcio::ILDDetID::ECAL_ENDCAP){} 
+			   CaloFaceEndcapID( lcio::ILDDetID::ECAL_ENDCAP) {} 
 
     lcio::Track* operator() (CluTrack* c) ;
 
@@ -250,21 +938,8 @@ namespace clupatra_new{
 
     bool operator()(const CluTrack* cl) const {
  
-      // check for duplicate layer numbers
-      std::vector<int> hLayer( _N )  ; 
-      typedef CluTrack::const_iterator IT ;
-
-      unsigned nHit = 0 ;
-      for(IT it=cl->begin() ; it != cl->end() ; ++it ) {
-	++ hLayer[ (*it)->first->layer]   ;
-	++ nHit ;
-      } 
-      unsigned nDuplicate = 0 ;
-      for(unsigned i=0 ; i < _N ; ++i ) {
-	if( hLayer[i] > 1 ) 
-	  nDuplicate += hLayer[i] ;
-      }
-      return double(nDuplicate)/nHit > _f ;
+      // check for duplicate layer numbers - use the running summary of the cluster
+      return double( cl->summary().nDuplicate() ) / cl->summary().nHit > _f ;
     }
   };
 
@@ -277,6 +952,20 @@ namespace clupatra_new{
   struct LayerSortIn{
     bool operator()( const Hit* l, const Hit* r) { return l->first->layer > r->first->layer ; }
   } ;
+
+  /** Sort the cluster outwards (inwards) in layer - nothing is done if the cluster summary shows 
+   *  that the hits are already sorted.
+   */
+  inline void sortLayers( CluTrack* clu, bool outwards ){
+    
+    if( outwards ? clu->summary().sortedOut : clu->summary().sortedIn ) 
+      return ;
+
+    if( outwards ) 
+      clu->sort( LayerSortOut() ) ;
+    else
+      clu->sort( LayerSortIn() ) ;
+  }
   
   
 
@@ -300,9 +989,9 @@ namespace clupatra_new{
 
   /** Try to add hits from hLV (hit lists per layer) to the cluster. The cluster needs to have a fitted KalTrack associated to it.
    *  Hits are added if the resulting delta Chi2 is less than dChiMax - a maxStep is the maximum number of steps (layers) w/o 
-   *  successfully merging a hit.
+   *  successfully merging a hit. nPadRows is the number of pad rows of the TPC.
    */
-  int addHitsAndFilter( CluTrack* clu, HitListVector& hLV , double dChiMax, double chi2Cut, unsigned maxStep, ZIndex& zIndex,  bool backward=false, 
+  int addHitsAndFilter( CluTrack* clu, HitListVector& hLV , double dChiMax, double chi2Cut, unsigned maxStep, ZIndex& zIndex, int nPadRows, bool backward=false, 
 			MarlinTrk::IMarlinTrkSystem* trkSys=0) ; 
   //------------------------------------------------------------------------------------------
   
@@ -316,6 +1005,35 @@ namespace clupatra_new{
    */
   void split_multiplicity( Clusterer::cluster_list& cluList, int layersWithMultiplicity , int N=5) ;
 
+  //------------------------------------------------------------------------------------------
+
+  /** Parameters for the early tagging of loopers, i.e. low pt tracks from the IP that curl many times in the TPC. */
+  struct LooperFinderParams{
+    LooperFinderParams() : rMax(900.), rBinSize(5.), nPhiBins(180), outerRowFraction(0.5), minVotes(25), minHits(100), 
+			   minHitsPerLayer(4.), maxDist(5.), maxDZ(10.), minZSpan(50.), minSegmentHits(5) {}
+    float rMax ;            // maximum radius of the circles (mm) 
+    float rBinSize ;        // bin size of the circle radius in the Hough transform (mm)
+    int   nPhiBins ;        // number of bins for the azimuth of the circle center 
+    float outerRowFraction ; // only the hits in this fraction of the outer pad rows vote in the Hough transform
+    unsigned minVotes ;     // minimum number of votes of a circle 
+    unsigned minHits ;      // minimum number of hits on the circle
+    float minHitsPerLayer ; // minimum average number of hits per pad row ( 2 per full turn )
+    float maxDist ;         // maximum distance of the hits from the circle (mm)
+    float maxDZ ;           // maximum distance in z of the hits from the helix (mm)
+    float minZSpan ;        // minimum z extent - needed to separate the turns 
+    unsigned minSegmentHits ; // minimum number of hits in a segment ( half turn ) 
+  } ;
+
+  /** Find loopers with a Hough transform in the space of the centers of circles through the origin: every 
+   *  hit in the outer pad rows votes for all circles with radius <= rMax through the hit ( loopers that do 
+   *  not reach the outer rows are left to the seeding ). The circles are refitted with the hits of all pad rows,
+   *  only hits that are also within maxDZ in z of the helix are kept. Circles with many hits per pad row 
+   *  are split into segments, with the hits sorted in z, where the direction in pad row changes (i.e. half turns). 
+   *  The segments are added to cluList and their hits are removed from hitsInLayer. Returns the number of loopers found.
+   */
+  unsigned findLoopers( HitListVector& hitsInLayer, const LooperFinderParams& p, Clusterer::cluster_list& cluList, 
+			ClupaWorkspace& ws ) ;
+
   //------------------------------------------------------------------------------------------
   /** Returns the number of rows where cluster clu has i hits in mult[i] for i=1,2,3,4,.... -
    *  mult[0] counts all rows that have hits
@@ -335,7 +1053,8 @@ namespace clupatra_new{
   void create_three_clusters( Clusterer::cluster_type& clu, Clusterer::cluster_list& cluVec ) ;
 
 
-  /** Split the cluster into N clusters.
+  /** Split the cluster into n clusters ( 2 <= n <= 9 ) - hits are assigned layer by layer using only layers 
+   *  with exactly n hits. Note: the hits in clu are sorted inwards in layer.
    */
   void create_n_clusters( Clusterer::cluster_type& clu, Clusterer::cluster_list& cluVec ,  unsigned n ) ;
 
@@ -344,7 +1063,8 @@ namespace clupatra_new{
   //=======================================================================================
 
   struct TrackInfoStruct{  
-    TrackInfoStruct() : zMin(0.), zAvg(0.), zMax(0.), startsInner(false), isCentral(false), isForward(false), isCurler(false) {}
+    TrackInfoStruct() : zMin(0.), zAvg(0.), zMax(0.), startsInner(false), isCentral(false), isForward(false), isCurler(false),
+			domain(-1), atDomainBoundary(false), hasCircle(false), x0(0.), y0(0.), r(0.), tanL(0.), zFirst(0.) {}
     float zMin ;
     float zAvg ;
     float zMax ;
@@ -352,6 +1072,31 @@ namespace clupatra_new{
     bool isCentral   ;
     bool isForward   ;
     bool isCurler    ;
+
+    // geometric domain of the first hit and whether an end point is close to a domain boundary - see TPCDomains
+    int  domain ;
+    bool atDomainBoundary ;
+
+    // circle parameters (from track parameters at the IP) used for merging curler segments - see setCircle()
+    bool hasCircle ;
+    double x0 ;     // circle center
+    double y0 ;
+    double r ;      // signed radius 1/omega
+    float  tanL ;
+    double zFirst ; // z of the reference point at the first hit ( 0 if not present )
+
+    /** Compute the circle parameters from the track parameters. */
+    void setCircle( const lcio::Track* trk ) {
+      double d0 = trk->getD0() ;
+      double p0 = trk->getPhi() ;
+      r    = 1. / trk->getOmega() ;
+      x0   = ( r - d0 ) * sin( p0 ) ;
+      y0   = ( d0 - r ) * cos( p0 ) ;
+      tanL = trk->getTanLambda() ;
+      const lcio::TrackState* ts = trk->getTrackState( lcio::TrackState::AtFirstHit ) ;
+      zFirst = ( ts ? ts->getReferencePoint()[2]  : 0. ) ;
+      hasCircle = true ;
+    }
   } ;
   struct TrackInfo : lcrtrel::LCOwnedExtension<TrackInfo, TrackInfoStruct> {} ;
 
@@ -395,29 +1140,61 @@ namespace clupatra_new{
   } ;
   //=======================================================================================
 
+  /** Analytic propagation of the track state (helix w/o energy loss) to the hit: computes the residuals 
+   *  in r-phi (distance to the circle) and z (on the turn closest to the hit) and returns their chi2, using the 
+   *  covariance matrices of the track state and the hit. Meant as a cheap pre-selection before a Kalman filter step.
+   *  If bField and radLength (radiation length of the traversed material in mm) are given, the covariance is 
+   *  inflated for the multiple scattering along the (straight line) distance between the track state and the hit.
+   *  Returns -1. if the chi2 cannot be computed.
+   */
+  double helixHitChi2( const lcio::TrackState& ts, const lcio::TrackerHit* hit, double bField=0., double radLength=0. ) ;
+
+  //=======================================================================================
+
   /** helper class for merging split track segments */
   
   class TrackSegmentMerger{
     
   public:
-    /** C'tor takes merge distance */
-    TrackSegmentMerger(float chi2Max,  MarlinTrk::IMarlinTrkSystem* trksystem, float b) : _chi2Max( chi2Max ) , _trksystem( trksystem), _b(b) {}
+    /** C'tor takes merge distance - if gateChi2 > 0 every probe hit of the other segment is required to have an 
+     *  analytic chi2 (helixHitChi2, with multiple scattering in the TPC gas) below gateChi2 before the Kalman 
+     *  filter is run. The pair is rejected at the first probe hit that fails - usually the closest one.
+     */
+    TrackSegmentMerger(float chi2Max,  MarlinTrk::IMarlinTrkSystem* trksystem, float b, float gateChi2=-1. ) : 
+      _chi2Max( chi2Max ) , _trksystem( trksystem), _b(b), _gateChi2( gateChi2 ), _nGateRejected(0), _nKalmanTested(0) {}
     
     float _chi2Max ;
     MarlinTrk::IMarlinTrkSystem* _trksystem ;
     float _b ;
+    float _gateChi2 ;
+    unsigned _nGateRejected ; // pairs rejected by the analytic gate 
+    unsigned _nKalmanTested ; // pairs tested with the Kalman filter
+
+    /** radiation length of the TPC gas [mm] ( argon based ) used for the multiple scattering in the gate */
+    static constexpr double tpcGasRadLength = 1.1e5 ;
+
+    /** allow the track segements to overlap slightly  - FIXME: make a parameter ... */
+    static const int overlapRows = 4 ;
     
     /** Merge condition: ... */
     inline bool operator()( nnclu::Element<lcio::Track>* h0, nnclu::Element<lcio::Track>* h1){
       
-      lcio::Track* trk0 = h0->first ;
-      lcio::Track* trk1 = h1->first ;
-
-
       // protect against merging multiple segments (and thus complete tracks) 
       if(  h0->second || h1->second ) 
 	return false ;
 
+      return compatible( h0->first, h1->first, _trksystem, _nGateRejected, _nKalmanTested ) ;
+    }
+
+    /** The merge condition for the two segments w/o the check for existing clusters - does not modify the 
+     *  merger and uses the given tracking system and counters, so it can be called concurrently from several 
+     *  threads, each with its own MarlinTrk system. 
+     */
+    bool compatible( lcio::Track* trk0, lcio::Track* trk1, MarlinTrk::IMarlinTrkSystem* trksystem, 
+		     unsigned& nGateRejected, unsigned& nKalmanTested ) const {
+
+      static const CellIDField layerID( LCTrackerCellID::encoding_string(), LCTrackerCellID::layer() ) ;
+
       // const TrackInfoStruct* ti0 =  trk0->ext<TrackInfo>() ;
       // const TrackInfoStruct* ti1 =  trk1->ext<TrackInfo>() ;
 
@@ -441,16 +1218,15 @@ namespace clupatra_new{
       // lcio::TrackerHit* thm1 = trk1->getTrackerHits()[ nhit1 / 2 ] ;
       // lcio::TrackerHit* thm0 = trk0->getTrackerHits()[ nhit0 / 2 ] ;
 
-      int lthf0 = ILD_cellID(  thf0 )[ LCTrackerCellID::layer() ] ;
-      int lthf1 = ILD_cellID(  thf1 )[ LCTrackerCellID::layer() ] ;
+      int lthf0 = layerID(  thf0 ) ;
+      int lthf1 = layerID(  thf1 ) ;
 
-      int lthl0 = ILD_cellID(  thl0 )[ LCTrackerCellID::layer() ] ;
-      int lthl1 = ILD_cellID(  thl1 )[ LCTrackerCellID::layer() ] ;
+      int lthl0 = layerID(  thl0 ) ;
+      int lthl1 = layerID(  thl1 ) ;
       
       //      if( lthf0 <= lthl1 && lthf1 <= lthl0 )   return false ; 
 
-      // allow the track segements to overlap slightly  - FIXME: make a parameter ...
-      const int overlapRows = 4 ;
+      // allow the track segements to overlap slightly 
       if( lthf0 + overlapRows <= lthl1 && lthf1  + overlapRows  <= lthl0 )   return false ; 
 
       // now we take the larger segment and see if we can add the three hits from the other segment...
@@ -467,41 +1243,50 @@ namespace clupatra_new{
       lcio::TrackerHit* th2 =  ( outward ? oth->getTrackerHits()[ n -1 ] :  oth->getTrackerHits()[ 0 ]     );
       
 
-      // track state at last hit migyt be rubish....
-      //      const lcio::TrackState* ts = ( outward ? trk->getTrackState( lcio::TrackState::AtLastHit  ) : trk->getTrackState( lcio::TrackState::AtFirstHit  ) ) ;
-      const lcio::TrackState* ts = trk->getTrackState( lcio::TrackState::AtFirstHit  )  ;
-      
-
-
-      streamlog_out( DEBUG3 ) << " *******  TrackSegmentMerger : will extrapolate track " << ( outward ? " outwards\t" : " inwards\t" ) 
+      clupa_out( DEBUG3 ) << " *******  TrackSegmentMerger : will extrapolate track " << ( outward ? " outwards\t" : " inwards\t" ) 
 			      <<  lcio::lcshort( trk  ) << "     vs:  [" <<   std::hex << oth->id() << std::dec << "]"  << std::endl ;  
       
       // if( trk->id() == 0x0004534d &&  oth->id() == 0x000454a6 ){
-      // 	streamlog_out( DEBUG3 )  << " &&&&&&&&&&&&&& Track 1 : \n" << *trk 
+      // 	clupa_out( DEBUG3 )  << " &&&&&&&&&&&&&& Track 1 : \n" << *trk 
       // 				 << " &&&&&&&&&&&&&& Track 2 : \n" << *oth 
       // 				 <<  std::endl ;
       // }
 
-      std::auto_ptr<MarlinTrk::IMarlinTrack> mTrk( _trksystem->createTrack()  ) ;
-      
-      int nHit = trk->getTrackerHits().size() ;
-      
-      if( nHit == 0 || ts ==0 )
-	return false ;
-      
-      // float initial_chi2 = trk->getChi2() ;
-      // float initial_ndf  = trk->getNdf() ;
-      
-      streamlog_out( DEBUG3  )  << "               -- extrapolate TrackState : " << lcshort( ts )    << std::endl ;
-      
-      //need to add a dummy hit to the track
-      int result = mTrk->addHit(  trk->getTrackerHits()[0] ) ;  // is this the right hit ??????????
+      // restart the filter from the fit snapshot at the first hit - 
+      // fall back to the track state at the first hit for tracks w/o snapshot
+      // ( track state at last hit migyt be rubish.... )
+      const TrackFitSnapshot* snap = trk->ext<FitSnapshot>() ;
+
+      // cheap analytic pre-selection: propagate the helix at the first hit to the probe hits in the order 
+      // they are added in the Kalman filter - like there, the pair is rejected at the first hit that fails 
+      if( _gateChi2 > 0. ){
 
-      if( result !=  MarlinTrk::IMarlinTrack::success ){
-	     return false ;
+	const lcio::TrackState* ts = ( snap ? &snap->atFirstHit : trk->getTrackState( lcio::TrackState::AtFirstHit ) ) ;
+	
+	if( ts ){
+	  
+	  const lcio::TrackerHit* gHits[3] = { th0, th1, th2 } ;
+	  
+	  for( unsigned i=0 ; i<3 ; ++i ){
+	    
+	    double chi2 = helixHitChi2( *ts, gHits[i], _b, tpcGasRadLength ) ;
+	    
+	    clupa_out( DEBUG3 ) << "    ****  analytic chi2 for hit " << i << " : " << chi2 << std::endl ;
+	    
+	    if( chi2 > _gateChi2 ){
+	      ++nGateRejected ;
+	      return false ;
+	    }
+	  }
+	}
       }
 
-      mTrk->initialise( *ts ,  _b ,  MarlinTrk::IMarlinTrack::backward ) ;
+      ++nKalmanTested ;
+
+      std::auto_ptr<MarlinTrk::IMarlinTrack> mTrk( snap ?  createTrackFromSnapshot( trksystem, *snap, true, _b ) 
+						   :  createTrackFromState( trksystem, trk, lcio::TrackState::AtFirstHit, _b ) ) ;
+      if( mTrk.get() == 0 )
+	return false ;
       
       double deltaChi ;
       int addHit = 0 ;
@@ -509,7 +1294,7 @@ namespace clupatra_new{
       //-----   now try to add the three hits : ----------------
       addHit = mTrk->addAndFit(  th0 , deltaChi, _chi2Max ) ;
       
-      streamlog_out( DEBUG3 ) << "    ****  adding first hit : " <<  DDSurfaces::Vector3D( th0->getPosition() )  
+      clupa_out( DEBUG3 ) << "    ****  adding first hit : " <<  DDSurfaces::Vector3D( th0->getPosition() )  
 			      << "         added : " << MarlinTrk::errorCode( addHit )
 			      << "         deltaChi2: " << deltaChi 
 			      << std::endl ;
@@ -519,7 +1304,7 @@ namespace clupatra_new{
       //---------------------
       addHit = mTrk->addAndFit(  th1 , deltaChi, _chi2Max ) ;
       
-      streamlog_out( DEBUG3 ) << "    ****  adding second hit : " <<  DDSurfaces::Vector3D( th1->getPosition() )  
+      clupa_out( DEBUG3 ) << "    ****  adding second hit : " <<  DDSurfaces::Vector3D( th1->getPosition() )  
 			      << "         added : " << MarlinTrk::errorCode( addHit )
 			      << "         deltaChi2: " << deltaChi 
 			      << std::endl ;
@@ -529,7 +1314,7 @@ namespace clupatra_new{
       //--------------------
       addHit = mTrk->addAndFit(  th2 , deltaChi, _chi2Max ) ;
       
-      streamlog_out( DEBUG3 ) << "    ****  adding third hit : " <<  DDSurfaces::Vector3D( th2->getPosition() )  
+      clupa_out( DEBUG3 ) << "    ****  adding third hit : " <<  DDSurfaces::Vector3D( th2->getPosition() )  
 			      << "         added : " << MarlinTrk::errorCode( addHit )
 			      << "         deltaChi2: " << deltaChi 
 			      << std::endl ;
@@ -545,8 +1330,25 @@ namespace clupatra_new{
 
   };
   //=======================================================================================
+
+  /** Pre-selection of candidate pairs of incomplete track segments for the (expensive) TrackSegmentMerger: 
+   *  the segments are sorted in the pad rows of their first and last hit and the segments that are 
+   *  compatible with the allowed overlap (TrackSegmentMerger::overlapRows) are found with a binary search. 
+   *  This pruning is exact. If maxDeltaPhi > 0, pairs are further required to have a distance in phi 
+   *  between their closest end points of less than maxDeltaPhi and the same sign of tan lambda (if both 
+   *  |tanLambda| > minTanL) - these cuts can change the merging w.r.t. testing all pairs: for a track from 
+   *  the IP with radius R the azimuth of the hits changes by asin(rOuter/2R) - asin(rInner/2R) in the TPC.
+   *  Fills the pairs of indices (i,j), i<j, sorted in (i,j) and returns the number of pairs pruned.
+   */
+  unsigned findSegmentMergeCandidates( const std::vector< nnclu::Element<lcio::Track>* >& segs, 
+				       std::vector< std::pair<unsigned,unsigned> >& pairs, 
+				       float maxDeltaPhi, float minTanL=0.05 ) ;
+
+  //=======================================================================================
   
-/** helper class for merging track segments, based on circle (and tan lambda) */
+/** helper class for merging track segments, based on circle (and tan lambda) - uses the circle parameters
+ *  stored in the TrackInfo (computed on the fly if not present).
+ */
   
   class TrackCircleDistance{
     
@@ -557,16 +1359,17 @@ namespace clupatra_new{
     /** Merge condition: ... */
     inline bool operator()( nnclu::Element<lcio::Track>* h0, nnclu::Element<lcio::Track>* h1){
       
-     
-
       lcio::Track* trk0 = h0->first ;
       lcio::Track* trk1 = h1->first ;
       
       const TrackInfoStruct* ti0 =  trk0->ext<TrackInfo>() ;
       const TrackInfoStruct* ti1 =  trk1->ext<TrackInfo>() ;
 
+      TrackInfoStruct tmp0, tmp1 ;
+      if( ! ti0->hasCircle ) { tmp0 = *ti0 ; tmp0.setCircle( trk0 ) ; ti0 = &tmp0 ; }
+      if( ! ti1->hasCircle ) { tmp1 = *ti1 ; tmp1.setCircle( trk1 ) ; ti1 = &tmp1 ; }
 
-      streamlog_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
+      clupa_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
 			      << "  (  ti0->zAvg > ti1->zAvg ) = " << (  ti0->zAvg > ti1->zAvg )
 			      << std::endl ;
 
@@ -585,16 +1388,16 @@ namespace clupatra_new{
 	
       }
       
-      double tl0 = std::abs( trk0->getTanLambda() ) ;
-      double tl1 = std::abs( trk1->getTanLambda() ) ;
+      double tl0 = std::abs( ti0->tanL ) ;
+      double tl1 = std::abs( ti1->tanL ) ;
       
-      if( trk0->getTanLambda() * trk1->getTanLambda()   < 0. ) 
+      if( ti0->tanL * ti1->tanL   < 0. ) 
 	return false ; // require the same sign
 
 
       double dtl = 2. * std::abs( tl0 - tl1 ) / ( tl0 + tl1 ) ;
 
-      streamlog_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id()
+      clupa_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id()
 			     << " dtl : " << dtl << "   std::abs( tl0 + tl1 ) = " <<  std::abs( tl0 + tl1 ) 
 			     << " (  dtl > 2.  * _dCut  &&  std::abs( tl0 + tl1 ) > 1.e-2  ) = " << (  dtl > 2.  * _dCut  &&  std::abs( tl0 + tl1 ) > 1.e-2  )
 			     << std::endl ;
@@ -603,39 +1406,18 @@ namespace clupatra_new{
       	return false ;
       // for very steep tracks (tanL < 0.001 ) tanL might differ largely for curlers due to multiple scattering
       
-      double r0 = 1. / trk0->getOmega()   ;
-      double r1 = 1. / trk1->getOmega()  ;
+      double r0 = ti0->r ;
       
       double r0abs = std::abs( r0 ) ; 
-      double r1abs = std::abs( r1 ) ; 
+      double r1abs = std::abs( ti1->r ) ; 
       
-
-      double d0 = trk0->getD0() ;
-      double d1 = trk1->getD0() ;
-
-      // double z0 = trk0->getZ0() ;
-      // double z1 = trk1->getZ0() ;
-
+      // don't merge tracks that come from an area of 20 mm around the IP
       double rIP = 20. ; 
 
-      // streamlog_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
-      //  			      << " (  std::abs( d0 ) < rIP &&  std::abs( z0 ) < rIP  && std::abs( d1 ) < rIP &&  std::abs( z1 ) < rIP     ) " 
-      //  			      << (  std::abs( d0 ) < rIP &&  std::abs( z0 ) < rIP  && std::abs( d1 ) < rIP &&  std::abs( z1 ) < rIP     )
-      //  			      << std::endl ;
-      // // // don't merge tracks that come from an area of 20 mm around the IP
-      // if(  std::abs( d0 ) < rIP &&  std::abs( z0 ) < rIP  &&
-      //  	   std::abs( d1 ) < rIP &&  std::abs( z1 ) < rIP     )
-      // 	return false ;
-
-      
-      const TrackState* ts0 =  trk0->getTrackState( TrackState::AtFirstHit ) ;
-      const TrackState* ts1 =  trk1->getTrackState( TrackState::AtFirstHit ) ;
-
-      double z0 = ( ts0 ? ts0->getReferencePoint()[2]  : 0. ) ;
-      double z1 = ( ts1 ? ts1->getReferencePoint()[2]  : 0. ) ;
-     
+      double z0 = ti0->zFirst ;
+      double z1 = ti1->zFirst ;
 
-      streamlog_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
+      clupa_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
 			      << " (  std::abs( z0 ) < rIP  &&  std::abs( z1 ) < rIP     ) " 
 			      << ( std::abs( z0 ) < rIP  &&  std::abs( z1 ) < rIP     )
 			      << std::endl ;
@@ -643,22 +1425,17 @@ namespace clupatra_new{
       if(  std::abs( z0 ) < rIP  && std::abs( z1 ) < rIP     )
       	return false ;
 
+      double x0 = ti0->x0 ;
+      double x1 = ti1->x0 ;
 
-
-      double p0 = trk0->getPhi() ;
-      double p1 = trk1->getPhi() ;
-
-      double x0 = ( r0 - d0 ) * sin( p0 ) ;
-      double x1 = ( r1 - d1 ) * sin( p1 ) ;
-
-      double y0 = ( d0 - r0 ) * cos( p0 ) ;
-      double y1 = ( d1 - r1 ) * cos( p1 ) ;
+      double y0 = ti0->y0 ;
+      double y1 = ti1->y0 ;
     
       double dr = 2. * std::abs( r0abs - r1abs )  / (r0abs + r1abs )  ;
 
       double distMS = sqrt ( ( x0 - x1 ) * ( x0 - x1 ) + ( y0 - y1 ) * ( y0 - y1 )  ) ;
     
-      streamlog_out( DEBUG2 ) << "TrackCircleDistance:: operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
+      clupa_out( DEBUG2 ) << "TrackCircleDistance:: operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
 			      << "( dr < _dCut * std::abs( r0 )  &&  distMS < _dCut * std::abs( r0 )  ) " 
 			      << ( dr < _dCut * std::abs( r0 )  &&  distMS < _dCut * std::abs( r0 )  ) 
 			      <<  " dr : " << dr 
@@ -676,6 +1453,14 @@ namespace clupatra_new{
     float _dCut ;
   } ; 
 
+  /** Candidate pairs of track segments for merging with TrackCircleDistance( dCut ): the circle centers are 
+   *  sorted into a grid, so that only pairs (i,j) with a distance of the centers of less than dCut * |r_i| 
+   *  are returned ( TrackCircleDistance is false for all other pairs ). The index pairs are sorted with i<j.
+   *  The TrackInfo of all segments needs to be set.
+   */
+  void findCircleMergeCandidates( const std::vector< nnclu::Element<lcio::Track>* >& segs, 
+				  std::vector< std::pair<unsigned,unsigned> >& pairs, float dCut ) ;
+
   //=======================================================================================
   
   struct TrackZSort {  // sort tracks wtr to abs(z_average )  
@@ -737,6 +1522,48 @@ namespace clupatra_new{
     std::vector< std::string > _names ;
   };
 
+  //=======================================================================================
+
+  /** Wall clock time budget for the reconstruction of one event: the stages check exceeded() between 
+   *  and inside their loops and fall back to cheaper settings or are skipped - the degraded stages are 
+   *  recorded. The wall clock is used as the CPU time of the process is shared by concurrent events and 
+   *  threads. Can be used from different threads.
+   */
+  class TimeBudget{
+  public:
+
+    /** Stages that can be degraded or skipped. */
+    enum Stage{ 
+      SeedingLoops        = 1 << 0,  // remaining seeding loops with larger distance cuts skipped
+      GlobalReclustering  = 1 << 1,  // reclustering of leftover hits skipped or stopped early
+      MergeSplitSegments  = 1 << 2,  // (further) rounds of merging split segments skipped
+      MergeCurlerSegments = 1 << 3,  // merging of curler segments skipped
+      NStages             = 4 
+    } ;
+
+    /** Budget in seconds from now - no limit if seconds <= 0. */
+    TimeBudget( double seconds ) : _seconds( seconds ), _start( std::chrono::steady_clock::now() ), _skipped(0) {}
+
+    bool exceeded() const {
+      return _seconds > 0. && 
+	std::chrono::duration<double>( std::chrono::steady_clock::now() - _start ).count() > _seconds ;
+    }
+
+    /** Record a degraded stage. */
+    void skip( Stage s ) { _skipped |= s ; }
+
+    /** Bit mask of the degraded stages. */
+    unsigned skipped() const { return _skipped ; }
+
+    /** Names of the stages in the bit mask. */
+    static void stageNames( unsigned mask, std::vector<std::string>& names ) ;
+
+  protected:
+    double _seconds ;
+    std::chrono::steady_clock::time_point _start ;
+    std::atomic<unsigned> _skipped ;
+  } ;
+
 
 }
 #endif
@@ -0,0 +1,1741 @@
+#include "ClupatraReconstructor.h"
+
+#include "clupatra_new.h"
+
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <math.h>
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <float.h>
+
+//---- LCIO ---
+#include "IMPL/LCCollectionVec.h"
+#include "IMPL/TrackImpl.h"
+#include "IMPL/LCFlagImpl.h"
+#include "UTIL/Operators.h"
+#include "UTIL/LCIterator.h"
+
+#include "DDSurfaces/Vector3D.h"
+
+#include "MarlinTrk/IMarlinTrack.h"
+#include "MarlinTrk/IMarlinTrkSystem.h"
+
+
+using namespace lcio ;
+
+using namespace clupatra_new ;
+using namespace clupatra ;
+
+
+/** helper method to create a track collection w/ the hit flag set */
+inline LCCollectionVec* newTrkCol( bool isSubset=false ){
+
+  LCCollectionVec* col = new LCCollectionVec( LCIO::TRACK ) ;  
+
+  LCFlagImpl hitFlag(0) ;
+  hitFlag.setBit( LCIO::TRBIT_HITS ) ;
+  col->setFlag( hitFlag.getFlag()  ) ;
+
+  col->setSubset( isSubset ) ;
+
+  return col ;
+}
+
+/** helper method to copy a track segment to the final tracks: the copy gets its own fit snapshot, so that
+ *  the Si hit pick up and the merging can restart the fit from it - the track info and the MarlinTrk are 
+ *  not copied ( owned by the segment ) 
+ */
+inline TrackImpl* copyTrackSegment( const TrackImpl* trk ){
+
+  TrackImpl* t = new TrackImpl( *trk ) ;
+
+  t->ext<TrackInfo>() = 0 ; // set extension to 0 to prevent double free ... 
+
+  const TrackFitSnapshot* snap = trk->ext<FitSnapshot>() ;
+
+  t->ext<FitSnapshot>() = ( snap ? new TrackFitSnapshot( *snap ) : 0 ) ;
+
+  t->ext<MarTrk>() = 0 ;
+
+  return t ;
+}
+
+
+/** Segment finding in one geometric domain of the TPC ( or in the whole TPC ): seeding with the NN-clustering 
+ *  in pad row windows, extension of the seeds with the Kalman filter and reclustering of the leftover hits. 
+ *  Domains have disjoint hits and their own buffers and tracking system, so they can be processed concurrently.
+ */
+struct SegmentFinder{
+
+  SegmentFinder( HitListVector& layerHits, HitVec& window, HitVec& seeds, ClupaBuffers& buf, MarlinTrk::IMarlinTrkSystem* trkSys ) : 
+    domainHits( &layerHits ), windowBuf( &window ), seedBuf( &seeds ), buffers( &buf ), trkSystem( trkSys ) {
+
+    cluList.setOwner() ;
+    seedTrks.setOwner() ; // memory mgmt - will delete MarlinTrks at the end
+  }
+
+  // input - not owned
+  HitListVector* domainHits ;
+  HitVec*        windowBuf ;
+  HitVec*        seedBuf ;
+  ClupaBuffers*  buffers ;
+  MarlinTrk::IMarlinTrkSystem* trkSystem ;
+
+  // output
+  Clusterer::cluster_list cluList ;                     // the track segments
+  nnclu::PtrVector<MarlinTrk::IMarlinTrack> seedTrks ;  // fits of the reclustered segments 
+  std::vector<Track*> seedClusters ;                    // tracks for the debug collections ( not owned )
+  std::vector<Track*> initialSegments ;
+  std::vector<Track*> leftoverClusters ;
+
+  void find( const ReconstructorConfig& cfg, const TPCGeometry& geo, int nHit, TimeBudget& budget ) ;
+} ;
+
+void SegmentFinder::find( const ReconstructorConfig& cfg, const TPCGeometry& geo, int nHit, TimeBudget& budget ){
+
+  HitListVector& hitsInLayer = *domainHits ;
+
+  const unsigned int maxTPCLayers = geo.nPadRows ;
+  const double driftLength = geo.driftLength ;
+  ZIndex zIndex( -driftLength , driftLength , cfg.nZBins  ) ; 
+
+  // the hits have to be binned in z with the same nZBins ( e.g. re-binned for a profile with different nZBins )
+  for( unsigned l=0 ; l < hitsInLayer.size() ; ++l ){
+
+    if( hitsInLayer[l].empty() )
+      continue ;
+
+    const ClupaHit* h = hitsInLayer[l].front()->first ;
+
+    if( h->zIndex != zIndex.index( h->pos.z() ) )
+      throw lcio::Exception( " SegmentFinder::find: the z index of the hits does not match nZBins of the configuration " ) ;
+  }
+
+  const bool writeSeedCluster        = cfg.createDebugCollections ;
+  const bool writeCluTrackSegments   = cfg.createDebugCollections ;
+  const bool writeLeftoverClusters   = cfg.createDebugCollections ;
+
+  LCIOTrackConverter converter ;
+  converter.UsePropagate  = ! cfg.previewMode ;
+  converter.Light         = cfg.previewMode ;
+  converter.CaloFaceBarrelID  = cfg.caloFaceBarrelID ;
+  converter.CaloFaceEndcapID  = cfg.caloFaceEndcapID ;
+
+  //===============================================================================================
+  // first main step of clupatra:
+  //   * cluster in pad row range - starting from the outside - to find clean cluster segments
+  //   * extend the track segments with best matching hits, based on extrapolation to next layer(s)
+  //   * add the hits and apply a Kalman filter step ( track segement is always best estimate )
+  //   * repeat in backward direction ( after smoothing back, to get a reasonable track 
+  //     state for extrapolating backwards )
+  //===============================================================================================
+
+  Clusterer nncl ;
+  
+  int outerRow = 0 ;
+  
+  IMarlinTrkFitter fitter( trkSystem ) ;
+
+
+  clupa_out( DEBUG5 ) << "===============================================================================================\n"
+			  << "   first step of Clupatra algorithm: find seeds with NN-clustering  in " <<  cfg.nLoop << " loops - max dist = " << cfg.distCut <<" \n"
+			  << "===============================================================================================\n"  ;
+  
+  // ---- introduce a loop over increasing distance cuts for finding the tracks seeds
+  //      -> should fix (some of) the problems seen @ 3 TeV with extremely boosted jets
+  //   if the time budget is exceeded the loops with larger distance cuts are skipped
+  //
+  double dcut =  cfg.distCut / cfg.nLoop ;
+  for(int nloop=1 ; nloop <= cfg.nLoop ; ++nloop){ 
+
+    if( nloop > 1 && budget.exceeded() ){
+      budget.skip( TimeBudget::SeedingLoops ) ;
+      break ;
+    }
+
+    HitDistance dist( nloop * dcut , cfg.cosAlphaCut ) ;
+
+    outerRow = maxTPCLayers - 1 ;
+    
+    while( outerRow >= cfg.minCluSize ) { //cfg.padRowRange * .5 ) {
+
+      if( nloop > 1 && budget.exceeded() ){
+	budget.skip( TimeBudget::SeedingLoops ) ;
+	break ;
+      }
+
+      HitVec& hits = *windowBuf ;
+      buffers->prepare( hits, nHit ) ;
+      
+      // add all hits in pad row range to hits
+      for(int iRow = outerRow ; iRow > ( outerRow - cfg.padRowRange) ; --iRow ) {
+
+	if( iRow > -1 ) {
+
+	  clupa_out( DEBUG0 ) << "  copy " <<  hitsInLayer[ iRow ].size() << " hits for row " << iRow << std::endl ;
+
+	  std::copy( hitsInLayer[ iRow ].begin() , hitsInLayer[ iRow ].end() , std::back_inserter( hits )  ) ;
+	}
+      }
+      
+      //-----  cluster in given pad row range  -----------------------------
+      Clusterer::cluster_list sclu ;    
+      sclu.setOwner() ;  
+    
+      clupa_out( DEBUG2 ) << "   call cluster_sorted with " <<  hits.size() << " hits " << std::endl ;
+
+      nncl.cluster_sorted( hits.begin(), hits.end() , std::back_inserter( sclu ), dist , cfg.minCluSize ) ;
+    
+      const static int merge_seeds = true ; 
+
+      if( merge_seeds ) { //-----------------------------------------------------------------------
+	
+	// sometimes we have split seed clusters as one link is just above the cut
+	// -> recluster in all hits of small clusters with 1.2 * cut 
+	float _smallClusterPadRowFraction = 0.9  ;
+	float _cutIncrease = 1.2 ;
+	// fixme: could make parameters ....
+
+	HitVec& seedhits = *seedBuf ;
+	buffers->prepare( seedhits, hits.size() ) ;
+	Clusterer::cluster_list smallclu ; 
+	smallclu.setOwner() ;      
+	split_list( sclu, std::back_inserter(smallclu),  ClusterSize(  int( cfg.padRowRange * _smallClusterPadRowFraction) ) ) ; 
+	for( Clusterer::cluster_list::iterator sci=smallclu.begin(), end= smallclu.end() ; sci!=end; ++sci ){
+	  for( Clusterer::cluster_type::iterator ci=(*sci)->begin(), end1= (*sci)->end() ; ci!=end1;++ci ){
+	    seedhits.push_back( *ci ) ; 
+	  }
+	}
+	// free hits from bad clusters 
+	std::for_each( smallclu.begin(), smallclu.end(), std::mem_fun( &CluTrack::freeElements ) ) ;
+	
+	HitDistance distLarge( nloop * dcut * _cutIncrease ) ;
+
+	nncl.cluster_sorted( seedhits.begin(), seedhits.end() , std::back_inserter( sclu ), distLarge , cfg.minCluSize ) ;
+
+      } //------------------------------------------------------------------------------------------
+
+      clupa_out( DEBUG ) << "     found " <<  sclu.size() << "  clusters " << std::endl ;
+
+      // try to split up clusters according to multiplicity
+      int layerWithMultiplicity = cfg.padRowRange - 2  ; // fixme: make parameter 
+      split_multiplicity( sclu , layerWithMultiplicity , 10 ) ;
+
+
+      // remove clusters whith too many duplicate hits per pad row
+      Clusterer::cluster_list bclu ;    // bad clusters  
+      bclu.setOwner() ;      
+      split_list( sclu, std::back_inserter(bclu),  DuplicatePadRows( maxTPCLayers, cfg.duplicatePadRowFraction  ) ) ;
+      // free hits from bad clusters 
+      std::for_each( bclu.begin(), bclu.end(), std::mem_fun( &CluTrack::freeElements ) ) ;
+
+     
+      // ---- now we also need to remove the hits from good cluster seeds from the hitsInLayers:
+      for( Clusterer::cluster_list::iterator sci=sclu.begin(), end= sclu.end() ; sci!=end; ++sci ){
+	for( Clusterer::cluster_type::iterator ci=(*sci)->begin(), end1= (*sci)->end() ; ci!=end1;++ci ){
+	
+	  // this is not cheap ...
+	  removeHit( hitsInLayer[ (*ci)->first->layer ], *ci )  ; 
+	}
+      }
+    
+      // now we have 'clean' seed clusters
+      // Write debug collection with seed clusters:
+      // convert the clusters into tracks and write the resulting tracks into the vector seedClusters for the debug collection.
+      // The conversion is performed by the STL transform() function, the insertion to the end of the
+      // vector is done by creating an STL back_inserter iterator on seedClusters
+      if( writeSeedCluster ) {
+	std::transform( sclu.begin(), sclu.end(), std::back_inserter( seedClusters ) , converter ) ;
+      }
+      
+      //      std::transform( sclu.begin(), sclu.end(), std::back_inserter( seedTrks) , fitter ) ;
+      // reduce memory footprint: deal with one KalTest track at a time and delete it, when done
+    
+      clupa_out( DEBUG2 ) << "  -------- search seeds with distCut=" << nloop * dcut 
+			      << " starting in row "   <<  outerRow 
+			      << " with padrow range " << cfg.padRowRange
+			      <<  " - found " << sclu.size() << " seed clusters " 
+			      << std::endl ;
+      
+      for( Clusterer::cluster_list::iterator icv = sclu.begin(), end =sclu.end()  ; icv != end ; ++ icv ) {
+      
+	int nHitsAdded = 0 ;
+
+	//	clupa_out( DEBUG4 ) <<  " call fitter for seed cluster with " << (*icv)->size() << " hits " << std::endl ;
+
+	MarlinTrk::IMarlinTrack* mTrk = fitter( *icv ) ;
+
+	nHitsAdded += addHitsAndFilter( *icv , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers ) ; 
+      
+	static const bool backward = true ;
+	nHitsAdded += addHitsAndFilter( *icv , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers, backward ) ; 
+	// in order to use smooth for backward extrapolation call with   _trksystem  - does not work well...
+	// nHitsAdded += addHitsAndFilter( *icv , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers, backward , _trksystem ) ; 
+
+
+	// drop seed clusters with no hits added - but not in the very forward region...
+	if( nHitsAdded < 1  &&  outerRow >   2*cfg.padRowRange  ){  //FIXME: make parameter ?
+
+	  std::auto_ptr<Track> lcioTrk( converter( *icv ) ) ; 
+
+	  clupa_out( DEBUG2) << "=============  poor seed cluster - no hits added - started from row " <<  outerRow << "\n" 
+				 << *lcioTrk << std::endl ;
+	  
+	  
+	  for( Clusterer::cluster_type::iterator ci=(*icv)->begin(), end1= (*icv)->end() ; ci!=end1; ++ci ) {
+	    hitsInLayer[ (*ci)->first->layer ].push_back( *ci )   ; 
+	  }
+	  (*icv)->freeElements() ;
+	  (*icv)->clear() ;
+	}
+	
+	// if( nHitsAdded < 1 ){
+	//   Track* lcioTrk = converter( *icv ) ; 
+	//   clupa_out( DEBUG5) << "  poor seed cluster - no hits added - n hits = " << nHitsAdded << "\n" 
+	// 			 << *lcioTrk << std::endl ;
+	//   delete lcioTrk ;
+	// }
+
+	if( writeCluTrackSegments )  //  ---- store track segments from the first main step  ----- 
+	  initialSegments.push_back(  converter( *icv ) );
+	
+	// reset the pointer to the KalTest track - as we are done with this track
+	(*icv)->ext<MarTrk>() = 0 ;
+	
+	delete mTrk ;
+      } 
+
+      // merge the good clusters to final list
+      cluList.merge( sclu ) ;
+
+      outerRow -= cfg.padRowRange ;
+    
+    } //while outerRow > padRowRange 
+  
+  }// nloop
+
+  //---------------------------------------------------------------------------------------------------------
+
+  //===============================================================================================
+  //  do a global reclustering in leftover hits
+  //===============================================================================================
+  if( cfg.globalReclustering ) {
+
+    outerRow = maxTPCLayers - 1 ;
+    
+    const int padRangeRecluster = cfg.padRangeRecluster ;
+    // define an inner cylinder where we exclude hits from re-clustering - only the radius for stream windows:
+    double zMaxInnerHits   = ( cfg.streamWindow ? DBL_MAX : driftLength * .67 ) ;   // FIXME: make parameter 
+    double rhoMaxInnerHits =  geo.rMin +  0.67 * ( geo.rMax - geo.rMin ) ; // FIXME: make parameter
+
+    
+    clupa_out( DEBUG5 ) << "  ===========================================================================\n"
+			    << "      recluster in leftover hits - outside a clyinder of :  z =" << zMaxInnerHits << " rho = " <<  rhoMaxInnerHits << "\n"
+			    << "  ===========================================================================\n" << std::endl ;
+    
+    
+    while( outerRow > 0 ) {
+      
+      if( budget.exceeded() ){ // out of time - no (further) reclustering 
+	budget.skip( TimeBudget::GlobalReclustering ) ;
+	break ;
+      }
+      
+      Clusterer::cluster_list loclu ; // leftover clusters
+      loclu.setOwner() ;
+      
+      HitVec& hits = *windowBuf ;
+      buffers->prepare( hits, nHit ) ;
+      
+      int  minRow = ( ( outerRow - padRangeRecluster ) > -1 ?  ( outerRow - padRangeRecluster ) : -1 ) ;
+      
+      // add all hits in pad row range to hits
+      for(int iRow = outerRow ; iRow > minRow ; --iRow ) {
+	
+	clupa_out( DEBUG ) << "      hit candidates in row " << iRow << " : " << hitsInLayer[ iRow ].size() << std::endl ;
+	
+	for( HitList::iterator hlIt=hitsInLayer[ iRow ].begin() , end = hitsInLayer[ iRow ].end() ; hlIt != end ; ++hlIt ) {
+	  clupa_out( DEBUG ) << "      hit candidate for reclustering " << (*hlIt)->first 
+				 << " ( std::abs( (*hlIt)->first->pos.z() ) > zMaxInnerHits  ||  (*hlIt)->first->pos.rho() >  rhoMaxInnerHits )  " 
+				 <<   ( std::abs( (*hlIt)->first->pos.z() ) > zMaxInnerHits  ||  (*hlIt)->first->pos.rho() >  rhoMaxInnerHits )
+				 << std::endl ;
+	  
+	  if( std::abs( (*hlIt)->first->pos.z() ) > zMaxInnerHits  ||  (*hlIt)->first->pos.rho() >  rhoMaxInnerHits ) {
+	    hits.push_back( *hlIt ) ;
+	  }
+	}
+      }
+      
+      
+      HitDistance distSmall( cfg.distCut ) ; 
+      nncl.cluster( hits.begin(), hits.end() , std::back_inserter( loclu ),  distSmall , cfg.minCluSize ) ;
+      
+      clupa_out( DEBUG ) << "   reclusterd in the range : " << outerRow << " - " <<  minRow 
+			     << " found " << loclu.size() << " clusters " 
+			     << std::endl ;
+      
+      // Write debug collection using STL transform() function on the clusters 
+      if( writeLeftoverClusters )
+	std::transform( loclu.begin(), loclu.end(), std::back_inserter( leftoverClusters ) , converter ) ;
+      
+      
+      // timer.time( t_recluster ) ;
+      
+      //===============================================================================================
+      //  now we split the clusters based on their hit multiplicities
+      //===============================================================================================
+      
+      
+      //    cfg.dChi2Max = 5. * cfg.dChi2Max ; //FIXME !!!!!!!!!
+      
+      for( Clusterer::cluster_list::iterator it= loclu.begin(), end= loclu.end() ; it != end ; ++it ){
+	
+	CluTrack* clu = *it ;
+	
+	if( budget.exceeded() ){ // out of time - discard the remaining leftover clusters 
+	  budget.skip( TimeBudget::GlobalReclustering ) ;
+	  clu->freeElements() ; 
+	  continue ;
+	}
+
+	clupa_out(  DEBUG5 ) << " **** left over cluster with size : " << clu->size() << std::endl ;
+	
+	std::vector<int> mult(8) ; 
+	// get hit multiplicities up to 6 ( 7 means 7 or higher ) 
+	getHitMultiplicities( clu , mult ) ;
+	
+	clupa_out(  DEBUG3 ) << " **** left over cluster with hit multiplicities: \n" ;
+	for( unsigned i=0,n=mult.size() ; i<n ; ++i) {
+	  clupa_out(  DEBUG3 ) << "     m["<<i<<"] = " <<  mult[i] << "\n"  ;
+	}
+	
+	
+	if( float( mult[5]) / mult[0]  >= cfg.minLayerFractionWithMultiplicity &&  mult[5] >  cfg.minLayerNumberWithMultiplicity ) {
+	  
+	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
+	  reclu.setOwner() ;
+	  
+	  create_n_clusters( *clu , reclu , 5 ) ;
+	  
+	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
+	  
+	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
+	    
+	    clupa_out( DEBUG5 ) << " extending mult-5 clustre  of length " << (*ir)->size() << std::endl ;
+	    
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers ) ; 
+	    static const bool backward = true ;
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers, backward ) ; 
+	  }
+	  
+	  cluList.merge( reclu ) ;
+	} 
+      
+	else if( float( mult[4]) / mult[0]  >= cfg.minLayerFractionWithMultiplicity &&  mult[4] >  cfg.minLayerNumberWithMultiplicity ) {
+	
+	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
+	  reclu.setOwner() ;
+	
+	  create_n_clusters( *clu , reclu , 4 ) ;
+	
+	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
+	
+	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
+	  
+	    clupa_out( DEBUG5 ) << " extending mult-4 clustre  of length " << (*ir)->size() << std::endl ;
+	  
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers ) ; 
+	    static const bool backward = true ;
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers, backward ) ; 
+	  }
+	
+	  cluList.merge( reclu ) ;
+	} 
+      
+	else if( float( mult[3]) / mult[0]  >= cfg.minLayerFractionWithMultiplicity &&  mult[3] >  cfg.minLayerNumberWithMultiplicity ) {
+	
+	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
+	  reclu.setOwner() ;
+	
+	  create_three_clusters( *clu , reclu ) ;
+	
+	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
+	
+	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
+	  
+	    clupa_out( DEBUG5 ) << " extending triplet clustre  of length " << (*ir)->size() << std::endl ;
+	  
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers ) ; 
+	    static const bool backward = true ;
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers, backward ) ; 
+	  }
+	
+	  cluList.merge( reclu ) ;
+	} 
+      
+	else if( float( mult[2]) / mult[0]  >= cfg.minLayerFractionWithMultiplicity &&  mult[2] >  cfg.minLayerNumberWithMultiplicity ) {
+	
+	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
+	  reclu.setOwner() ;
+	
+	  create_two_clusters( *clu , reclu ) ;
+	
+	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
+	
+	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
+	  
+	    clupa_out( DEBUG5 ) << " extending doublet clustre  of length " << (*ir)->size() << std::endl ;
+	  
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers ) ; 
+	    static const bool backward = true ;
+	    addHitsAndFilter( *ir , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers, backward ) ; 
+	  } 
+	
+	  cluList.merge( reclu ) ;
+	
+	}
+	else if( float( mult[1]) / mult[0]  >= cfg.minLayerFractionWithMultiplicity &&  mult[1] >  cfg.minLayerNumberWithMultiplicity ) {    
+	
+	
+	  seedTrks.push_back( fitter( *it )  );
+	
+	  addHitsAndFilter( *it , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers ) ; 
+	  static const bool backward = true ;
+	  addHitsAndFilter( *it , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, maxTPCLayers, backward ) ; 
+	
+	  cluList.push_back( *it ) ;
+	
+	  it = loclu.erase( it ) ;
+	  --it ; // erase returns iterator to next element 
+	
+	} else {
+	
+	  //  discard cluster and free hits
+	  clu->freeElements() ; 
+	}
+      
+      }
+
+  
+      outerRow -=  padRangeRecluster ; 
+
+    }
+  }
+}
+
+//----------------------------------------------------------------
+
+ReconstructorConfig::ReconstructorConfig() :
+  distCut( 40. ),
+  cosAlphaCut( 0.9999999 ),
+  nLoop( 4 ),
+  minCluSize( 6 ),
+  duplicatePadRowFraction( 0.1 ),
+  dChi2Max( 35. ),
+  chi2Cut( 100. ),
+  maxStep( 3 ),
+  padRowRange( 12 ),
+  nZBins( 150 ),
+  minLayerFractionWithMultiplicity( 0.5 ),
+  minLayerNumberWithMultiplicity( 3 ),
+  padRangeRecluster( 50 ),
+  globalReclustering( true ),
+  mergeSplitSegments( true ),
+  mergeCurlerSegments( true ),
+  trackStartsInnerDist( 25. ),
+  trackEndsOuterCentralDist( 25. ),
+  trackEndsOuterForwardDist( 40. ),
+  trackIsCurlerOmega( 0.001 ),
+  segmentMergeMaxDeltaPhi( 1.0 ),
+  segmentMergeGateChi2( 50. ),
+  tagLoopers( false ),
+  looperMinHits( 100 ),
+  looperMinHitsPerRow( 4. ),
+  caloFaceBarrelID( 20 ),
+  caloFaceEndcapID( 29 ),
+  nThreads( 1 ),
+  parallelMergeVerdicts( false ),
+  timeBudget( 0. ),
+  splitZHalves( false ),
+  nPhiDomains( 1 ),
+  domainMargin( 20. ),
+  createDebugCollections( false ),
+  previewMode( false ),
+  streamWindow( false ) {
+}
+
+//----------------------------------------------------------------
+
+void ReconstructorConfig::apply( const OccupancyProfile& p ){
+
+  nLoop               = p.nLoop ;
+  padRowRange         = p.padRowRange ;
+  nZBins              = p.nZBins ;
+  padRangeRecluster   = p.padRangeRecluster ;
+  globalReclustering  = p.globalReclustering ;
+  mergeSplitSegments  = p.mergeSplitSegments ;
+  mergeCurlerSegments = p.mergeCurlerSegments ;
+}
+
+//----------------------------------------------------------------
+
+void ReconstructorConfig::setPreviewMode(){
+
+  previewMode         = true ;
+  tagLoopers          = false ;
+  globalReclustering  = false ;
+  mergeSplitSegments  = false ;
+  mergeCurlerSegments = false ;
+}
+
+//----------------------------------------------------------------
+
+void RegionOfInterest::addCone( double theta, double phi, double halfAngle ){
+
+  Cone c ;
+
+  c.dir[0] = std::sin( theta ) * std::cos( phi ) ;
+  c.dir[1] = std::sin( theta ) * std::sin( phi ) ;
+  c.dir[2] = std::cos( theta ) ;
+
+  c.cosMax = std::cos( std::min( std::max( halfAngle, 0. ), M_PI ) ) ;
+
+  cones.push_back( c ) ;
+}
+
+void RegionOfInterest::addSeeds( unsigned n, const double* p, unsigned stride, double halfAngle ){
+
+  for( unsigned i=0 ; i < n ; ++i ){
+
+    const double* pi = p + i * stride ;
+
+    addCone( std::atan2( std::sqrt( pi[0] * pi[0] + pi[1] * pi[1] ), pi[2] ), std::atan2( pi[1], pi[0] ), halfAngle ) ;
+  }
+
+  if( cones.empty() ) 
+    excludeAll = true ;
+}
+
+//----------------------------------------------------------------
+
+OccupancyProfile::OccupancyProfile() :
+  name( "default" ),
+  minHitsPerRow( 0. ),
+  nLoop( 4 ),
+  padRowRange( 12 ),
+  nZBins( 150 ),
+  padRangeRecluster( 50 ),
+  globalReclustering( true ),
+  mergeSplitSegments( true ),
+  mergeCurlerSegments( true ) {
+}
+
+//----------------------------------------------------------------
+
+void ReconstructionResult::clear(){
+
+  // the debug collections might hold subsets of the tracks and segments - delete them first
+  for( unsigned i=0 ; i < debugCollections.size() ; ++i )
+    delete debugCollections[i].second ;
+  debugCollections.clear() ;
+
+  delete tracks ;
+  tracks = 0 ;
+
+  delete segments ;
+  segments = 0 ;
+
+  trackResults.clear() ;
+
+  skippedStages = 0 ;
+}
+
+//----------------------------------------------------------------
+
+Reconstructor::Reconstructor( const ReconstructorConfig& cfg, const TPCGeometry& geo ) :
+  _cfg( cfg ),
+  _geo( geo ),
+  _contexts( new ClupaContextPool ),
+  _nSegPairsTested(0),
+  _nSegPairsPruned(0),
+  _nSegPairsMemo(0),
+  _nOverBudget(0),
+  _nProfileEvents( cfg.profiles.size() + 1 ) {
+
+  if( _cfg.previewMode ) 
+    _cfg.setPreviewMode() ;
+
+  // the configurations for all profiles are created once - no copies of the configuration per event
+  for( unsigned i=0 ; i < cfg.profiles.size() ; ++i ){
+
+    const OccupancyProfile& p = cfg.profiles[i] ;
+
+    if( p.nLoop < 1 || p.padRowRange < 1 || p.nZBins < 1 || p.padRangeRecluster < 1 )
+      throw lcio::Exception( std::string( " Reconstructor: invalid parameters in occupancy profile " ) + p.name ) ;
+
+    _profileCfgs.push_back( cfg ) ;
+    _profileCfgs.back().profiles.clear() ;
+    _profileCfgs.back().apply( p ) ;
+
+    if( _cfg.previewMode )  // the stages of the preview can not be switched on by a profile
+      _profileCfgs.back().setPreviewMode() ;
+  }
+}
+
+Reconstructor::~Reconstructor(){
+
+  delete _contexts ;
+}
+
+//----------------------------------------------------------------
+
+void Reconstructor::addContext( MarlinTrk::IMarlinTrkSystem* trkSystem, 
+				const std::vector<MarlinTrk::IMarlinTrkSystem*>& threadSystems ){
+
+  if( trkSystem == 0 )
+    throw lcio::Exception( " Reconstructor::addContext: no MarlinTrk system given " ) ;
+
+  ClupaEventContext* ctx = new ClupaEventContext ;
+
+  ctx->trkSystem = trkSystem ;
+
+  if( threadSystems.empty() ) 
+    ctx->trkSystems.push_back( trkSystem ) ;
+  else
+    ctx->trkSystems = threadSystems ;
+
+  _contexts->add( ctx ) ;
+}
+
+//----------------------------------------------------------------
+
+int Reconstructor::selectProfile( float hitsPerRow ) const {
+
+  int best = -1 ;
+
+  for( unsigned i=0 ; i < _cfg.profiles.size() ; ++i ){
+
+    const OccupancyProfile& p = _cfg.profiles[i] ;
+
+    if( p.minHitsPerRow <= hitsPerRow && ( best < 0 || p.minHitsPerRow > _cfg.profiles[best].minHitsPerRow ) )
+      best = i ;
+  }
+
+  return best ;
+}
+
+//----------------------------------------------------------------
+
+void Reconstructor::reconstruct( const TPCHitView& view, ReconstructionResult& result ){
+
+  // the tracking system(s) and all buffers are taken from a context that is not used by any other event
+  ClupaContextLock ctxLock( *_contexts ) ;
+
+  reconstruct( view, result, ctxLock.context() ) ;
+}
+
+//----------------------------------------------------------------
+
+void Reconstructor::reconstruct( const TPCHitView& view, ReconstructionResult& result, ClupaEventContext& ctx ){
+
+  //  clock_t start =  clock() ; 
+  Timer timer ;
+  unsigned t_init       = timer.registerTimer(" initialization      " ) ;
+  unsigned t_loopers    = timer.registerTimer(" tag loopers         " ) ;
+  unsigned t_seedtracks = timer.registerTimer(" find segments       " ) ;
+  unsigned t_finalfit   = timer.registerTimer(" final refit         " ) ;
+  unsigned t_merge      = timer.registerTimer(" merge segments      " ) ;
+  
+  timer.start() ;
+  
+  // stages are degraded or skipped if the event takes too long
+  TimeBudget budget( _cfg.timeBudget ) ;
+
+  result.clear() ;
+
+  // all buffers for hits and hit lists are taken from the workspace - they keep their capacity between events
+  ClupaWorkspace& ws = ctx.ws ;
+  ++ws.nEvents ;
+
+  // the clupa wrapper hits that hold pointers to LCIO hits plus some additional parameters
+  // are kept in ws.clupaHits for convenient memeory mgmt 
+  
+  // on top of the clupahits we need the tiny wrappers for clustering - they are stored in the workspace
+  // and we use a vector of pointers to them (w/o ownership)
+  HitVec& nncluHits = ws.nncluHits ;        
+
+
+  // this is the final list of cluster tracks
+  Clusterer::cluster_list cluList ;    
+  cluList.setOwner() ;
+  
+  LCIOTrackConverter converter ;
+  converter.UsePropagate  = ! _cfg.previewMode ;
+  converter.Light         = _cfg.previewMode ;
+  converter.CaloFaceBarrelID  = _cfg.caloFaceBarrelID ;
+  converter.CaloFaceEndcapID  = _cfg.caloFaceEndcapID ;
+
+  const unsigned int maxTPCLayers = _geo.nPadRows ;
+  
+  double driftLength = _geo.driftLength ;
+  
+  //===============================================================================================
+  //   create clupa and clustering hits for every lcio hit
+  //===============================================================================================
+  
+  int nHit = view.n ;
+
+  clupa_out( DEBUG1 ) << "  create clupatra TPC hits, n = " << nHit << std::endl ;
+  
+  // decode hits in parallel and sort them into (layer,zIndex) buckets - fills clupaHits, nncluHits and hitsInLayer
+  // only the hits in the region of interest are used by all stages 
+  const RegionOfInterest* roi = ( view.roi ? view.roi : &_cfg.roi ) ;
+  if( roi->empty() ) 
+    roi = 0 ;
+
+  unsigned nUsed = ingestTPCHits( view, ws, maxTPCLayers, driftLength, _cfg.nZBins, _cfg.nThreads, roi ) ;
+
+  if( roi ) 
+    clupa_out( DEBUG4 ) << "  region of interest: use " << nUsed << " of " << nHit << " TPC hits " << std::endl ;
+  
+  //===============================================================================================
+  //   choose the parameters for the occupancy of the event
+  //===============================================================================================
+
+  result.hitsPerRow = ( maxTPCLayers > 0 ? float( nUsed ) / maxTPCLayers : 0. ) ;
+
+  result.maxHitsPerZBin = 0 ;
+  for( unsigned b=0, N = ws.bucketStart.size() ; b+1 < N ; ++b )
+    result.maxHitsPerZBin = std::max( result.maxHitsPerZBin, ws.bucketStart[b+1] - ws.bucketStart[b] ) ;
+
+  const int iProfile = selectProfile( result.hitsPerRow ) ;
+
+  const ReconstructorConfig& cfg = ( iProfile < 0 ? _cfg : _profileCfgs[ iProfile ] ) ;
+
+  result.profile = ( iProfile < 0 ? std::string( "default" ) : _cfg.profiles[ iProfile ].name ) ;
+
+  ++_nProfileEvents[ iProfile < 0 ? _cfg.profiles.size() : iProfile ] ;
+
+  clupa_out( DEBUG4 ) << "  occupancy: " << result.hitsPerRow << " hits per pad row - max. " << result.maxHitsPerZBin 
+			  << " hits per z bin - use profile " << result.profile << std::endl ;
+
+  // the hit buckets and the z index of the hits depend on the binning in z - re-bin the hits in place
+  if( cfg.nZBins != _cfg.nZBins )
+    rebinTPCHits( ws, maxTPCLayers, driftLength, cfg.nZBins ) ;
+
+  HitListVector& hitsInLayer = ws.hitsInLayer ;
+
+  clupa_out( DEBUG2 ) << "  added  " <<  nncluHits.size()  << "  tp hitsInLayer - > size " <<  hitsInLayer.size() << std::endl ;
+
+  //---------------------------------------------------------------------------------------------------------
+
+  //===============================================================================================
+  //   create output collections  ( some optional )
+  //===============================================================================================
+
+  const bool writeSeedCluster        = cfg.createDebugCollections ;
+  const bool writeCluTrackSegments   = cfg.createDebugCollections ;
+  const bool writeLeftoverClusters   = cfg.createDebugCollections ;
+  
+  static const bool copyTrackSegments = false ;
+  
+  LCCollectionVec* seedCol =  ( writeSeedCluster        ?  newDebugCol( "ClupatraSeedCluster"          , result )  :   0   )  ; 
+  LCCollectionVec* cluCol  =  ( writeCluTrackSegments   ?  newDebugCol( "ClupatraInitialTrackSegments" , result )  :   0   )  ; 
+  LCCollectionVec* locCol  =  ( writeCluTrackSegments   ?  newDebugCol( "ClupatraLeftoverClusters"     , result )  :   0   )  ; 
+
+  LCCollectionVec* incSegCol  = ( writeCluTrackSegments   ?  newDebugCol( "ClupatraIncompleteSegments"   , result , true )  :   0   )  ; 
+  LCCollectionVec* curSegCol  = ( writeCluTrackSegments   ?  newDebugCol( "ClupatraCurlerSegments"       , result , true )  :   0   )  ; 
+  LCCollectionVec* finSegCol  = ( writeCluTrackSegments   ?  newDebugCol( "ClupatraFinalTrackSegments"   , result , true )  :   0   )  ; 
+
+  LCCollectionVec* outerCol  = ( cfg.createDebugCollections ?  newDebugCol( "ClupatraOuterSegments" , result ,true )  :   0   )  ; 
+  LCCollectionVec* innerCol  = ( cfg.createDebugCollections ?  newDebugCol( "ClupatraInnerSegments" , result ,true )  :   0   )  ; 
+  LCCollectionVec* middleCol = ( cfg.createDebugCollections ?  newDebugCol( "ClupatraMiddleSegments" , result ,true )  :   0   )  ; 
+
+  
+  LCCollectionVec* tsCol  =  result.segments = newTrkCol() ;
+  
+  LCCollectionVec* outCol =  result.tracks   = newTrkCol() ; 
+
+  outCol->parameters().setValue( "ClupatraProfile",        result.profile ) ;
+  outCol->parameters().setValue( "ClupatraHitsPerRow",     result.hitsPerRow ) ;
+  outCol->parameters().setValue( "ClupatraMaxHitsPerZBin", int( result.maxHitsPerZBin ) ) ;
+
+  //---------------------------------------------------------------------------------------------------------
+  
+  timer.time(t_init ) ; 
+
+  //===============================================================================================
+  //  optionally find loopers ( many turns on the same circle ) and remove their hits before the seeding 
+  //===============================================================================================
+
+  if( cfg.tagLoopers ){
+
+    LooperFinderParams lp ;
+    lp.rMax            = 0.5 * _geo.rMax ;  // larger circles leave the TPC
+    lp.minHits         = cfg.looperMinHits ;
+    lp.minVotes        = cfg.looperMinHits / 4 ;  // the outer half of the rows, spread over neighbouring bins
+    lp.minHitsPerLayer = cfg.looperMinHitsPerRow ;
+    lp.minSegmentHits  = cfg.minCluSize ;
+
+    unsigned nLoopers = findLoopers( hitsInLayer, lp, cluList, ws ) ;
+
+    clupa_out( DEBUG4 ) << " ===== tagged " << nLoopers << " loopers - created " << cluList.size() << " segments " << std::endl ;
+  }
+
+  timer.time( t_loopers ) ;
+
+  //===============================================================================================
+  // first main step of clupatra:
+  //   * cluster in pad row range - starting from the outside - to find clean cluster segments
+  //   * extend the track segments with best matching hits, based on extrapolation to next layer(s)
+  //   * add the hits and apply a Kalman filter step ( track segement is always best estimate )
+  //   * repeat in backward direction ( after smoothing back, to get a reasonable track 
+  //     state for extrapolating backwards )
+  //   * recluster the leftover hits
+  // 
+  // optionally the TPC is split into geometric domains that are processed in parallel - segments 
+  // crossing a domain boundary are stitched together in the merging of split segments below
+  //===============================================================================================
+
+  TPCDomains domains( cfg.splitZHalves, cfg.nPhiDomains, cfg.domainMargin ) ;
+
+  const unsigned nDomains = domains.size() ;
+
+  nnclu::PtrVector<SegmentFinder> finders ;
+  finders.setOwner() ;
+
+  if( nDomains < 2 ){
+
+    finders.push_back( new SegmentFinder( hitsInLayer, ws.windowHits, ws.seedHits, ws, ctx.trkSystem ) ) ;
+
+    finders[0]->find( cfg, _geo, nHit, budget ) ;
+
+  } else {
+
+    splitIntoDomains( hitsInLayer, domains, ws ) ;
+
+    for( unsigned d=0 ; d<nDomains ; ++d ){
+
+      ClupaDomainBuffers& db = ws.domains[d] ;
+
+      finders.push_back( new SegmentFinder( db.hitsInLayer, db.windowHits, db.seedHits, db, 0 ) ) ;
+    }
+
+    // one tracking system per thread - runs serially if there are no per thread systems
+    parallel_for_each_index( nDomains, ctx.trkSystems.size(), [&]( unsigned d, unsigned t ){
+	
+	finders[d]->trkSystem = ctx.trkSystems[t] ;
+	finders[d]->find( cfg, _geo, nHit, budget ) ;
+      } ) ;
+
+    // leftover hits are not used any further - no need to merge the hit lists of the domains
+  }
+
+  for( unsigned d=0 ; d < finders.size() ; ++d ){
+
+    SegmentFinder* sf = finders[d] ;
+
+    if( writeSeedCluster )      std::copy( sf->seedClusters.begin(),     sf->seedClusters.end(),     std::back_inserter( *seedCol ) ) ;
+    if( writeCluTrackSegments ) std::copy( sf->initialSegments.begin(),  sf->initialSegments.end(),  std::back_inserter( *cluCol ) ) ;
+    if( writeLeftoverClusters ) std::copy( sf->leftoverClusters.begin(), sf->leftoverClusters.end(), std::back_inserter( *locCol ) ) ;
+
+    cluList.merge( sf->cluList ) ;
+  }
+
+  clupa_out( DEBUG4 ) << " ===== found " << cluList.size() << " track segments in " << nDomains << " domain(s) " << std::endl ;
+
+  timer.time( t_seedtracks ) ;
+
+  //=======================================================================================================================
+  //  try again to gobble up hits at the ends ....   - does not work right now, as there are no fits  for the clusters....
+  //=======================================================================================================================
+
+  // clupa_out( DEBUG5 ) << " ===========     gobble up leftover hits at the ends for "  <<  cluList.size() << "  clusters " << std::endl ;
+  
+  // for( Clusterer::cluster_list::iterator icv = cluList.begin() , end = cluList.end() ; icv != end ; ++ icv ) {
+    
+  //   if( (*icv)->empty() ) continue ;
+    
+  //   int nH = 0 ;
+
+  //   nH += addHitsAndFilter( *icv , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex) ; 
+  //   static const bool backward = true ;
+  //   nH += addHitsAndFilter( *icv , hitsInLayer , cfg.dChi2Max, cfg.chi2Cut , cfg.maxStep , zIndex, backward ) ; 
+
+  //   clupa_out( DEBUG3 ) << "     added " << nH << " leftover hits to cluster " << *icv << std::endl ; 
+  // }
+
+
+  //===============================================================================================
+  //  now refit the tracks 
+  //===============================================================================================
+
+  clupa_out( DEBUG5 ) << " ===========    refitting final " << cluList.size() << " track segments  "   << std::endl ;
+
+  //---- refit cluster tracks individually to save memory ( KalTest tracks have ~1MByte each)
+
+  IMarlinTrkFitter fit( ctx.trkSystem,  cfg.dChi2Max) ; // fixme: do we need a different chi2 max here ????
+
+  for( Clusterer::cluster_list::iterator icv = cluList.begin() , end = cluList.end() ; icv != end ; ++ icv ) {
+
+    if( (*icv)->empty() ) 
+      continue ;
+
+    MarlinTrk::IMarlinTrack* trk = fit( *icv ) ;
+    if( ! cfg.previewMode ) 
+      trk->smooth() ;
+    Track* lcioTrk = converter( *icv ) ; 
+    tsCol->push_back(  lcioTrk ) ;
+    lcioTrk->ext<MarTrk>() = 0 ;
+    delete trk ;
+  }
+  
+  timer.time( t_finalfit) ;
+  
+  //===============================================================================================
+  //   optionally create collections of used and unused TPC hits 
+  //===============================================================================================
+  
+  if( cfg.createDebugCollections ) {
+    LCCollectionVec* usedHits   = new LCCollectionVec( LCIO::TRACKERHIT ) ;   ;
+    LCCollectionVec* unUsedHits = new LCCollectionVec( LCIO::TRACKERHIT ) ;   ;
+    result.debugCollections.push_back( std::make_pair( std::string( "ClupatraUsedTPCHits" ) ,   usedHits   ) ) ;
+    result.debugCollections.push_back( std::make_pair( std::string( "ClupatraUnUsedTPCHits" ) , unUsedHits ) ) ;
+    usedHits->setSubset() ;
+    unUsedHits->setSubset() ;
+    usedHits->reserve(   nncluHits.size() ) ;
+    unUsedHits->reserve( nncluHits.size() ) ;
+    
+    for( HitVec::iterator it = nncluHits.begin(), end = nncluHits.end(); it!=end;++it ){
+      
+      if( (*it)->second != 0 ){   usedHits->push_back( (*it)->first->lcioHit ) ;
+      } else {                  unUsedHits->push_back( (*it)->first->lcioHit ) ;          
+      }
+    }
+  }
+
+
+
+  //===============================================================================================
+  //  compute some track parameters for possible merging
+  //===============================================================================================
+  
+  typedef nnclu::NNClusterer<Track> TrackClusterer ;
+  TrackClusterer nntrkclu ;
+  MakeLCIOElement<Track> trkMakeElement ;
+  
+  for( int i=0,N=tsCol->getNumberOfElements() ;  i<N ; ++i ) {
+    
+    computeTrackInfo( (Track*) tsCol->getElementAt(i) , &domains ) ;
+  }
+  
+  //===============================================================================================
+  //  merge split segements 
+  //===============================================================================================
+  
+  
+  if( cfg.mergeSplitSegments ) {
+
+    // worklist: in every round only pairs with at least one track that is new in tsCol are tested - the 
+    // verdict for two segments that have both been tested before cannot change (a segment that is merged 
+    // is flagged and dropped) - stop when no more merges happen
+    int firstNew = 0 ;  
+
+    // if the TPC is split into domains, the first round only stitches segments from different domains that
+    // end close to a domain boundary - all remaining segments are then tested in the following rounds as usual
+    bool stitchRound = ( nDomains > 1 ) ;
+
+    for(unsigned round=0 ; ; ++round ) { 
+      
+      if( budget.exceeded() ){ // out of time - keep the segments as they are
+	budget.skip( TimeBudget::MergeSplitSegments ) ;
+	break ;
+      }
+
+      clupa_out( DEBUG5 ) << "===============================================================================================\n"
+			      << "  merge split segments - round " << round << ( stitchRound ? " - stitch domains" : "" ) << "\n"
+			      << "===============================================================================================\n"  ;
+      
+      int nMax  =  tsCol->size()   ;
+      
+      TrackClusterer::element_vector incSegVec ;
+      incSegVec.setOwner() ;
+      incSegVec.reserve( nMax  ) ;
+      TrackClusterer::cluster_vector incSegCluVec ;
+      incSegCluVec.setOwner() ;
+      std::vector<char> isNew ;
+      isNew.reserve( nMax ) ;
+      unsigned nNew = 0 ;
+
+      for( int i=0,N=tsCol->getNumberOfElements() ;  i<N ; ++i ){
+	
+	TrackImpl* trk = (TrackImpl*) tsCol->getElementAt(i) ;
+	
+	const TrackInfoStruct* ti = trk->ext<TrackInfo>() ;
+	
+	bool isIncompleteSegment =   !ti->isCurler  && ( !ti->startsInner || ( !ti->isCentral && !ti->isForward )  ) ;  
+	
+	std::bitset<32> type = trk->getType() ;
+
+
+	if( isIncompleteSegment  && ! type[ ILDTrackTypeBit::SEGMENT ]){ 
+	  
+	  incSegVec.push_back(  trkMakeElement( trk )  ) ; 
+	  
+	  isNew.push_back( i >= firstNew ) ;
+
+	  if( i >= firstNew ){
+
+	    ++nNew ;
+
+	    if( writeCluTrackSegments && !stitchRound )  incSegCol->addElement( trk ) ;
+	  }
+	}
+      }
+      
+      if( nNew == 0 ) 
+	break ;
+ 
+      // only geometrically compatible pairs of segments are tested with the (expensive) TrackSegmentMerger
+      std::vector< std::pair<unsigned,unsigned> > segPairs ;
+      unsigned nPruned = findSegmentMergeCandidates( incSegVec, segPairs, cfg.segmentMergeMaxDeltaPhi ) ;
+
+      // stitching: only pairs of segments from different domains that both end at a domain boundary
+      if( stitchRound ){
+
+	segPairs.erase( std::remove_if( segPairs.begin(), segPairs.end(), 
+					[&]( const std::pair<unsigned,unsigned>& p ){ 
+					  const TrackInfoStruct* ti0 = incSegVec[ p.first  ]->first->ext<TrackInfo>() ;
+					  const TrackInfoStruct* ti1 = incSegVec[ p.second ]->first->ext<TrackInfo>() ;
+					  return ti0->domain == ti1->domain || !ti0->atDomainBoundary || !ti1->atDomainBoundary ; } ), 
+			segPairs.end() ) ;
+      }
+
+      // pairs of two old segments have been rejected in a previous round 
+      unsigned nCand = segPairs.size() ;
+      segPairs.erase( std::remove_if( segPairs.begin(), segPairs.end(), 
+				      [&]( const std::pair<unsigned,unsigned>& p ){ return !isNew[ p.first ] && !isNew[ p.second ] ; } ), 
+		      segPairs.end() ) ;
+
+      _nSegPairsMemo  += nCand - segPairs.size() ;
+      _nSegPairsTested += segPairs.size() ;
+      _nSegPairsPruned += nPruned ;
+
+      TrackSegmentMerger trkMerge( cfg.dChi2Max , ctx.trkSystem ,  _geo.bField, cfg.segmentMergeGateChi2 ) ; 
+ 
+      if( cfg.parallelMergeVerdicts && ctx.trkSystems.size() > 1 ){
+
+	// evaluate the merge condition for all pairs in parallel - then link them in the same order as 
+	// cluster_candidates() and ignore pairs with segments that are already merged ( as the merger does )
+	const unsigned nT = ctx.trkSystems.size() ;
+	std::vector<char> verdicts( segPairs.size() ) ;
+	std::vector<unsigned> nGate( nT ), nKalman( nT ) ;
+
+	parallel_for_each_index( segPairs.size(), nT, [&]( unsigned i, unsigned t ){
+	    verdicts[i] = trkMerge.compatible( incSegVec[ segPairs[i].first ]->first, incSegVec[ segPairs[i].second ]->first, 
+					       ctx.trkSystems[t], nGate[t], nKalman[t] ) ;
+	  } ) ;
+
+	for( unsigned t=0 ; t<nT ; ++t ){
+	  trkMerge._nGateRejected += nGate[t] ;
+	  trkMerge._nKalmanTested += nKalman[t] ;
+	}
+
+	nntrkclu.cluster_verdicts( incSegVec.begin() , segPairs.begin(), segPairs.end(), verdicts.begin(), 
+				   std::back_inserter( incSegCluVec ), true, 2  ) ;
+      } else {
+
+	nntrkclu.cluster_candidates( incSegVec.begin() , segPairs.begin(), segPairs.end(), std::back_inserter( incSegCluVec ), trkMerge , 2  ) ;
+      }
+
+      clupa_out( DEBUG4 ) << " ===== segment merging: " << trkMerge._nGateRejected << " pairs rejected by the analytic gate, " 
+			      << trkMerge._nKalmanTested << " pairs tested with the Kalman filter " << std::endl ;
+
+      clupa_out( DEBUG4 ) << " ===== merged track segments - # cluster: " << incSegCluVec.size()   
+			      << " from " << incSegVec.size() << " incomplete track segments - tested " << segPairs.size() 
+			      << " pairs, pruned " << nPruned << ", known from previous rounds " << nCand - segPairs.size() 
+			      << "  ============================== " << std::endl ;
+    
+      firstNew = tsCol->getNumberOfElements() ;
+
+      for(  TrackClusterer::cluster_vector::iterator it= incSegCluVec.begin() ; it != incSegCluVec.end() ; ++it) {
+      
+	clupa_out( DEBUG4 ) <<  lcio::header<Track>() << std::endl ;
+      
+	TrackClusterer::cluster_type*  incSegClu = *it ;
+
+	std::vector<Track*> mergedTrk ;
+      
+	// vector to collect hits from segments
+	//      std::vector< TrackerHit* >  hits ;
+	// hits.reserve( 1024 ) ;
+	// IMPL::TrackImpl* track = new  IMPL::TrackImpl ;
+	// tsCol->addElement( track ) ;
+      
+	CluTrack hits ; 
+      
+	for( TrackClusterer::cluster_type::iterator itC = incSegClu->begin() ; itC != incSegClu->end() ; ++ itC ){
+	
+	  clupa_out( DEBUG3 ) << lcshort(  (*itC)->first ) << std::endl ; 
+	
+	  TrackImpl* trk = (TrackImpl*) (*itC)->first ;
+
+	  mergedTrk.push_back( trk ) ;
+
+	  //	std::copy( trk->getTrackerHits().begin() , trk->getTrackerHits().end() , std::back_inserter( hits ) ) ;
+
+	  for( lcio::TrackerHitVec::const_iterator it1 = trk->getTrackerHits().begin() , END =  trk->getTrackerHits().end() ; it1 != END ; ++it1 ){
+	    hits.addElement( (*it1)->ext<GHit>() )  ;
+	  }
+
+	  // flag the segments so they can be ignored for final list 
+	  trk->setTypeBit( ILDTrackTypeBit::SEGMENT ) ;
+
+	  // add old segments to new track
+	  //	track->addTrack( trk ) ;
+	}
+
+	// MarlinTrk::IMarlinTrack* mTrk = _trksystem->createTrack();
+	// EVENT::FloatVec icov( 15 ) ;
+	// icov[ 0] = 1e2 ;
+	// icov[ 2] = 1e2 ;
+	// icov[ 5] = 1e2 ;
+	// icov[ 9] = 1e2 ;
+	// icov[14] = 1e2 ;
+	// int result = createFinalisedLCIOTrack( mTrk, hits, track, !MarlinTrk::IMarlinTrack::backward, icov, _geo.bField,  cfg.dChi2Max ) ;
+	// //int result = createFinalisedLCIOTrack( mTrk, hits, track, ! MarlinTrk::IMarlinTrack::backward, icov, _geo.bField,  cfg.dChi2Max ) ; 
+	// // ??? 
+      
+	MarlinTrk::IMarlinTrack* mTrk = fit( &hits ) ;
+	mTrk->smooth() ;
+	Track* track = converter( &hits ) ; 
+	tsCol->push_back(  track ) ;
+	track->ext<MarTrk>() = 0 ;
+	delete mTrk ;
+	computeTrackInfo( track , &domains ) ;    
+
+	clupa_out( DEBUG4 ) << "   ******  created new track : " << " : " << lcshort( (Track*) track )  << std::endl ;
+
+      }
+
+      if( stitchRound ){
+	
+	// pairs that were not stitched have not all been tested yet
+	stitchRound = false ;
+	firstNew = 0 ;
+	continue ;
+      }
+
+      if( incSegCluVec.empty() ) 
+	break ;
+
+    }// loop over rounds 
+  }
+  //===============================================================================================
+  //  merge curler segments 
+  //===============================================================================================
+  
+  
+  // this also moves the final tracks to the output collection - w/o merging all segments become final tracks
+  {
+
+
+    clupa_out( DEBUG5 ) << "===============================================================================================\n"
+			    << "  merge curler segments\n"
+			    << "===============================================================================================\n"  ;
+    
+    int nMax  =  tsCol->size()   ;
+
+    TrackClusterer::element_vector curSegVec ;
+    curSegVec.setOwner() ;
+    curSegVec.reserve( nMax  ) ;
+    TrackClusterer::cluster_vector curSegCluVec ;
+    curSegCluVec.setOwner() ;
+
+    // tracks moved to the output collection - removed from tsCol in one pass at the end 
+    std::vector<char> movedToOut( nMax , 0 ) ;
+
+    //    for( int i=0,N=tsCol->getNumberOfElements() ;  i<N ; ++i ){
+    for( int i=tsCol->getNumberOfElements()-1 ;  i>=0 ; --i ){
+      
+      TrackImpl* trk = (TrackImpl*) tsCol->getElementAt(i) ;
+      
+
+      std::bitset<32> type = trk->getType() ;
+
+      if( type[ ILDTrackTypeBit::SEGMENT ] ) 
+	continue ;   // ignore previously merged track segments
+
+      const TrackInfoStruct* ti = trk->ext<TrackInfo>() ;
+      
+      bool isCompleteTrack =   ti && !ti->isCurler  && ( ti->startsInner &&  (  ti->isCentral || ti->isForward ) );  
+      
+      if( !isCompleteTrack ){ 
+	
+	curSegVec.push_back(  new TrackClusterer::element_type( trk, i )  ) ;  // Index0: index in tsCol
+	
+	if( writeCluTrackSegments )  curSegCol->addElement( trk ) ;
+	  
+      } else {   // ... is not a curler ->  add a copy to the final tracks collection 
+	  
+
+	if( copyTrackSegments) {
+
+	  outCol->addElement( copyTrackSegment( trk ) ) ;
+
+	}else{
+
+	  outCol->addElement( trk ) ;
+
+	  movedToOut[ i ] = 1 ;
+	}
+
+	if( writeCluTrackSegments )  finSegCol->addElement( trk ) ;
+      }
+    }
+    
+    //======================================================================================================
+
+
+    const float curlerMergeDist = 0.1 ;
+
+    // only pairs with close circle centers can be merged - find them with a grid search 
+    std::vector< std::pair<unsigned,unsigned> > curPairs ;
+
+    // w/o candidate pairs all segments are added to the final tracks unmerged
+    if( cfg.mergeCurlerSegments ){
+
+      if( budget.exceeded() )  // out of time 
+	budget.skip( TimeBudget::MergeCurlerSegments ) ;
+      else
+	findCircleMergeCandidates( curSegVec, curPairs, curlerMergeDist ) ;
+    }
+
+    clupa_out( DEBUG4 ) << " ===== curler merging: " << curPairs.size() << " candidate pairs from " 
+			    << curSegVec.size() << " track segments " << std::endl ;
+
+    TrackCircleDistance trkMerge( curlerMergeDist ) ; 
+
+    if( cfg.parallelMergeVerdicts && ctx.trkSystems.size() > 1 ){
+
+      // the circle distance does not depend on the clustering - evaluate it for all pairs in parallel
+      std::vector<char> verdicts( curPairs.size() ) ;
+
+      parallel_for_each_index( curPairs.size(), ctx.trkSystems.size(), [&]( unsigned i, unsigned ){
+	  verdicts[i] = trkMerge( curSegVec[ curPairs[i].first ], curSegVec[ curPairs[i].second ] ) ;
+	} ) ;
+
+      nntrkclu.cluster_verdicts( curSegVec.begin() , curPairs.begin(), curPairs.end(), verdicts.begin(), 
+				 std::back_inserter( curSegCluVec ), false, 2  ) ;
+    } else {
+
+      nntrkclu.cluster_candidates( curSegVec.begin() , curPairs.begin(), curPairs.end(), std::back_inserter( curSegCluVec ), trkMerge , 2  ) ;
+    }
+
+
+    clupa_out( DEBUG4 ) << " ===== merged tracks - # cluster: " << curSegCluVec.size()   
+			    << " from " << tsCol->size() << " track segments "    << "  ============================== " << std::endl ;
+    
+    for(  TrackClusterer::cluster_vector::iterator it= curSegCluVec.begin() ; it != curSegCluVec.end() ; ++it) {
+      
+      clupa_out( DEBUG4 ) <<  lcio::header<Track>() << std::endl ;
+      
+      TrackClusterer::cluster_type*  curSegClu = *it ;
+
+      std::list<Track*> mergedTrk ;
+
+      for( TrackClusterer::cluster_type::iterator itC = curSegClu->begin() ; itC != curSegClu->end() ; ++ itC ){
+	
+	clupa_out( DEBUG4 ) << lcshort(  (*itC)->first ) << std::endl ; 
+	
+	mergedTrk.push_back( (*itC)->first ) ; 
+      }
+      
+
+      mergedTrk.sort( TrackZSort() ) ;
+      
+      //================================================================================
+
+ 
+      if( copyTrackSegments) {
+
+	// ====== create a new LCIO track for the merged cluster ...
+	TrackImpl* trk = new TrackImpl ;
+
+	trk->setTypeBit( lcio::ILDDetID::TPC ) ; 
+
+	// == and copy all the hits 
+	unsigned hitCount = 0 ;
+	for( std::list<Track*>::iterator itML = mergedTrk.begin() ; itML != mergedTrk.end() ; ++ itML ){
+	  
+	  const TrackerHitVec& hV = (*itML)->getTrackerHits() ;
+	  for(unsigned i=0, n=hV.size() ; i<n ; ++i){
+	    
+	    trk->addHit( hV[i] ) ;
+	  }
+	  hitCount  += hV.size()  ;
+	  
+	  // add a pointer to the original track segment 
+	  trk->addTrack( *itML ) ;
+	}
+	
+	// take track states from first and last track :
+	Track* firstTrk = mergedTrk.front() ;
+	Track* lastTrk  = mergedTrk.back() ;
+	
+	const TrackState* ts = 0 ; 
+	ts = firstTrk->getTrackState( lcio::TrackState::AtIP  ) ;
+	if( ts ) trk->addTrackState( new TrackStateImpl( *ts )  ) ;
+	
+	ts = firstTrk->getTrackState( lcio::TrackState::AtFirstHit  ) ;
+	if( ts ) 	trk->addTrackState( new TrackStateImpl( *ts )  ) ;
+	
+	ts = lastTrk->getTrackState( lcio::TrackState::AtLastHit  ) ;
+	if( ts ) trk->addTrackState( new TrackStateImpl( *ts )  ) ;
+	
+	ts = lastTrk->getTrackState( lcio::TrackState::AtCalorimeter  ) ;
+	if( ts ) trk->addTrackState( new TrackStateImpl( *ts )  ) ;
+	
+	
+	trk->ext<MarTrk>() = firstTrk->ext<MarTrk>() ;
+	
+	int hitsInFit  =  firstTrk->getSubdetectorHitNumbers()[ 2 * ILDDetID::TPC - 1 ] ;
+	trk->setChi2(     firstTrk->getChi2()     ) ;
+	trk->setNdf(      firstTrk->getNdf()      ) ;
+	trk->setdEdx(     firstTrk->getdEdx()     ) ;
+	trk->setdEdxError(firstTrk->getdEdxError()) ;
+	
+	trk->subdetectorHitNumbers().resize( 2 * ILDDetID::ETD ) ;
+	trk->subdetectorHitNumbers()[ 2 * ILDDetID::TPC - 2 ] =  hitsInFit ;  
+	trk->subdetectorHitNumbers()[ 2 * ILDDetID::TPC - 1 ] =  hitCount ;  
+	
+	ts = trk->getTrackState( lcio::TrackState::AtFirstHit  ) ;
+	double RMin = ( ts ?
+			sqrt( ts->getReferencePoint()[0] * ts->getReferencePoint()[0]
+			      + ts->getReferencePoint()[1] * ts->getReferencePoint()[1] )
+			:  0.0 ) ;
+	trk->setRadiusOfInnermostHit( RMin  ) ; 
+
+    
+
+	clupa_out( DEBUG2 ) << "   create new merged track from bestTrack parameters - ptr to MarlinTrk : " << trk->ext<MarTrk>()  
+				<< "   with subdetector hit numbers  : " <<  trk->subdetectorHitNumbers()[0 ] << " , " <<  trk->subdetectorHitNumbers()[1] 
+				<< std::endl ;
+	
+	
+	outCol->addElement( trk )  ;
+
+      } else { //==========================
+	
+	// we move the first segment to the final list and keep pointers to the other segments
+
+	std::list<Track*>::iterator itML = mergedTrk.begin() ;
+
+	TrackImpl* trk = (TrackImpl*) *itML++ ;
+
+	for(  ; itML != mergedTrk.end() ; ++itML ){
+	  
+	  // add a pointer to the original track segment 
+	  trk->addTrack( *itML ) ;
+	}
+
+	outCol->addElement( trk ) ;
+
+	//remove from segment collection:
+	for( TrackClusterer::cluster_type::iterator itC = curSegClu->begin() ; itC != curSegClu->end() ; ++ itC ){
+	  if( (*itC)->first == trk ){
+	    movedToOut[ (*itC)->Index0 ] = 1 ;
+	    break ;
+	  }
+	}
+
+      }//================================================================================
+
+    }
+    //---------------------------------------------------------------------------------------------
+    // // add all tracks that have not been merged :
+    
+    for( TrackClusterer::element_vector::iterator it = curSegVec.begin(); it != curSegVec.end() ;++it){
+      
+      if( (*it)->second == 0 ){
+	
+    	TrackImpl* trk = dynamic_cast<TrackImpl*>( (*it)->first ) ;
+	
+	if( copyTrackSegments) {
+
+	  TrackImpl* t = copyTrackSegment( trk ) ;
+	
+	  clupa_out( DEBUG2 ) << "   create new track from existing LCIO track  - ptr to MarlinTrk : " << t->ext<MarTrk>()  << std::endl ;
+	
+	  outCol->addElement( t ) ;
+
+	} else { 
+	  outCol->addElement( trk ) ;
+	  
+	  //remove from segment collection:
+	  movedToOut[ (*it)->Index0 ] = 1 ;
+	}
+
+
+      }
+    }
+    
+    if( ! copyTrackSegments ){ 
+
+      // compact the segment collection - keeping the order of the remaining tracks
+      unsigned j = 0 ;
+      for( int i=0 ; i<nMax ; ++i ) 
+	if( ! movedToOut[i] ) 
+	  (*tsCol)[ j++ ] = (*tsCol)[ i ] ;
+
+      tsCol->resize( j ) ;
+    }
+  }
+  timer.time( t_merge ) ;  
+
+
+
+  //===============================================================================================
+  //  create some debug collections ....
+  //===============================================================================================
+  if( cfg.createDebugCollections ) {
+    
+    float r_inner =  _geo.rMin ; 
+    float r_outer =  _geo.rMax ; 
+
+
+    for(  LCIterator<TrackImpl> it( outCol ) ;  TrackImpl* trk = it.next()  ; ) {
+      
+
+      const TrackState* tsF = trk->getTrackState( lcio::TrackState::AtFirstHit  ) ;
+      const TrackState* tsL = trk->getTrackState( lcio::TrackState::AtLastHit  ) ;
+      
+      if( tsF == 0 || tsL == 0 ){
+
+	clupa_out( DEBUG5 ) <<  " Track in ouput collection with invalid TrackStates " << *trk << std::endl ;
+
+	continue; 
+      }
+
+      DDSurfaces::Vector3D fhPos( tsF->getReferencePoint() ) ;
+      DDSurfaces::Vector3D lhPos( tsL->getReferencePoint() ) ;
+      
+
+      bool startsInner =  std::abs( fhPos.rho() - r_inner )     <  cfg.trackStartsInnerDist ;        // first hit close to inner field cage 
+      bool isCentral   =  std::abs( lhPos.rho() - r_outer )     <  cfg.trackEndsOuterCentralDist ;   // last hit close to outer field cage
+      bool isForward   =  !cfg.streamWindow && driftLength - std::abs( lhPos.z() ) < cfg.trackEndsOuterForwardDist ;  // last hitclose to endcap
+      bool isCurler    =  std::abs( tsF->getOmega() )           >  cfg.trackIsCurlerOmega  ;         // curler segment ( r <~ 1m )
+      bool endsOuter   = isCentral || isForward ;
+     
+
+      if( isCurler )  continue ;
+
+
+      if( !startsInner && endsOuter ) {
+	
+	outerCol->addElement( trk ) ;
+      } 
+      if( startsInner &&  !endsOuter ) {
+	
+	innerCol->addElement( trk ) ;
+      } 
+      if( !startsInner &&  !endsOuter ) {    
+	
+	middleCol->addElement( trk ) ;
+      }
+      
+    }  
+  }
+ //---------------------------------------------------------------------------------------------------------
+
+
+
+
+  //===============================================================================================
+  //  flag the event if stages have been skipped
+  //===============================================================================================
+
+  result.skippedStages = budget.skipped() ;
+
+  if( result.skippedStages ){
+
+    ++_nOverBudget ;
+
+    StringVec stages ;
+    TimeBudget::stageNames( result.skippedStages, stages ) ;
+
+    outCol->parameters().setValues( "ClupatraSkippedStages", stages ) ;
+
+    // one message - the lines of concurrent events are not interleaved
+    std::stringstream msg ;
+    msg << " time budget of " << cfg.timeBudget << " s exceeded for " << nHit << " TPC hits - skipped or degraded stages: " ;
+    for( unsigned i=0 ; i < stages.size() ; ++i )
+      msg << stages[i] << " " ;
+
+    clupa_out( WARNING ) << msg.str() << std::endl ;
+  }
+
+  if( result.fillTrackResults )
+    fillTrackResults( result, ctx ) ;
+
+  clupa_out( DEBUG9 )  <<  timer.toString () << std::endl ;
+}
+
+//----------------------------------------------------------------
+
+LCCollectionVec* Reconstructor::newDebugCol( const std::string& name, ReconstructionResult& result, bool isSubset ) const {
+
+  LCCollectionVec* col = newTrkCol( isSubset ) ;
+
+  result.debugCollections.push_back( std::make_pair( name, col ) ) ;
+
+  return col ;
+}
+
+//----------------------------------------------------------------
+
+void Reconstructor::fillTrackResults( ReconstructionResult& result, ClupaEventContext& ctx ) const {
+
+  const std::vector<ClupaHit>& clupaHits = ctx.ws.clupaHits ;
+
+  int nTrk = result.tracks->getNumberOfElements() ;
+
+  result.trackResults.resize( nTrk ) ;
+
+  for( int i=0 ; i < nTrk ; ++i ){
+
+    Track* trk = (Track*) result.tracks->getElementAt( i ) ;
+
+    TrackResult& tr = result.trackResults[i] ;
+
+    tr.chi2 = trk->getChi2() ;
+    tr.ndf  = trk->getNdf() ;
+
+    // the index of the hit in the view is the index of its clupa hit
+    const TrackerHitVec& hV = trk->getTrackerHits() ;
+    tr.hits.reserve( hV.size() ) ;
+
+    for( unsigned j=0, N = hV.size() ; j<N ; ++j ){
+
+      Hit* gh = hV[j]->ext<GHit>() ;
+
+      if( gh ) 
+	tr.hits.push_back( gh->first - &clupaHits[0] ) ;
+    }
+
+    const TrackStateVec& tsV = trk->getTrackStates() ;
+    tr.states.resize( tsV.size() ) ;
+
+    for( unsigned j=0, N = tsV.size() ; j<N ; ++j ){
+
+      const TrackState* ts = tsV[j] ;
+      TrackParameters& tp = tr.states[j] ;
+
+      tp.location  = ts->getLocation() ;
+      tp.d0        = ts->getD0() ;
+      tp.phi       = ts->getPhi() ;
+      tp.omega     = ts->getOmega() ;
+      tp.z0        = ts->getZ0() ;
+      tp.tanLambda = ts->getTanLambda() ;
+
+      std::copy( ts->getReferencePoint() , ts->getReferencePoint() + 3 , tp.referencePoint ) ;
+      std::copy( ts->getCovMatrix().begin() , ts->getCovMatrix().end() , tp.covMatrix ) ;
+    }
+  }
+}
+
+//----------------------------------------------------------------
+
+std::string Reconstructor::statistics() const {
+
+  std::stringstream s ;
+
+  s << " merging of split segments: tested " << _nSegPairsTested << " pairs of segments - pruned " 
+    << _nSegPairsPruned << " pairs - skipped " << _nSegPairsMemo << " pairs known from previous rounds " ;
+
+  if( _cfg.timeBudget > 0. )
+    s << "\n time budget of " << _cfg.timeBudget << " s per event exceeded in " << _nOverBudget << " events " ;
+
+  if( ! _cfg.profiles.empty() ){
+
+    s << "\n occupancy profiles: " ;
+
+    for( unsigned i=0 ; i < _cfg.profiles.size() ; ++i )
+      s << _cfg.profiles[i].name << " " << _nProfileEvents[i] << " events - " ;
+
+    s << "no profile " << _nProfileEvents[ _cfg.profiles.size() ] << " events " ;
+  }
+
+  const std::vector<ClupaEventContext*>& ctxs = _contexts->contexts() ;
+
+  for( unsigned c=0 ; c < ctxs.size() ; ++c )
+    s << "\n" << ctxs[c]->ws.statistics() ;
+
+  return s.str() ;
+}
+
+ /*************************************************************************************************/
+
+void Reconstructor::computeTrackInfo(  lcio::Track* lTrk, const TPCDomains* domains ) const {
+  
+  if( ! lTrk->ext<TrackInfo>() )
+    lTrk->ext<TrackInfo>() =  new TrackInfoStruct ;
+
+  float r_inner = _geo.rMin ;
+  float r_outer = _geo.rMax ;
+  float driftLength = _geo.driftLength ;
+
+  // compute z-extend of this track segment
+  const lcio::TrackerHitVec& hv = lTrk->getTrackerHits() ;
+  
+  float zMin =  1e99 ;
+  float zMax = -1e99 ;
+  float zAvg =  0. ;
+  
+  if( hv.size() >  1 ) {
+    zMin = hv[            0  ]->getPosition()[2] ;
+    zMax = hv[ hv.size() -1  ]->getPosition()[2] ;
+    zAvg = ( zMax + zMin ) / 2. ;
+  }
+  
+  if( zMin > zMax ){ // swap 
+    float d = zMax ;
+    zMax = zMin ;
+    zMin = d  ;
+  }
+  
+  const lcio::TrackState* tsF = lTrk->getTrackState( lcio::TrackState::AtFirstHit  ) ;
+  const lcio::TrackState* tsL = lTrk->getTrackState( lcio::TrackState::AtLastHit  ) ;
+  
+  // protect against bad tracks 
+  if(  tsF == 0 ) return ;
+  if(  tsL == 0 ) return ;
+  
+  DDSurfaces::Vector3D fhPos( tsF->getReferencePoint() ) ;
+  DDSurfaces::Vector3D lhPos( tsL->getReferencePoint() ) ;
+  
+
+  TrackInfoStruct* ti = lTrk->ext<TrackInfo>() ;
+
+  ti->startsInner =  std::abs( fhPos.rho() - r_inner )     <  _cfg.trackStartsInnerDist ;        // first hit close to inner field cage 
+  ti->isCentral   =  std::abs( lhPos.rho() - r_outer )     <  _cfg.trackEndsOuterCentralDist ;   // last hit close to outer field cage
+  ti->isForward   =  !_cfg.streamWindow && driftLength - std::abs( lhPos.z() ) < _cfg.trackEndsOuterForwardDist ;  // last hitclose to endcap
+  ti->isCurler    =  std::abs( tsF->getOmega() )           >  _cfg.trackIsCurlerOmega  ;         // curler segment ( r <~ 1m )
+  
+  ti->zMin = zMin ;
+  ti->zMax = zMax ;
+  ti->zAvg = zAvg ;
+
+  if( domains && domains->size() > 1 && ! hv.empty() ){
+    
+    ti->domain = domains->index( DDSurfaces::Vector3D( hv[0]->getPosition() ) ) ;
+    ti->atDomainBoundary = domains->nearBoundary( fhPos ) || domains->nearBoundary( lhPos ) ;
+  }
+
+  // circle parameters for merging curler segments - computed once per segment
+  ti->setCircle( lTrk ) ;
+}
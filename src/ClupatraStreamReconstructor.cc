@@ -0,0 +1,306 @@
+#include "ClupatraStreamReconstructor.h"
+
+#include "clupatra_new.h"
+
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <float.h>
+
+
+using namespace lcio ;
+
+using namespace clupatra ;
+
+
+namespace{
+
+  /** The configuration of the windows: no stages that depend on the position of the hits in z. */
+  ReconstructorConfig windowConfig( const ReconstructorConfig& cfg ){
+
+    ReconstructorConfig wcfg( cfg ) ;
+
+    wcfg.streamWindow = true ;
+    wcfg.splitZHalves = false ;
+    wcfg.roi = RegionOfInterest() ;
+
+    return wcfg ;
+  }
+}
+
+
+StreamReconstructor::StreamReconstructor( const ReconstructorConfig& cfg, const TPCGeometry& geo, const StreamConfig& scfg ) :
+  _reco( windowConfig( cfg ), geo ),
+  _length( scfg.windowLength > 0. ? scfg.windowLength : 2. * geo.driftLength ),
+  _overlap( scfg.overlap > 0. ? scfg.overlap : geo.driftLength ),
+  _windowStart( 0. ),
+  _lastWindowStart( 0. ),
+  _started( false ),
+  _nHits( 0 ),
+  _nWindows( 0 ),
+  _nTracks( 0 ),
+  _nForced( 0 ),
+  _nLate( 0 ) {
+
+  // the window is shifted into the TPC - it can not be longer than the drift region
+  if( _length > 2. * geo.driftLength )
+    throw lcio::Exception( " StreamReconstructor: the window is longer than the drift region of the TPC " ) ;
+
+  if( !( _overlap < _length ) )
+    throw lcio::Exception( " StreamReconstructor: the overlap has to be shorter than the window " ) ;
+
+  _result.fillTrackResults = true ;
+}
+
+StreamReconstructor::~StreamReconstructor(){
+}
+
+//----------------------------------------------------------------
+
+void StreamReconstructor::addHits( const TPCHitView& view ){
+
+  if( view.n > 0 && view.handle == 0 && ( view.pos == 0 || view.cellID0 == 0 || view.cov == 0 ) )
+    throw lcio::Exception( " StreamReconstructor::addHits: a hit view w/o handles needs the positions, cellIDs and covariances " ) ;
+
+  if( ! _started && view.n > 0 ){  // the first window starts at the first hit of the stream
+
+    _windowStart = DBL_MAX ;
+    for( unsigned i=0 ; i < view.n ; ++i )
+      _windowStart = std::min( _windowStart, ( view.pos ? view.pos[ i * view.posStride + 2 ] : view.handle[i]->getPosition()[2] ) ) ;
+
+    _started = true ;
+  }
+
+  for( unsigned i=0 ; i < view.n ; ++i ){
+
+    StreamHit h ;
+
+    const EVENT::TrackerHit* th = ( view.handle ? view.handle[i] : 0 ) ;
+
+    h.index  = _nHits++ ;
+
+    const double* pos = ( view.pos ? view.pos + i * view.posStride : th->getPosition() ) ;
+    std::copy( pos, pos + 3, h.pos ) ;
+
+    h.cellID0 = ( view.cellID0 ? view.cellID0[ i * view.cellIDStride ] : th->getCellID0() ) ;
+    h.cellID1 = ( view.cellID0 ? ( view.cellID1 ? view.cellID1[ i * view.cellIDStride ] : 0 ) : th->getCellID1() ) ;
+
+    if( view.cov ) 
+      std::copy( view.cov + i * view.covStride, view.cov + i * view.covStride + 6, h.cov ) ;
+    else
+      std::copy( th->getCovMatrix().begin(), th->getCovMatrix().begin() + 6, h.cov ) ;
+
+    h.eDep = ( view.eDep ? view.eDep[ i * view.eDepStride ] : ( th ? th->getEDep() : 0. ) ) ;
+
+    if( h.pos[2] < _windowStart ){
+
+      ++_nLate ;
+      continue ;
+    }
+
+    _hits.push_back( h ) ;
+  }
+}
+
+//----------------------------------------------------------------
+
+unsigned StreamReconstructor::process( std::vector<TrackResult>& tracks ){
+
+  unsigned nTrk = 0 ;
+
+  for(;;){
+
+    if( _hits.empty() )
+      break ;
+
+    // a window is complete if the stream has reached its end
+    double zMin =  DBL_MAX ;
+    double zMax = -DBL_MAX ;
+    for( unsigned i=0 ; i < _hits.size() ; ++i ){
+      zMin = std::min( zMin, _hits[i].pos[2] ) ;
+      zMax = std::max( zMax, _hits[i].pos[2] ) ;
+    }
+
+    _windowStart = std::max( _windowStart, zMin ) ;  // no empty windows in gaps of the stream
+
+    if( zMax < _windowStart + _length )
+      break ;
+
+    nTrk += reconstructWindow( tracks, false ) ;
+  }
+
+  return nTrk ;
+}
+
+//----------------------------------------------------------------
+
+unsigned StreamReconstructor::flush( std::vector<TrackResult>& tracks ){
+
+  unsigned nTrk = process( tracks ) ;
+
+  if( ! _hits.empty() ){
+
+    for( unsigned i=0 ; i < _hits.size() ; ++i )
+      _windowStart = std::min( _windowStart, _hits[i].pos[2] ) ;
+
+    nTrk += reconstructWindow( tracks, true ) ;
+  }
+
+  _hits.clear() ;
+  _started = false ;
+
+  return nTrk ;
+}
+
+//----------------------------------------------------------------
+
+unsigned StreamReconstructor::reconstructWindow( std::vector<TrackResult>& tracks, bool last ){
+
+  ++_nWindows ;
+  _lastWindowStart = _windowStart ;
+
+  const double step    = _length - _overlap ;
+  const double wEnd    = _windowStart + _length ;
+  const double zCenter = _windowStart + 0.5 * _length ; // is shifted to z=0 of the TPC
+
+  std::sort( _hits.begin(), _hits.end(), []( const StreamHit& a, const StreamHit& b ){
+      return ( a.pos[2] < b.pos[2] || ( a.pos[2] == b.pos[2] && a.index < b.index ) ) ;
+    } ) ;
+
+  // hits in the window
+  unsigned n = 0 ;
+  while( n < _hits.size() && _hits[n].pos[2] < wEnd )
+    ++n ;
+
+  //---- the hit view of the window with the hits at their position in the TPC - the Reconstructor creates the LCIO hits
+  _localPos.resize( 3 * n ) ;
+  _localCellIDs.resize( 2 * n ) ;
+  _localCov.resize( 6 * n ) ;
+  _localEDep.resize( n ) ;
+
+  for( unsigned k=0 ; k<n ; ++k ){
+
+    const StreamHit& h = _hits[k] ;
+
+    double* pos = &_localPos[ 3 * k ] ;
+    pos[0] = h.pos[0] ;
+    pos[1] = h.pos[1] ;
+    pos[2] = h.pos[2] - zCenter ;
+
+    _localCellIDs[ 2 * k     ] = h.cellID0 ;
+    _localCellIDs[ 2 * k + 1 ] = h.cellID1 ;
+
+    std::copy( h.cov, h.cov + 6, &_localCov[ 6 * k ] ) ;
+
+    _localEDep[k] = h.eDep ;
+  }
+
+  TPCHitView view ;
+  view.n            = n ;
+  view.pos          = ( n ? &_localPos[0] : 0 ) ;
+  view.cellID0      = ( n ? &_localCellIDs[0] : 0 ) ;
+  view.cellID1      = ( n ? &_localCellIDs[1] : 0 ) ;
+  view.cellIDStride = 2 ;
+  view.cov          = ( n ? &_localCov[0] : 0 ) ;
+  view.eDep         = ( n ? &_localEDep[0] : 0 ) ;
+
+  reconstructWindowHits( view, _result ) ;
+
+  //---- emit the final tracks - the hits of unfinished candidates are carried into the next window
+
+  // hit states: 0 free, 1 used by an emitted track, 2 used by an unfinished candidate
+  _hitState.assign( n, 0 ) ;
+
+  const double minNext = _windowStart + 0.5 * step ;  // the window advances by at least half a step
+  double next = ( last ? wEnd : _windowStart + step ) ;
+
+  unsigned nTrk = 0 ;
+
+  for( unsigned t=0 ; t < _result.trackResults.size() ; ++t ){
+
+    const TrackResult& tr = _result.trackResults[t] ;
+
+    if( tr.hits.empty() )
+      continue ;
+
+    double zMin =  DBL_MAX ;
+    double zMax = -DBL_MAX ;
+
+    for( unsigned j=0 ; j < tr.hits.size() ; ++j ){
+
+      zMin = std::min( zMin, _hits[ tr.hits[j] ].pos[2] ) ;
+      zMax = std::max( zMax, _hits[ tr.hits[j] ].pos[2] ) ;
+    }
+
+    const bool unfinished = !last && zMax >= _windowStart + step ;
+
+    if( unfinished && zMin >= minNext ){
+
+      for( unsigned j=0 ; j < tr.hits.size() ; ++j )
+	_hitState[ tr.hits[j] ] = 2 ;
+
+      next = std::min( next, zMin ) ;
+
+      continue ;
+    }
+
+    if( unfinished )  // longer than the overlap - the window would not advance
+      ++_nForced ;
+
+    tracks.push_back( tr ) ;
+    TrackResult& out = tracks.back() ;
+
+    for( unsigned j=0 ; j < out.hits.size() ; ++j ){
+
+      _hitState[ tr.hits[j] ] = 1 ;
+
+      out.hits[j] = _hits[ tr.hits[j] ].index ;
+    }
+
+    for( unsigned j=0 ; j < out.states.size() ; ++j )
+      out.states[j].referencePoint[2] += zCenter ;
+
+    ++nTrk ;
+  }
+
+  _result.clear() ;
+
+  //---- keep the hits of the unfinished candidates, the free hits after the start of the next window and the following windows
+  unsigned m = 0 ;
+  for( unsigned k=0 ; k < _hits.size() ; ++k ){
+
+    bool keep = ( k >= n ) || ( _hitState[k] != 1 && _hits[k].pos[2] >= next ) ;
+
+    if( keep )
+      _hits[ m++ ] = _hits[k] ;
+  }
+  _hits.resize( m ) ;
+
+  clupa_out( DEBUG4 ) << "  StreamReconstructor: window [" << _windowStart << "," << wEnd << "[ with " << n << " hits - emitted "
+			  << nTrk << " tracks - next window at " << next << " with " << m << " buffered hits " << std::endl ;
+
+  _windowStart = next ;
+  _nTracks += nTrk ;
+
+  return nTrk ;
+}
+
+//----------------------------------------------------------------
+
+void StreamReconstructor::reconstructWindowHits( const TPCHitView& view, ReconstructionResult& result ){
+
+  _reco.reconstruct( view, result ) ;
+}
+
+//----------------------------------------------------------------
+
+std::string StreamReconstructor::statistics() const {
+
+  std::stringstream s ;
+
+  s << " stream reconstruction: " << _nWindows << " windows of " << _length << " mm with an overlap of " << _overlap
+    << " mm - emitted " << _nTracks << " tracks ( " << _nForced << " before they were complete ) - ignored "
+    << _nLate << " late hits \n" << _reco.statistics() ;
+
+  return s.str() ;
+}
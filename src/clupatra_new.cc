@@ -1,4 +1,5 @@
 #include "clupatra_new.h"
+#include "ClupatraReconstructor.h"
 #include <set>
 #include <vector>
 
@@ -8,19 +9,16 @@
 #include <UTIL/ILDConf.h>
 #include <UTIL/BitSet32.h>
 
-#include "marlin/Global.h"
 
 #include "IMPL/TrackerHitImpl.h"
+#include "EVENT/TrackerHitPlane.h"
 #include "IMPL/TrackStateImpl.h"
 
-#include "MarlinTrk/Factory.h"
-#include "MarlinTrk/MarlinKalTest.h"
 
 // --- DD4hep ---
-#include "DD4hep/LCDD.h"
 #include "DDSurfaces/Vector3D.h"
+#include "DDSurfaces/ISurface.h"
 #include "DD4hep/DD4hepUnits.h" 
-#include "DDRec/DetectorData.h"
 
 
 #include "gearimpl/Vector3D.h"
@@ -35,6 +33,10 @@ namespace lcio{
 
 namespace clupatra_new{
   
+  std::recursive_mutex& LogLock::mutex(){
+    static std::recursive_mutex m ;
+    return m ;
+  }
   
   /** helper class to compute the chisquared of two points in rho and z coordinate */
   struct Chi2_RPhi_Z_Hit{
@@ -64,38 +66,23 @@ namespace clupatra_new{
 
   //-------------------------------------------------------------------------------
 
-  struct CDot{
-    CDot( int i , int j , double d) : I(i) , J(j) , Dot( d ) {}
-    int I ;
-    int J ;
-    double Dot ;
-  };
-  
-  bool sort_CDot( const CDot& c0 ,const CDot& c1 ){
-    return c0.Dot > c1.Dot ;
-  }
-
-  //-------------------------------------------------------------------------------
   
 
-  int addHitsAndFilter( CluTrack* clu, HitListVector& hLV , double dChi2Max, double chi2Cut, unsigned maxStep, ZIndex& zIndex, bool backward, 
+  int addHitsAndFilter( CluTrack* clu, HitListVector& hLV , double dChi2Max, double chi2Cut, unsigned maxStep, ZIndex& zIndex, int nPadRows, bool backward, 
 			MarlinTrk::IMarlinTrkSystem* trkSys ) {
     
 
     int nHitsAdded = 0 ;
 
-    DD4hep::Geometry::LCDD& lcdd = DD4hep::Geometry::LCDD::getInstance();
-    DD4hep::Geometry::DetElement tpcDE = lcdd.detector("TPC") ;
-    DD4hep::DDRec::FixedPadSizeTPCData* tpc = tpcDE.extension<DD4hep::DDRec::FixedPadSizeTPCData>() ;
-    const int maxTPCLayerID  = tpc->maxRow ;
+    const int maxTPCLayerID  = nPadRows ;
 
     
-    clu->sort( LayerSortIn() ) ;
+    sortLayers( clu, false ) ;
     
-    int layer =  ( backward ?  clu->front()->first->layer : clu->back()->first->layer   ) ; 
+    int layer =  ( backward ?  clu->summary().lastLayer : clu->summary().firstLayer ) ; 
 
     
-    streamlog_out( DEBUG2 ) <<  " ======================  addHitsAndFilter():  - layer " << layer << "  backward: " << backward << std::endl  ;
+    clupa_out( DEBUG2 ) <<  " ======================  addHitsAndFilter():  - layer " << layer << "  backward: " << backward << std::endl  ;
 
 
    if( layer <= 0  || layer >=  maxTPCLayerID   ) 
@@ -107,7 +94,7 @@ namespace clupatra_new{
     IMarlinTrack* trk =  clu->ext<MarTrk>() ;
 
     if(  trk == 0 ){
-      streamlog_out( DEBUG3 ) <<  "  addHitsAndFilter called with null pointer to MarlinTrk  - won't do anything " << std::endl ;
+      clupa_out( DEBUG3 ) <<  "  addHitsAndFilter called with null pointer to MarlinTrk  - won't do anything " << std::endl ;
       return  nHitsAdded;
     } 
     
@@ -129,11 +116,11 @@ namespace clupatra_new{
 
       if( it == end ) --it ;
 
-      streamlog_out( DEBUG2  ) <<  " ---- addHitsAndFilter : will smooth back to " << i <<"th  hit - size of clu " << clu->size() << std::endl ;
+      clupa_out( DEBUG2  ) <<  " ---- addHitsAndFilter : will smooth back to " << i <<"th  hit - size of clu " << clu->size() << std::endl ;
 
       if( !  (*it)->first ){
 
-	streamlog_out( ERROR ) << " ---- addHitsAndFilter : null pointer at i-th hit : i = " << i << std::endl ;
+	clupa_out( ERROR ) << " ---- addHitsAndFilter : null pointer at i-th hit : i = " << i << std::endl ;
 	return nHitsAdded ;
       }
 
@@ -147,7 +134,7 @@ namespace clupatra_new{
       IMPL::TrackStateImpl ts ; 
       trk->getTrackState( firstHit , ts, chi2,  ndf ) ;
       
-      streamlog_out( DEBUG3 ) <<  "  -- addHitsAndFilter(): smoothed track segment : " <<  MarlinTrk::errorCode( smoothed ) 
+      clupa_out( DEBUG3 ) <<  "  -- addHitsAndFilter(): smoothed track segment : " <<  MarlinTrk::errorCode( smoothed ) 
 			      <<  " using track state : " <<   ts 
 			      <<  " ---- chi2: " << chi2 
 			      <<  "  ndf " << ndf 
@@ -208,7 +195,7 @@ namespace clupatra_new{
       DDSurfaces::Vector3D xv( gxv.x() , gxv.y(), gxv.z()  )   ;
 	
 
-      streamlog_out( DEBUG2 ) <<  "  -- addHitsAndFilter(): looked for intersection - " 
+      clupa_out( DEBUG2 ) <<  "  -- addHitsAndFilter(): looked for intersection - " 
 			     <<  "  Step : " << step 
 			     <<  "  at layer: "   << layer      
 			     <<  "   intersects: " << MarlinTrk::errorCode( intersects )
@@ -224,7 +211,7 @@ namespace clupatra_new{
 	double ch2Min = 1.e99 ;
 	Hit* bestHit = 0 ;
 
-	streamlog_out( DEBUG3 ) <<  "      -- number of hits on layer " << layer << " : " << hLL.size() << std::endl ; 
+	clupa_out( DEBUG3 ) <<  "      -- number of hits on layer " << layer << " : " << hLL.size() << std::endl ; 
 
 	for( HitList::const_iterator ih = hLL.begin(), end = hLL.end() ; ih != end ; ++ih ){    
 	  
@@ -243,7 +230,7 @@ namespace clupatra_new{
 	
  	if( bestHit != 0 ){
 	  
-	  streamlog_out( DEBUG3 ) <<   " ************ bestHit "  << bestHit 
+	  clupa_out( DEBUG3 ) <<   " ************ bestHit "  << bestHit 
 				  <<   " pos : " <<   (bestHit ? bestHit->first->pos :  DDSurfaces::Vector3D() ) 
 				  <<   " chi2: " <<  ch2Min 
 				  <<   " chi2Cut: " <<  chi2Cut <<   std::endl ;
@@ -258,7 +245,7 @@ namespace clupatra_new{
 	    
 	    
 	    
-	    streamlog_out( DEBUG3 ) <<   " *****       assigning left over hit : " << errorCode( addHit )  //<< hPos << " <-> " << xv
+	    clupa_out( DEBUG3 ) <<   " *****       assigning left over hit : " << errorCode( addHit )  //<< hPos << " <-> " << xv
 				    <<   " dist: " <<  (  hPos - xv ).r()
 				    <<   " chi2: " <<  ch2Min 
 				    <<   "  hit errors :  rphi=" <<  sqrt( bestHit->first->lcioHit->getCovMatrix()[0] 
@@ -272,14 +259,14 @@ namespace clupatra_new{
 	      
 	      hitAdded = true ;
 	      
-	      hLL.remove(  bestHit ) ;
+	      removeHit( hLL, bestHit ) ;
 	      clu->addElement( bestHit ) ;
 	      
 	      firstHit = 0 ; // after we added a hit, the next intersection search should use this last hit...
 	      
 	      ++nHitsAdded ;
 
-	      streamlog_out( DEBUG ) <<   " ---- track state filtered with new hit ! ------- " << std::endl ;
+	      clupa_out( DEBUG ) <<   " ---- track state filtered with new hit ! ------- " << std::endl ;
 	    }
 	  } // chi2Cut 
 	} // bestHit
@@ -329,7 +316,7 @@ namespace clupatra_new{
  
  //  IMarlinTrack::modeBackward , IMarlinTrack::modeForward 
     
-    streamlog_out( DEBUG2 ) <<  "  ============ addHitAndFilter(): looked for intersection - " 
+    clupa_out( DEBUG2 ) <<  "  ============ addHitAndFilter(): looked for intersection - " 
 			    <<  "  detector : " <<  detectorID 
 			    <<  "  at layer: "   << layer      
 			    <<  "  intersects: " << MarlinTrk::errorCode( intersects )
@@ -365,7 +352,7 @@ namespace clupatra_new{
       }//-------------------------------------------------------------------
       
       
-      streamlog_out( DEBUG2 ) <<   " ************ bestHit "  << bestHit 
+      clupa_out( DEBUG2 ) <<   " ************ bestHit "  << bestHit 
 			     <<   " pos : " <<   (bestHit ? bestHit->first->pos :  DDSurfaces::Vector3D() ) 
 			     <<   " chi2: " <<  ch2Min 
 			     <<   " chi2Cut: " <<  chi2Cut <<   std::endl ;
@@ -382,7 +369,7 @@ namespace clupatra_new{
 	  
 	  
 	  
-	  streamlog_out( DEBUG2 ) <<   " *****       assigning left over hit : " << errorCode( addHit )  //<< hPos << " <-> " << xv
+	  clupa_out( DEBUG2 ) <<   " *****       assigning left over hit : " << errorCode( addHit )  //<< hPos << " <-> " << xv
 				 <<   " dist: " <<  (  hPos - xv ).r()
 				 <<   " chi2: " <<  ch2Min 
 				 <<   "  hit errors :  rphi=" <<  sqrt( bestHit->first->lcioHit->getCovMatrix()[0] 
@@ -398,11 +385,11 @@ namespace clupatra_new{
 	    
 	    hitAdded = true ;
 	    
-	    hLL.remove(  bestHit ) ;
+	    removeHit( hLL, bestHit ) ;
 	    clu->addElement( bestHit ) ;
 	    
 	    
-	    streamlog_out( DEBUG2 ) <<   " ---- track state filtered with new hit ! ------- " << std::endl ;
+	    clupa_out( DEBUG2 ) <<   " ---- track state filtered with new hit ! ------- " << std::endl ;
 	  }
 	} // chi2Cut 
       } // bestHit
@@ -417,28 +404,18 @@ namespace clupatra_new{
 
   void getHitMultiplicities( CluTrack* clu, std::vector<int>& mult ){
     
-    std::map<int, unsigned > hm ;
-    
-    for( CluTrack::iterator it=clu->begin(), end =clu->end() ;   it != end ; ++ it ){
-      
-      ++hm[ (*it)->first->layer ] ;
-    }
+    // the number of layers with n hits is kept in the cluster summary
+    const std::vector<unsigned>& lwn = clu->summary().layersWithNHits ;
 
     unsigned maxN = mult.size() - 1 ;
 
-    //    for( unsigned i=0 ; i < hLV.size() ; ++i ){
-    //      unsigned m =  hLV[i].size() ;  
-      
-    for( std::map<int, unsigned>::iterator it= hm.begin() , end = hm.end() ; it != end ; ++ it ){
+    for( unsigned n=1, N = lwn.size() ; n < N ; ++n ){
       
-      unsigned m = ( it->second < maxN ?  it->second  :  maxN   ) ;
-      
-      if( m == 0 ) 
-	continue ;
+      unsigned m = ( n < maxN ?  n  :  maxN   ) ;
       
-      ++mult[m] ;
+      mult[m] += lwn[n] ;
       
-      ++mult[0] ;
+      mult[0] += lwn[n] ;
     }
   }
 
@@ -454,10 +431,10 @@ namespace clupatra_new{
       getHitMultiplicities( clu , mult ) ;
       
 
-      streamlog_out(  DEBUG2 ) << " **** split_multiplicity -  hit multiplicities: \n" ;
+      clupa_out(  DEBUG2 ) << " **** split_multiplicity -  hit multiplicities: \n" ;
       
       for( unsigned i=0,n=mult.size() ; i<n ; ++i) {
-      	streamlog_out(  DEBUG2 ) << "     m["<<i<<"] = " <<  mult[i] << "\n"  ;
+      	clupa_out(  DEBUG2 ) << "     m["<<i<<"] = " <<  mult[i] << "\n"  ;
       }
       
       
@@ -470,25 +447,25 @@ namespace clupatra_new{
 	
 	if( m == 2 && mult[m] >= layerWithMultiplicity ){
 	  
-	  streamlog_out(  DEBUG3 ) << " **** split_multiplicity - create_two_clusters \n" ;
+	  clupa_out(  DEBUG3 ) << " **** split_multiplicity - create_two_clusters \n" ;
 	  
- 	  create_two_clusters( *clu , cluList  ) ;
+ 	  create_two_clusters( *clu , cluList ) ;
 	  
 	  split_cluster = true  ;
 	}
 	else if( m == 3 && mult[m] >= layerWithMultiplicity ){
 	  
-	  streamlog_out(  DEBUG3 ) << " **** split_multiplicity - create_three_clusters \n" ;
+	  clupa_out(  DEBUG3 ) << " **** split_multiplicity - create_three_clusters \n" ;
 	  
-	  create_three_clusters( *clu , cluList  ) ;
+	  create_three_clusters( *clu , cluList ) ;
 	  
 	  split_cluster = true  ;
 	}
 	else if(  mult[m] >= layerWithMultiplicity ){
 	  
-	  streamlog_out(  DEBUG3 ) << " **** split_multiplicity - create_n_clusters \n" ;
+	  clupa_out(  DEBUG3 ) << " **** split_multiplicity - create_n_clusters \n" ;
 	  
-	  create_n_clusters( *clu ,cluList , m  ) ;
+	  create_n_clusters( *clu ,cluList , m ) ;
 	  
 	  split_cluster = true  ;
 	}
@@ -508,418 +485,194 @@ namespace clupatra_new{
 
   //------------------------------------------------------------------------------------------------------------------------- 
 
-  void create_n_clusters( Clusterer::cluster_type& hV, Clusterer::cluster_list& cluVec , unsigned n ) {
-    
-    if( n < 4 ){
-      
-      streamlog_out( ERROR ) <<  " create_n_clusters called for n = " << n << std::endl ;
-      return ;
-    }
-    
-    // copy of the algorithm for creating three clusters (minimize angle between hits as seen from IP)
-    
-    hV.freeElements() ;
-
-    DD4hep::Geometry::LCDD& lcdd = DD4hep::Geometry::LCDD::getInstance();
-    DD4hep::Geometry::DetElement tpcDE = lcdd.detector("TPC") ;
-    DD4hep::DDRec::FixedPadSizeTPCData* tpc = tpcDE.extension<DD4hep::DDRec::FixedPadSizeTPCData>() ;
-    const int tpcNRow  = tpc->maxRow ;
+  /** Engine for splitting a cluster into N clusters: the hits are sorted inwards in layer and only layers 
+   *  with exactly N hits are used. The N hits in the first (outermost) such layer initialize the clusters,
+   *  hits in the following layers are assigned to the clusters with the smallest angle as seen from the IP.
+   *  Uses fixed size arrays only - no memory is allocated apart from the new clusters.
+   */
+  template <unsigned N>
+  class ClusterSplitter{
 
+  public:
 
-    HitListVector hitsInLayer( tpcNRow )  ; 
-    addToHitListVector(  hV.begin(), hV.end(), hitsInLayer ) ;
-    
-    std::vector< CluTrack*> clu(n)  ;
-    
-    std::vector< DDSurfaces::Vector3D > lastp(n) ;
-    
-    for(unsigned i=0; i<n; ++i){
-      
-      clu[i] = new CluTrack ;
-      
-      cluVec.push_back( clu[i] ) ;
-    }    
-    
-    for( int l=tpcNRow-1 ; l >= 0 ; --l){
-      
-      HitList& hL = hitsInLayer[ l ] ;
-      
-      streamlog_out(  DEBUG ) << " create_n_clusters  --- layer " << l  <<  " size: " << hL.size() << std::endl ;
-      
-      if( hL.size() != n ){  // ignore layers with different hit numbers
-	
-	continue ;
-      }
-      
-      HitList::iterator iH = hL.begin() ;
-      
-      std::vector<Hit*> h(n) ;
-      std::vector< DDSurfaces::Vector3D>  p(n) ;
+    void operator()( Clusterer::cluster_type& hV, Clusterer::cluster_list& cluVec ) {
       
+      hV.freeElements() ;
 
-      streamlog_out(  DEBUG2 ) << " create_n_clusters  ---  layer " << l << std::endl ;
-      
-      for(unsigned i=0; i<n; ++i){
-      
-	h[i] = *iH++ ;
-	
-	p[i] = h[i]->first->pos ;
+      sortLayers( &hV, false ) ;
 
-	streamlog_out(  DEBUG2 ) << "              h"<< i << ": " << p[i] << std::endl ; 
+      for(unsigned i=0; i<N; ++i){
+	_clu[i] = new CluTrack ;
+	cluVec.push_back( _clu[i] ) ;
       }
       
-      streamlog_out(  DEBUG2 ) << " ---------------------------- " << std::endl ;
+      Hit* h[N] ;
+      bool first = true ;
 
+      // iterate over runs of hits in the same layer 
+      CluTrack::iterator it = hV.begin(), end = hV.end() ;
       
-      if( clu[0]->empty() ){ // first hit tuple
+      while( it != end ){
 	
-  	streamlog_out(  DEBUG ) << " create_n_clusters  --- initialize clusters " << std::endl ;
+	int l = (*it)->first->layer ;
 	
-	for(unsigned i=0; i<n; ++i){
-	  
-	  clu[i]->addElement( h[i] ) ;
-	  
-	  lastp[i] = ( 1. / p[i].r() ) * p[i] ;
+	unsigned nh = 0 ;
+	for(  ; it != end && (*it)->first->layer == l ; ++it, ++nh ){
+	  if( nh < N ) 
+	    h[ nh ] = *it ;
 	}
 	
-  	continue ;   //----------  that's all for the first layer w/ hits
-      }
-      
-      
-      // unit vector in direction of current hits
-      std::vector< DDSurfaces::Vector3D > pu(n) ;
-
-      for(unsigned i=0; i<n; ++i){
-
-	pu[i] = ( 1. / p[i].r() ) * p[i] ;  
-      }
-      
-      std::list< CDot > cDot ; 
-      
-      // create list of dot products between last hit in cluster and current hit 
-      // cos( angle between  hits as seen from IP ) 
-      for( unsigned i = 0 ; i < n ; ++i ){	         
-  	for( unsigned j = 0 ; j < n ; ++j ){
-	  
-  	  cDot.push_back( CDot( i , j , lastp[i].dot( pu[ j ] ) )) ;
-	}   
-      }   
-      
-      // sort dot products in descending order 
-      cDot.sort( sort_CDot ) ;
-      
-      // assign hits to clusters with largest dot product ( smallest angle )
-      
-      std::set<int> cluIdx ;
-      std::set<int> hitIdx ;
-      
-      for( std::list<CDot>::iterator it = cDot.begin() ; it != cDot.end() ; ++ it ) {
+	clupa_out(  DEBUG ) << " ClusterSplitter<" << N << ">  --- layer " << l  <<  " size: " << nh << std::endl ;
 	
-  	streamlog_out(  DEBUG2 ) << " I : " << it->I  
-				 << " J : " << it->J 
-				 << " d : " << it->Dot 
-				 << std::endl ;
-	unsigned i =  it->I ;
-  	unsigned j =  it->J ;
+	if( nh != N )  // ignore layers with different hit numbers
+	  continue ;
 	
-  	// ignore clusters or hits that hvae already been assigned
-  	if( cluIdx.find( i ) == cluIdx.end()  && hitIdx.find( j ) == hitIdx.end() ){
-	  
-  	  cluIdx.insert( i ) ;
-  	  hitIdx.insert( j ) ;
-	  
-  	  clu[ i ]->addElement( h[ j ] ) ;
-	  
-  	  // cluDir[i] = - ( p[j] - lastp[i] ) ;
-  	  // cluDir[i] =  (  1. / cluDir[i].r() ) * cluDir[i]  ;
+	if( first ){ // first hit tuple
 	  
-  	  lastp[i] =  p[j] ;
+	  clupa_out(  DEBUG ) << " ClusterSplitter<" << N << ">  --- initialize clusters " << std::endl ;
+
+	  init( h ) ;
+	  first = false ;
+
+	} else {
 	  
-  	  streamlog_out(  DEBUG2 ) << " **** adding to cluster : " << it->I  
-				   << " hit  : " << it->J 
-				   << " d : " << it->Dot 
-				   << std::endl ;
-  	}
-	
+	  assign( h ) ;
+	}
       }
+      
+      clupa_out(  DEBUG1 ) << " ClusterSplitter<" << N << ">  --- clu[0] " << _clu[0]->size() 
+			       <<  " clu[1] " << _clu[1]->size() << std::endl ;
     }
+    
+  protected:
 
+    void init( Hit* h[N] ) {
 
-    streamlog_out(  DEBUG ) << " create_three_clusters  --- clu[0] " << clu[0]->size() 
-  			    <<  " clu[1] " << clu[1]->size() 
-  			    <<  " clu[2] " << clu[2]->size() 
-  			    << std::endl ;
-
-
-
+      for(unsigned i=0; i<N; ++i){
 
-    return ;
-  }
+	_clu[i]->addElement( h[i] ) ;
 
+	const DDSurfaces::Vector3D& p = h[i]->first->pos ;
+	_lastp[i] = ( 1. / p.r() ) * p ;
+      }
+    }
 
-//======================================================================================================================
+    /** Greedy assignment: repeatedly take the (cluster,hit) pair with the largest dot product 
+     *  of the last cluster position and the hit direction (i.e. the smallest angle as seen from the IP),
+     *  among the clusters and hits not assigned yet - ties are resolved in the order of (cluster,hit). 
+     */
+    void assign( Hit* h[N] ) {
 
-  void create_three_clusters( Clusterer::cluster_type& hV, Clusterer::cluster_list& cluVec ) {
-    
-    hV.freeElements() ;
-    
-    DD4hep::Geometry::LCDD& lcdd = DD4hep::Geometry::LCDD::getInstance();
-    DD4hep::Geometry::DetElement tpcDE = lcdd.detector("TPC") ;
-    DD4hep::DDRec::FixedPadSizeTPCData* tpc = tpcDE.extension<DD4hep::DDRec::FixedPadSizeTPCData>() ;
-    const int tpcNRow  = tpc->maxRow ;
-    
-    HitListVector hitsInLayer( tpcNRow )  ; 
-    addToHitListVector(  hV.begin(), hV.end(), hitsInLayer ) ;
-    
-    CluTrack* clu[3] ;
+      double dot[N][N] ;
 
-    DDSurfaces::Vector3D lastp[3] ;
-    //    DDSurfaces::Vector3D cluDir[3] ;
+      for(unsigned j=0; j<N; ++j){
 
-    clu[0] = new CluTrack ;
-    clu[1] = new CluTrack ;
-    clu[2] = new CluTrack ;
-    
-    cluVec.push_back( clu[0] ) ;
-    cluVec.push_back( clu[1] ) ;
-    cluVec.push_back( clu[2] ) ;
+	const DDSurfaces::Vector3D& p = h[j]->first->pos ;
+	const DDSurfaces::Vector3D pu = ( 1. / p.r() ) * p ;
 
-       
-    for( int l=tpcNRow-1 ; l >= 0 ; --l){
-      
-      HitList& hL = hitsInLayer[ l ] ;
-      
-      streamlog_out(  DEBUG ) << " create_three_clusters  --- layer " << l  <<  " size: " << hL.size() << std::endl ;
-      
-      if( hL.size() != 3 ){
-	
-	continue ;
-      }
-      
-      HitList::iterator iH = hL.begin() ;
-      
-      Hit* h[3] ;
-      h[0] = *iH++ ;
-      h[1] = *iH++   ;
-      h[2] = *iH   ;
-      
-      DDSurfaces::Vector3D p[3] ;
-      p[0] = h[0]->first->pos ;
-      p[1] = h[1]->first->pos ;
-      p[2] = h[2]->first->pos ;
-      
-      
-      streamlog_out(  DEBUG ) << " create_three_clusters  ---  layer " << l 
-  			      << "  h0 : " << p[0] 
-  			      << "  h1 : " << p[1] 
-  			      << "  h2 : " << p[2] ;
-      //			       << std::endl ;
-      
-      if( clu[0]->empty() ){ // first hit triplet
-	
-  	streamlog_out(  DEBUG ) << " create_three_clusters  --- initialize clusters " << std::endl ;
-	
-  	clu[0]->addElement( h[0] ) ;
-  	clu[1]->addElement( h[1] ) ;
-  	clu[2]->addElement( h[2] ) ;
-	
-  	// lastp[0] =  p[0] ;
-  	// lastp[1] =  p[1] ;
-  	// lastp[2] =  p[2] ;
-	
-  	lastp[0] = ( 1. / p[0].r() ) * p[0] ;
-  	lastp[1] = ( 1. / p[1].r() ) * p[1] ;
-  	lastp[2] = ( 1. / p[2].r() ) * p[2] ;
-	
-  	continue ;  
+	for(unsigned i=0; i<N; ++i)
+	  dot[i][j] = _lastp[i].dot( pu ) ;
       }
-      
-
-      // unit vector in direction of current hits
-      DDSurfaces::Vector3D pu[3] ;
-      pu[0] = ( 1. / p[0].r() ) * p[0] ;
-      pu[1] = ( 1. / p[1].r() ) * p[1] ;
-      pu[2] = ( 1. / p[2].r() ) * p[2] ;
-      
-
-      std::list< CDot > cDot ; 
-
-      // create list of dot products between last hit in cluster and current hit 
-      // cos( angle between  hits as seen from IP ) 
-      for( int i = 0 ; i < 3 ; ++i ){	         
-  	for( int j = 0 ; j < 3 ; ++j ){
-	  
-  	  // // unit vector in direction of last hit and 
-  	  // DDSurfaces::Vector3D pu = - ( p[0] - lastp[0] ) ;
-  	  // pu[1] = - ( p[1] - lastp[1] ) ;
-  	  // pu[2] = - ( p[2] - lastp[2] ) ;
-  	  // pu[0] =  (  1. / pu[0].r() ) * pu[0]  ;
-  	  // pu[1] =  (  1. / pu[1].r() ) * pu[1]  ;
-  	  // pu[2] =  (  1. / pu[2].r() ) * pu[2]  ;
-  	  // cDot.push_back( CDot( i , j , cluDir[i].dot( pu[ j ] ) )) ;
-	  
-  	  cDot.push_back( CDot( i , j , lastp[i].dot( pu[ j ] ) )) ;
-	  
-  	}   
-      }   
-      
-      // sort dot products in descending order 
-      cDot.sort( sort_CDot ) ;
-
-      // assign hits to clusters with largest dot product ( smallest angle )
 
-      std::set<int> cluIdx ;
-      std::set<int> hitIdx ;
+      unsigned cluFree = ( 1u << N ) - 1 ;
+      unsigned hitFree = ( 1u << N ) - 1 ;
 
-      for( std::list<CDot>::iterator it = cDot.begin() ; it != cDot.end() ; ++ it ) {
+      for(unsigned k=0; k<N; ++k){
 	
-  	streamlog_out(  DEBUG ) << " I : " << it->I  
-  				<< " J : " << it->J 
-  				<< " d : " << it->Dot 
-  				<< std::endl ;
-	
-  	int i =  it->I ;
-  	int j =  it->J ;
-
-  	// ignore clusters or hits that hvae already been assigned
-  	if( cluIdx.find( i ) == cluIdx.end()  && hitIdx.find( j ) == hitIdx.end() ){
-
-  	  cluIdx.insert( i ) ;
-  	  hitIdx.insert( j ) ;
-
-  	  clu[ i ]->addElement( h[ j ] ) ;
+	unsigned iBest = N, jBest = N ;
+	double dBest = 0. ;
 
-  	  // cluDir[i] = - ( p[j] - lastp[i] ) ;
-  	  // cluDir[i] =  (  1. / cluDir[i].r() ) * cluDir[i]  ;
+	for(unsigned i=0; i<N; ++i){
+	  if( !( cluFree & ( 1u << i ) ) ) continue ;
+	  for(unsigned j=0; j<N; ++j){
+	    if( !( hitFree & ( 1u << j ) ) ) continue ;
+	    if( iBest == N || dot[i][j] > dBest ){
+	      iBest = i ; jBest = j ; dBest = dot[i][j] ;
+	    }
+	  }
+	}
 
-  	  lastp[i] =  p[j] ;
+	cluFree &= ~( 1u << iBest ) ;
+	hitFree &= ~( 1u << jBest ) ;
 
-  	  streamlog_out(  DEBUG ) << " **** adding to cluster : " << it->I  
-  				  << " hit  : " << it->J 
-  				  << " d : " << it->Dot 
-  				  << std::endl ;
-  	}
+	_clu[ iBest ]->addElement( h[ jBest ] ) ;
 	
-      }
+	_lastp[ iBest ] = h[ jBest ]->first->pos ;
 
-      // lastp[0] =  pu[0] ;
-      // lastp[1] =  pu[1] ;
-      // lastp[2] =  pu[2] ;
-      // lastp[0] =  p[0] ;
-      // lastp[1] =  p[1] ;
-      // lastp[2] =  p[2] ;
-      
-      
+	clupa_out(  DEBUG2 ) << " **** adding to cluster : " << iBest << " hit  : " << jBest << " d : " << dBest << std::endl ;
+      }
     }
 
-
-    streamlog_out(  DEBUG ) << " create_three_clusters  --- clu[0] " << clu[0]->size() 
-  			    <<  " clu[1] " << clu[1]->size() 
-  			    <<  " clu[2] " << clu[2]->size() 
-  			    << std::endl ;
+    CluTrack* _clu[N] ;
+    DDSurfaces::Vector3D _lastp[N] ;
+  } ;
 
 
+  /** For two clusters the orientation of the difference vector of the two hits w.r.t the one 
+   *  in the first layer is used for the assignment.
+   */
+  template <>
+  void ClusterSplitter<2>::init( Hit* h[2] ) {
 
-
-    return ;
-  }
-  //-----------------------------------------------------------------
-
-  void create_two_clusters( Clusterer::cluster_type& clu, Clusterer::cluster_list& cluVec ) {
+    _clu[0]->addElement( h[0] ) ;
+    _clu[1]->addElement( h[1] ) ;
     
+    _lastp[0] = h[1]->first->pos - h[0]->first->pos ;  // the difference vector of the first hit pair
+  }
 
-    clu.freeElements() ;
-    
-    streamlog_out(  DEBUG ) << " create_two_clusters  --- called ! - size :  " << clu.size()  << std::endl ;
+  template <>
+  void ClusterSplitter<2>::assign( Hit* h[2] ) {
 
-    DD4hep::Geometry::LCDD& lcdd = DD4hep::Geometry::LCDD::getInstance();
-    DD4hep::Geometry::DetElement tpcDE = lcdd.detector("TPC") ;
-    DD4hep::DDRec::FixedPadSizeTPCData* tpc = tpcDE.extension<DD4hep::DDRec::FixedPadSizeTPCData>() ;
-    const int tpcNRow  = tpc->maxRow ;
+    const DDSurfaces::Vector3D& lastDiffVec = _lastp[0] ;
     
-    HitListVector hitsInLayer( tpcNRow )  ; 
-
-    addToHitListVector(  clu.begin(), clu.end(), hitsInLayer ) ;
+    DDSurfaces::Vector3D d = h[1]->first->pos - h[0]->first->pos ;
     
-
-    CluTrack* clu0 = new CluTrack ;
-    CluTrack* clu1 = new CluTrack ;
-
-    cluVec.push_back( clu0 ) ;
-    cluVec.push_back( clu1 ) ;
-
-
-    DDSurfaces::Vector3D lastDiffVec(0.,0.,0.) ;
+    float s0 =  ( lastDiffVec + d ).r() ;
+    float s1 =  ( lastDiffVec - d ).r() ;
     
-    for( int l=tpcNRow-1 ; l >= 0 ; --l){
-
-      HitList& hL = hitsInLayer[ l ] ;
-	
-      streamlog_out(  DEBUG ) << " create_two_clusters  --- layer " << l  <<  " size: " << hL.size() << std::endl ;
-
-      if( hL.size() != 2 ){
-	
-  	// if there is not exactly two hits in the layer, we simply copy the unassigned hits to the leftover hit vector
-  	// std::copy( hL.begin(),  hL.end() , std::back_inserter( hV ) ) ;
-  	continue ;
-      }
-
-      HitList::iterator iH = hL.begin() ;
-
-      Hit* h0 = *iH++ ;
-      Hit* h1 = *iH   ;
-      
-      DDSurfaces::Vector3D& p0 = h0->first->pos ;
-      DDSurfaces::Vector3D& p1 = h1->first->pos ;
-
-
-      streamlog_out(  DEBUG ) << " create_two_clusters  ---  layer " << l 
-  			      << "  h0 : " << p0 
-  			      << "  h1 : " << p1 ;
-      //			       << std::endl ;
+    if( s0 > s1 ){  // same orientation, i.e. h0 in this layer belongs to h0 in first layer
       
-      if( clu0->empty() ){ // first hit pair
-	
-  	streamlog_out(  DEBUG ) << " create_two_clusters  --- initialize clusters " << std::endl ;
-	
-  	clu0->addElement( h0 ) ;
-  	clu1->addElement( h1 ) ;
-	
-  	lastDiffVec = p1 - p0 ;
-	
-  	continue ;  
-      }
-
-      DDSurfaces::Vector3D d = p1 - p0 ;
+      clupa_out(  DEBUG ) << " ClusterSplitter<2>  ---   same orientation " << std::endl ;
+      _clu[0]->addElement( h[0] ) ;
+      _clu[1]->addElement( h[1] ) ;
       
-      float s0 =  ( lastDiffVec + d ).r() ;
-      float s1 =  ( lastDiffVec - d ).r() ;
+    } else{                // oposite orientation, i.e. h1 in this layer belongs to h0 in first layer
       
-      if( s0 > s1 ){  // same orientation, i.e. h0 in this layer belongs to h0 in first layer
-	
-  	streamlog_out(  DEBUG ) << " create_two_clusters  ---   same orientation " << std::endl ;
-  	clu0->addElement( h0 ) ;
-  	clu1->addElement( h1 ) ;
-	
-      } else{                // oposite orientation, i.e. h1 in this layer belongs to h0 in first layer
-
-  	streamlog_out(  DEBUG2 ) << " create_two_clusters  ---  oposite orientation " << std::endl ;
-  	clu0->addElement( h1 ) ;
-  	clu1->addElement( h0 ) ;
-      }
-
+      clupa_out(  DEBUG2 ) << " ClusterSplitter<2>  ---  oposite orientation " << std::endl ;
+      _clu[0]->addElement( h[1] ) ;
+      _clu[1]->addElement( h[0] ) ;
     }
+  }
 
-    // clu.freeHits() ;
-
-    streamlog_out(  DEBUG1 ) << " create_two_clusters  --- clu0 " << clu0->size() 
-  			     <<  " clu1 " << clu1->size() << std::endl ;
+  //------------------------------------------------------------------------------------------------------------------------- 
 
-    // return std::make_pair( clu0 , clu1 ) ;
+  void create_n_clusters( Clusterer::cluster_type& clu, Clusterer::cluster_list& cluVec , unsigned n ) {
+    
+    switch( n ){
+    case 2: { ClusterSplitter<2> split ; split( clu , cluVec ) ; break ; }
+    case 3: { ClusterSplitter<3> split ; split( clu , cluVec ) ; break ; }
+    case 4: { ClusterSplitter<4> split ; split( clu , cluVec ) ; break ; }
+    case 5: { ClusterSplitter<5> split ; split( clu , cluVec ) ; break ; }
+    case 6: { ClusterSplitter<6> split ; split( clu , cluVec ) ; break ; }
+    case 7: { ClusterSplitter<7> split ; split( clu , cluVec ) ; break ; }
+    case 8: { ClusterSplitter<8> split ; split( clu , cluVec ) ; break ; }
+    case 9: { ClusterSplitter<9> split ; split( clu , cluVec ) ; break ; }
+    default:
+      clupa_out( ERROR ) <<  " create_n_clusters called for n = " << n << " - only 2 <= n <= 9 supported " << std::endl ;
+    }
+  }
 
-    return ;
+  void create_three_clusters( Clusterer::cluster_type& clu, Clusterer::cluster_list& cluVec ) {
+    
+    ClusterSplitter<3> split ; 
+    split( clu , cluVec ) ;
   }
 
+  void create_two_clusters( Clusterer::cluster_type& clu, Clusterer::cluster_list& cluVec ) {
+    
+    ClusterSplitter<2> split ; 
+    split( clu , cluVec ) ;
+  }
  //------------------------------------------------------------------------------------------------------------------------- 
 
 
@@ -1008,14 +761,14 @@ namespace clupatra_new{
     //if( clu->empty()  ){
     if( clu->size() < 3  ){
       
-      streamlog_out( ERROR ) << " IMarlinTrkFitter::operator() : cannot fit cluster track with less than 3 hits ! " << std::endl ;
+      clupa_out( ERROR ) << " IMarlinTrkFitter::operator() : cannot fit cluster track with less than 3 hits ! " << std::endl ;
       
       return trk ;
     }
     
     clu->ext<MarTrk>() = trk ;
     
-    clu->sort( LayerSortOut() ) ;
+    sortLayers( clu, true ) ;
     
     // need to reverse the order for incomming track segments (curlers)
     // assume particle comes from IP
@@ -1033,7 +786,7 @@ namespace clupatra_new{
 	trk->addHit( (*it)->first->lcioHit  ) ; 
 	++nHit ;
 
-	streamlog_out( DEBUG1 ) <<  "   hit  added  " <<  *(*it)->first->lcioHit   << std::endl ;
+	clupa_out( DEBUG1 ) <<  "   hit  added  " <<  *(*it)->first->lcioHit   << std::endl ;
       }
       
       trk->initialise( MarlinTrk::IMarlinTrack::forward ) ;
@@ -1045,7 +798,7 @@ namespace clupatra_new{
 	trk->addHit( (*it)->first->lcioHit   ) ; 
 	++nHit ;
 	
-	streamlog_out( DEBUG1 ) <<  "   hit  added  "<<  *(*it)->first->lcioHit   << std::endl ;
+	clupa_out( DEBUG1 ) <<  "   hit  added  "<<  *(*it)->first->lcioHit   << std::endl ;
       }
       
       trk->initialise( MarlinTrk::IMarlinTrack::backward ) ;
@@ -1056,7 +809,7 @@ namespace clupatra_new{
     
     if( code != MarlinTrk::IMarlinTrack::success ){
       
-      streamlog_out( ERROR ) << "  >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> IMarlinTrkFitter :  problem fitting track "
+      clupa_out( ERROR ) << "  >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> IMarlinTrkFitter :  problem fitting track "
 			     << " error code : " << MarlinTrk::errorCode( code ) 
 			     << std::endl ; 
       
@@ -1075,7 +828,7 @@ namespace clupatra_new{
       
       maxChi2 =  2. * _maxChi2Increment  ;
       
-      streamlog_out( DEBUG4 ) << "  >>>>>>  IMarlinTrkFitter :  small number of hits used in fit " << hitsInFit.size() << "/" << nHit << " = " 
+      clupa_out( DEBUG4 ) << "  >>>>>>  IMarlinTrkFitter :  small number of hits used in fit " << hitsInFit.size() << "/" << nHit << " = " 
 			      << ( 1.*hitsInFit.size()) / (1.*nHit )  << " refit with larger max chi2 increment:  " << maxChi2 <<  std::endl ;
       delete trk ;
 
@@ -1087,11 +840,188 @@ namespace clupatra_new{
   }
   
   
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  MarlinTrk::IMarlinTrack* createTrackFromSnapshot( MarlinTrk::IMarlinTrkSystem* trkSys, const TrackFitSnapshot& snap, 
+						    bool atFirstHit, double bfield, bool fitDirection ) {
+
+    lcio::TrackerHit* hit = ( atFirstHit ? snap.firstHit : snap.lastHit ) ;
+
+    if( hit == 0 ) 
+      return 0 ;
+
+    MarlinTrk::IMarlinTrack* trk = trkSys->createTrack() ;
+
+    // the hit the track state refers to is used as dummy hit
+    if( trk->addHit( hit ) != MarlinTrk::IMarlinTrack::success ){
+      
+      delete trk ;
+      return 0 ;
+    }
+    
+    trk->initialise( ( atFirstHit ? snap.atFirstHit : snap.atLastHit ) , bfield , fitDirection ) ;
+
+    return trk ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  MarlinTrk::IMarlinTrack* createTrackFromState( MarlinTrk::IMarlinTrkSystem* trkSys, const lcio::Track* trk, 
+						 int location, double bfield ) {
+
+    const lcio::TrackState* ts = trk->getTrackState( location ) ;
+
+    if( ts == 0 || trk->getTrackerHits().empty() ) 
+      return 0 ;
+
+    clupa_out( DEBUG3  )  << "               -- extrapolate TrackState : " << lcshort( ts )    << std::endl ;
+
+    MarlinTrk::IMarlinTrack* mTrk = trkSys->createTrack() ;
+
+    //need to add a dummy hit to the track
+    if( mTrk->addHit(  trk->getTrackerHits()[0] ) != MarlinTrk::IMarlinTrack::success ){  // is this the right hit ??????????
+
+      delete mTrk ;
+      return 0 ;
+    }
+
+    mTrk->initialise( *ts ,  bfield ,  MarlinTrk::IMarlinTrack::backward ) ;
+
+    return mTrk ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  /** Residuals of the hit w.r.t. the helix given by the LCIO track parameters par (d0,phi,omega,z0,tanL) at the 
+   *  reference point ref: dxy is the distance to the circle, dz is the distance in z on the given turn - 
+   *  if chooseTurn is true, the turn closest in z to the hit is selected first.
+   */
+  static bool helixResiduals( const double* par, const double* ref, const double* h, bool chooseTurn, int& turn, 
+			      double& dxy, double& dz, double* n=0 ){
+    
+    const double d0 = par[0], phi = par[1], om = par[2], z0 = par[3], tanL = par[4] ;
+
+    if( om == 0. ) 
+      return false ;
+
+    const double R  = 1. / om ;
+    const double xc = ref[0] + ( R - d0 ) * sin( phi ) ;
+    const double yc = ref[1] + ( d0 - R ) * cos( phi ) ;
+
+    const double ux = h[0] - xc ;
+    const double uy = h[1] - yc ;
+    const double rho = sqrt( ux*ux + uy*uy ) ;
+
+    if( rho == 0. ) 
+      return false ;
+
+    dxy = rho - std::abs( R ) ;
+    
+    if( n ){ // direction from the center to the hit
+      n[0] = ux / rho ;
+      n[1] = uy / rho ;
+    }
+
+    // position on the helix:  x(s) = xc - R sin( phi - om*s ),  y(s) = yc + R cos( phi - om*s ),  z(s) = zr + z0 + tanL*s
+    const double psi   = atan2( -ux / R , uy / R ) ;
+    const double s0    = ( phi - psi ) / om ;
+    const double sTurn = 2. * M_PI / om ;
+    
+    if( chooseTurn ) 
+      turn = ( tanL != 0. ? (int) std::floor( ( h[2] - ( ref[2] + z0 + tanL * s0 ) ) / ( tanL * sTurn ) + 0.5 ) : 0 ) ;
+
+    dz = h[2] - ( ref[2] + z0 + tanL * ( s0 + turn * sTurn ) ) ;
+
+    return true ;
+  }
+
+  double helixHitChi2( const lcio::TrackState& ts, const lcio::TrackerHit* hit, double bField, double radLength ){
+
+    double par[5] = { ts.getD0(), ts.getPhi(), ts.getOmega(), ts.getZ0(), ts.getTanLambda() } ;
+    const double ref[3] = { ts.getReferencePoint()[0], ts.getReferencePoint()[1], ts.getReferencePoint()[2] } ;
+    const double* h = hit->getPosition() ;
+
+    int turn = 0 ;
+    double r[2], n[2] ;
+    if( ! helixResiduals( par, ref, h, true, turn, r[0], r[1], n ) ) 
+      return -1. ;
+
+    // numerical jacobian of the residuals w.r.t. the track parameters ( for the selected turn )
+    const double zTurn = par[4] * 2. * M_PI / par[2] ;
+    const double step[5] = { 1.e-3, 1.e-6, 1.e-6 * std::abs( par[2] ) + 1.e-12, 1.e-3, 1.e-6 } ;
+    double J[2][5] ;
+
+    for( unsigned k=0 ; k<5 ; ++k ){
+
+      double rp[2], rm[2] ;
+      double p = par[k] ;
+
+      par[k] = p + step[k] ;
+      bool ok = helixResiduals( par, ref, h, false, turn, rp[0], rp[1] ) ;
+      par[k] = p - step[k] ;
+      ok = ok && helixResiduals( par, ref, h, false, turn, rm[0], rm[1] ) ;
+      par[k] = p ;
+
+      if( !ok ) 
+	return -1. ;
+
+      double ddz = rp[1] - rm[1] ;
+      if( std::abs( ddz ) > 0.5 * std::abs( zTurn ) ) // crossed the branch cut of the phase
+	ddz -= ( ddz > 0. ? 1. : -1. ) * std::abs( zTurn ) ;
+
+      J[0][k] = ( rp[0] - rm[0] ) / ( 2. * step[k] ) ;
+      J[1][k] = ddz / ( 2. * step[k] ) ;
+    }
+
+    // covariance of the residuals:  J C J^T  + hit covariance
+    const lcio::FloatVec& c = ts.getCovMatrix() ;  // lower triangle of d0, phi, omega, z0, tanL
+    double C[5][5] ;
+    for( unsigned i=0 ; i<5 ; ++i )
+      for( unsigned j=0 ; j<=i ; ++j )
+	C[i][j] = C[j][i] = c[ i * ( i + 1 ) / 2 + j ] ;
+
+    double V[2][2] = { { 0., 0. }, { 0., 0. } } ;
+    for( unsigned a=0 ; a<2 ; ++a )
+      for( unsigned b=0 ; b<2 ; ++b )
+	for( unsigned i=0 ; i<5 ; ++i )
+	  for( unsigned j=0 ; j<5 ; ++j )
+	    V[a][b] += J[a][i] * C[i][j] * J[b][j] ;
+
+    const lcio::FloatVec& hc = hit->getCovMatrix() ; // xx, yx, yy, zx, zy, zz
+    if( hc.size() >= 6 ){
+      V[0][0] += n[0] * n[0] * hc[0] + 2. * n[0] * n[1] * hc[1] + n[1] * n[1] * hc[2] ;
+      V[1][1] += hc[5] ;
+    }
+
+    // multiple scattering ( highland ) : displacement L*theta0/sqrt(3) after the distance L to the hit
+    if( bField > 0. && radLength > 0. && std::abs( par[2] ) > 0. ){
+
+      const double dx = h[0] - ref[0] , dy = h[1] - ref[1] , dz = h[2] - ref[2] ;
+      const double L = std::sqrt( dx*dx + dy*dy + dz*dz ) ;
+      const double p = 0.299792458e-3 * bField / std::abs( par[2] ) * std::sqrt( 1. + par[4] * par[4] ) ; // GeV
+      const double x = L / radLength ;
+
+      if( x > 0. ){
+	const double theta0 = 0.0136 / p * std::sqrt( x ) * std::max( 0., 1. + 0.038 * std::log( x ) ) ;
+	const double sigma2 = L * L * theta0 * theta0 / 3. ;
+	V[0][0] += sigma2 ;
+	V[1][1] += sigma2 * ( 1. + par[4] * par[4] ) ;
+      }
+    }
+
+    const double det = V[0][0] * V[1][1] - V[0][1] * V[1][0] ;
+
+    if( !( det > 0. ) ) 
+      return -1. ;
+
+    return ( V[1][1] * r[0] * r[0] - ( V[0][1] + V[1][0] ) * r[0] * r[1] + V[0][0] * r[1] * r[1] ) / det ;
+  }
+
   //---------------------------------------------------------------------------------------------------------------------------
 
    lcio::Track* LCIOTrackConverter::operator() (CluTrack* c) {  
     
-    static lcio::BitField64 encoder( lcio::LCTrackerCellID::encoding_string() ) ; 
+    static thread_local lcio::BitField64 encoder( lcio::LCTrackerCellID::encoding_string() ) ; 
 
     lcio::TrackImpl* trk = new lcio::TrackImpl ;
 
@@ -1141,12 +1071,12 @@ namespace clupatra_new{
 	lcio::TrackStateImpl* tsIP =  new lcio::TrackStateImpl ;
 	lcio::TrackStateImpl* tsFH =  new lcio::TrackStateImpl ;
 	lcio::TrackStateImpl* tsLH =  new lcio::TrackStateImpl ;
-	lcio::TrackStateImpl* tsCA =  new lcio::TrackStateImpl ;
+	lcio::TrackStateImpl* tsCA =  ( Light ? 0 : new lcio::TrackStateImpl ) ;
 	
 	tsIP->setLocation(  lcio::TrackState::AtIP ) ;
 	tsFH->setLocation(  lcio::TrackState::AtFirstHit ) ;
 	tsLH->setLocation(  lcio::TrackState::AtLastHit) ;
-	tsCA->setLocation(  lcio::TrackState::AtCalorimeter ) ;
+	if( tsCA ) tsCA->setLocation(  lcio::TrackState::AtCalorimeter ) ;
 	
 	double chi2 ;
 	int ndf  ;
@@ -1168,7 +1098,7 @@ namespace clupatra_new{
 	
 	if( code != MarlinTrk::IMarlinTrack::success ){
 	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at first Hit !!?? " 
+	  clupa_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at first Hit !!?? " 
 				 << " error code : " << MarlinTrk::errorCode( code ) 
 				 << std::endl ; 
 	}
@@ -1177,34 +1107,33 @@ namespace clupatra_new{
 
 #define use_fit_at_last_hit 0
 
+	EVENT::TrackerHit* last_constrained_hit = 0 ;     
+
+	if( Light ){  // the filtered state at the last hit - no smoothing 
+
+	  code = mtrk->getTrackState( lHit, *tsLH, chi2, ndf ) ;
+
+	} else {
+
 #if use_fit_at_last_hit
 	  code = mtrk->getTrackState( lHit, *tsLH, chi2, ndf ) ;
 #else     // get the track state at the last hit by propagating from the last(first) constrained fit position (a la MarlinTrkUtils)
-	  EVENT::TrackerHit* last_constrained_hit = 0 ;     
 	  mtrk->getTrackerHitAtPositiveNDF( last_constrained_hit );
 	  code = mtrk->smooth() ;
 	  DDSurfaces::Vector3D last_hit_pos( lHit->getPosition() );
 	  code = mtrk->propagate( last_hit_pos, last_constrained_hit, *tsLH, chi2, ndf);
 
 #endif
+	}
 	
 	if( code != MarlinTrk::IMarlinTrack::success ){
 	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at last Hit !!?? " << std::endl ; 
+	  clupa_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at last Hit !!?? " << std::endl ; 
 	}
 	
 	// ======= get TrackState at calo face  ========================
 
-	// FG: this is a temporary workaround for the old Mokka based simulation and KalTest - we force the 
-	// CaloFaceEndcapID to be the canincal lcio::ILDDetID::ECAL
-	 MarlinTrk::IMarlinTrkSystem* trksystem =  MarlinTrk::Factory::getCurrentMarlinTrkSystem() ;
-	 
-	 MarlinKalTest* trksys = dynamic_cast< MarlinKalTest* >( trksystem ) ;
-	 
-	 if( trksys != 0 ) { // we are in KalTest world
-	   CaloFaceEndcapID = lcio::ILDDetID::ECAL ;
-	 }
-	 //=========================================================================================================
+	if( ! Light ) {  // propagation to the calorimeter is slow
 
 	encoder.reset() ;
 	encoder[ lcio::LCTrackerCellID::subdet() ] = CaloFaceBarrelID ;
@@ -1235,17 +1164,19 @@ namespace clupatra_new{
 	}
 	if ( code !=MarlinTrk::IMarlinTrack::success ) {
 	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at calo face !!?? " << std::endl ;
+	  clupa_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at calo face !!?? " << std::endl ;
 	}
 	
 	//fg: for curling tracks the propagated track has the wrong z0 whereas it should be 0. really 
 	if( std::abs( tsCA->getZ0() ) > std::abs( 2.*M_PI/tsCA->getOmega() * tsCA->getTanLambda() ) ){
 	  
-	  streamlog_out( DEBUG2 ) << "  >>>>>>>>>>> createTrackStateAtCaloFace : setting z0 to 0. for track state at calorimeter : " 
+	  clupa_out( DEBUG2 ) << "  >>>>>>>>>>> createTrackStateAtCaloFace : setting z0 to 0. for track state at calorimeter : " 
 				  << toString(tsCA) << std::endl ;
 	  
 	  tsCA->setZ0( 0. ) ;
-	} 
+	}
+
+	} // ! Light
 
 	// ======= get TrackState at IP ========================
 	
@@ -1257,13 +1188,13 @@ namespace clupatra_new{
 	
 	if( code != MarlinTrk::IMarlinTrack::success ){
 	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not extrapolate TrackState to IP !!?? " << std::endl ; 
+	  clupa_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not extrapolate TrackState to IP !!?? " << std::endl ; 
 	}
 	
 	trk->addTrackState( tsIP ) ;
 	trk->addTrackState( tsFH ) ;
 	trk->addTrackState( tsLH ) ;
-	trk->addTrackState( tsCA ) ;
+	if( tsCA ) trk->addTrackState( tsCA ) ;
 	
 	double RMin = sqrt( tsFH->getReferencePoint()[0] * tsFH->getReferencePoint()[0]
 			    + tsFH->getReferencePoint()[1] * tsFH->getReferencePoint()[1] ) ;
@@ -1273,15 +1204,27 @@ namespace clupatra_new{
 	trk->setChi2( chi2 ) ;
 	trk->setNdf( ndf ) ;
 
+	// keep a compact snapshot of the fit, so that later stages can restart the filter w/o the MarlinTrk
+	TrackFitSnapshot* snap = new TrackFitSnapshot ;
+	snap->atFirstHit = *tsFH ;
+	snap->atLastHit  = *tsLH ;
+	snap->firstHit   = fHit ;
+	snap->lastHit    = lHit ;
+	snap->hitsInFit  = hitsInFit ;
+	snap->chi2       = chi2 ;
+	snap->ndf        = ndf ;
+
+	trk->ext<FitSnapshot>() = snap ;
+
       } else {
 
-	streamlog_out( WARNING ) << "  >>>>>>>>>>> LCIOTrackConverter::operator()  -  hitsInFitEmpty ! - nHits " << nHit << std::endl ;
+	clupa_out( WARNING ) << "  >>>>>>>>>>> LCIOTrackConverter::operator()  -  hitsInFitEmpty ! - nHits " << nHit << std::endl ;
       }
       
     } else {
       
       // this is not an error  for debug collections that just consist of track hits (no fit ) 
-      // streamlog_out( ERROR ) << "  >>>>>>>>>>> LCIOTrackConverter::operator() (CluTrack* c)  :  "
+      // clupa_out( ERROR ) << "  >>>>>>>>>>> LCIOTrackConverter::operator() (CluTrack* c)  :  "
       // 			     << " no MarlinTrk::IMarlinTrack* found for cluster !!?? " << std::endl ; 
     }
     
@@ -1290,4 +1233,1265 @@ namespace clupatra_new{
   }
 
 
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  unsigned ingestTPCHits( const clupatra::TPCHitView& view, ClupaWorkspace& ws, unsigned nLayers, double driftLength, 
+			  int nZBins, unsigned nThreads, const clupatra::RegionOfInterest* roi ){
+
+    static const CellIDField layerID( UTIL::LCTrackerCellID::encoding_string(), UTIL::LCTrackerCellID::layer() ) ;
+
+    const unsigned nHit = view.n ;
+    const unsigned nZ = ( nZBins > 0 ? nZBins : 1 ) ;
+    const unsigned nBucket = nLayers * nZ ;
+
+    ZIndex zIndex( -driftLength , driftLength , nZ ) ;
+
+    std::vector<ClupaHit>& clupaHits = ws.clupaHits ;
+    std::vector<int>& hitKey = ws.hitKey ;
+
+    ws.prepare( clupaHits, nHit ) ;
+    clupaHits.resize( nHit ) ;       // creates clupa hits (w/ default c'tor)
+    ws.prepare( hitKey, nHit ) ;
+    hitKey.resize( nHit ) ;
+
+    // w/o handles the LCIO hits for the Kalman filter are created from the arrays - the hits are kept in the workspace
+    if( view.handle == 0 && nHit > 0 ){
+
+      if( view.pos == 0 || view.cellID0 == 0 || view.cov == 0 )
+	throw lcio::Exception( " ingestTPCHits: a hit view w/o handles needs the positions, cellIDs and covariances " ) ;
+
+      if( ws.viewHits.size() >= nHit ) ++ws.nReused ; else ++ws.nGrown ;
+
+      while( ws.viewHits.size() < nHit )
+	ws.viewHits.emplace_back() ;
+
+      for( unsigned i=0 ; i<nHit ; ++i )   // might still point to the clustering hit of the previous event
+	ws.viewHits[i].ext<GHit>() = 0 ;
+    }
+
+    // ---- decode the hits in parallel chunks - every chunk only writes to its own elements of the arrays
+    parallel_for_chunks( nHit, nThreads, [&]( unsigned first, unsigned last ){
+	
+	for( unsigned i=first ; i<last ; ++i ){
+	  
+	  TrackerHit* th = ( view.handle ? view.handle[i] : 0 ) ;
+
+	  if( th == 0 ){
+
+	    IMPL::TrackerHitImpl& vh = ws.viewHits[i] ;
+
+	    vh.setCellID0( view.cellID0[ i * view.cellIDStride ] ) ;
+	    vh.setCellID1( view.cellID1 ? view.cellID1[ i * view.cellIDStride ] : 0 ) ;
+	    vh.setPosition( view.pos + i * view.posStride ) ;
+	    vh.setCovMatrix( view.cov + i * view.covStride ) ;
+	    vh.setEDep( view.eDep ? view.eDep[ i * view.eDepStride ] : 0. ) ;
+
+	    th = &vh ;
+	  }
+
+	  ClupaHit& ch = clupaHits[i] ;
+	  
+	  ch.lcioHit = th ; 
+	  ch.pos     = DDSurfaces::Vector3D( view.pos ? view.pos + i * view.posStride : th->getPosition() ) ;
+	  ch.layer   = ( view.cellID0 ? layerID( view.cellID0[ i * view.cellIDStride ], 
+						 view.cellID1 ? view.cellID1[ i * view.cellIDStride ] : 0 )  
+			 : layerID( th ) ) ;
+	  ch.zIndex  = zIndex.index( ch.pos.z() ) ;
+	  
+	  bool useHit = std::fabs( ch.pos.z() ) <= driftLength  &&  ch.layer >= 0  &&  unsigned( ch.layer ) < nLayers ;
+
+	  if( useHit && roi != 0 ){
+	    const double pos[3] = { ch.pos.x(), ch.pos.y(), ch.pos.z() } ;
+	    useHit = roi->contains( pos ) ;
+	  }
+	  
+	  int zBin = std::min( std::max( ch.zIndex, 0 ), int( nZ ) - 1 ) ;
+	  
+	  hitKey[i] = ( useHit ? ch.layer * nZ + zBin : -1 ) ;
+	}
+      } ) ;
+    
+    // ---- counting sort into (layer,zIndex) buckets 
+    std::vector<unsigned>& start = ws.bucketStart ;
+    ws.prepare( start, nBucket + 1 ) ;
+    start.resize( nBucket + 1 ) ;
+    
+    for( unsigned i=0 ; i<nHit ; ++i ) 
+      if( hitKey[i] > -1 ) 
+	++start[ hitKey[i] + 1 ] ;
+
+    for( unsigned b=0 ; b<nBucket ; ++b ) 
+      start[ b+1 ] += start[ b ] ;
+
+    const unsigned nUsed = start[ nBucket ] ;
+
+    std::vector<unsigned>& order = ws.hitOrder ;
+    ws.prepare( order, nUsed ) ;
+    order.resize( nUsed ) ;
+
+    for( unsigned i=0 ; i<nHit ; ++i ) 
+      if( hitKey[i] > -1 ) 
+	order[ start[ hitKey[i] ]++ ] = i ;
+
+    // now start[b] points to the end of bucket b, i.e. the start of bucket b+1 - shift by one
+    for( unsigned b=nBucket ; b>0 ; --b ) 
+      start[b] = start[b-1] ;
+    start[0] = 0 ;
+
+    // ---- sort in z within the buckets (typically few hits) 
+    for( unsigned b=0 ; b<nBucket ; ++b ){
+      for( unsigned k=start[b]+1 ; k<start[b+1] ; ++k ){
+	
+	unsigned idx = order[k] ;
+	double z = clupaHits[idx].pos.z() ;
+	
+	unsigned m = k ;
+	for(  ; m > start[b] && clupaHits[ order[m-1] ].pos.z() > z ; --m ) 
+	  order[m] = order[m-1] ;
+	
+	order[m] = idx ;
+      }
+    }
+
+    // ---- create the clustering hits in (layer,z) order 
+    ws.prepare( ws.hitStore, nUsed ) ; // no reallocation below -> pointers to hits stay valid 
+    ws.prepare( ws.nncluHits, nUsed ) ;
+
+    for( unsigned k=0 ; k<nUsed ; ++k ){
+
+      ClupaHit* ch = & clupaHits[ order[k] ] ;
+
+      ws.hitStore.push_back( Hit( ch ) ) ;
+      Hit* gh = & ws.hitStore.back() ;
+
+      ws.nncluHits.push_back( gh ) ;
+
+      ch->lcioHit->ext<GHit>() = gh ;  // assign the clupa hit to the LCIO hit for memory mgmt
+    }
+
+    // ---- the hits of one layer are contiguous 
+    ws.prepareLayers( ws.hitsInLayer, nLayers ) ;
+
+    for( unsigned l=0 ; l<nLayers ; ++l )
+      ws.hitsInLayer[l].assign( ws.nncluHits.begin() + start[ l * nZ ], ws.nncluHits.begin() + start[ (l+1) * nZ ] ) ;
+    
+    clupa_out( DEBUG2 ) << "  ingestTPCHits: created " << nUsed << " clupatra hits from " << nHit 
+			    << " TPC hits in " << nLayers << " layers " << std::endl ;
+
+    return nUsed ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  void rebinTPCHits( ClupaWorkspace& ws, unsigned nLayers, double driftLength, int nZBins ){
+
+    const unsigned nZ = ( nZBins > 0 ? nZBins : 1 ) ;
+    const unsigned nBucket = nLayers * nZ ;
+    const unsigned nUsed = ws.nncluHits.size() ;
+
+    ZIndex zIndex( -driftLength , driftLength , nZ ) ;
+
+    std::vector<unsigned>& start = ws.bucketStart ;
+    ws.prepare( start, nBucket + 1 ) ;
+    start.resize( nBucket + 1 ) ;
+
+    // the k-th clustering hit belongs to the input hit hitOrder[k]
+    for( unsigned k=0 ; k<nUsed ; ++k ){
+
+      ClupaHit* ch = ws.nncluHits[k]->first ;
+
+      ch->zIndex = zIndex.index( ch->pos.z() ) ;
+
+      int zBin = std::min( std::max( ch->zIndex, 0 ), int( nZ ) - 1 ) ;
+
+      ws.hitKey[ ws.hitOrder[k] ] = ch->layer * nZ + zBin ;
+
+      ++start[ ch->layer * nZ + zBin + 1 ] ;
+    }
+
+    for( unsigned b=0 ; b<nBucket ; ++b ) 
+      start[ b+1 ] += start[ b ] ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  unsigned findSegmentMergeCandidates( const std::vector< nnclu::Element<lcio::Track>* >& segs, 
+				       std::vector< std::pair<unsigned,unsigned> >& pairs, 
+				       float maxDeltaPhi, float minTanL ){
+
+    static const CellIDField layerID( UTIL::LCTrackerCellID::encoding_string(), UTIL::LCTrackerCellID::layer() ) ;
+
+    const int overlap = TrackSegmentMerger::overlapRows ;
+
+    const unsigned n = segs.size() ;
+
+    pairs.clear() ;
+
+    // --- end points of the segments 
+    std::vector<int> lf( n ), ll( n ) ;
+    std::vector<double> phif( n ), phil( n ), tanL( n ) ;
+
+    for( unsigned i=0 ; i<n ; ++i ){
+
+      const lcio::Track* trk = segs[i]->first ;
+      const lcio::TrackerHitVec& hv = trk->getTrackerHits() ;
+      
+      const lcio::TrackerHit* thf = hv.front() ;
+      const lcio::TrackerHit* thl = hv.back() ;
+
+      lf[i] = layerID( thf ) ;
+      ll[i] = layerID( thl ) ;
+
+      phif[i] = std::atan2( thf->getPosition()[1], thf->getPosition()[0] ) ;
+      phil[i] = std::atan2( thl->getPosition()[1], thl->getPosition()[0] ) ;
+
+      tanL[i] = trk->getTanLambda() ;
+    }
+
+    // --- index the segments in the pad row of the last hit and the first hit
+    typedef std::pair<int,unsigned> RowIndex ;
+    std::vector<RowIndex> byLast( n ), byFirst( n ) ;
+    for( unsigned i=0 ; i<n ; ++i ){
+      byLast[i]  = RowIndex( ll[i], i ) ;
+      byFirst[i] = RowIndex( lf[i], i ) ;
+    }
+    std::sort( byLast.begin(),  byLast.end() ) ;
+    std::sort( byFirst.begin(), byFirst.end() ) ;
+
+    // the cuts in phi and tan lambda are physics cuts ( not exact w.r.t. the TrackSegmentMerger ) - only if switched on
+    auto passCuts = [&]( unsigned i, unsigned j ){
+
+      if( maxDeltaPhi <= 0. ) 
+	return true ;
+
+      if( tanL[i] * tanL[j] < 0.  &&  std::abs( tanL[i] ) > minTanL  &&  std::abs( tanL[j] ) > minTanL ) 
+	return false ;
+
+      const double phiI[2] = { phif[i], phil[i] } ;
+      const double phiJ[2] = { phif[j], phil[j] } ;
+	  
+      double dPhiMin = M_PI ;
+      for( unsigned a=0 ; a<2 ; ++a ){
+	for( unsigned b=0 ; b<2 ; ++b ){
+	  double dPhi = std::abs( phiI[a] - phiJ[b] ) ;
+	  if( dPhi > M_PI ) dPhi = 2.*M_PI - dPhi ;
+	  if( dPhi < dPhiMin ) dPhiMin = dPhi ;
+	}
+      }
+      return dPhiMin <= maxDeltaPhi ;
+    } ;
+
+    for( unsigned i=0 ; i<n ; ++i ){
+
+      // TrackSegmentMerger rejects pairs with  lf[i] + overlap <= ll[j]  &&  lf[j] + overlap <= ll[i] :
+      // the candidates end before row lf[i] + overlap or start after row ll[i] - overlap
+      std::vector<RowIndex>::const_iterator lEnd   = std::lower_bound( byLast.begin(), byLast.end(), RowIndex( lf[i] + overlap, 0 ) ) ;
+      std::vector<RowIndex>::const_iterator fBegin = std::upper_bound( byFirst.begin(), byFirst.end(), RowIndex( ll[i] - overlap, n ) ) ;
+
+      for( std::vector<RowIndex>::const_iterator it = byLast.begin() ; it != lEnd ; ++it ){
+	unsigned j = it->second ;
+	if( j > i && passCuts( i, j ) ) 
+	  pairs.push_back( std::make_pair( i, j ) ) ;
+      }
+
+      // segments in both ranges are taken from the first one
+      for( std::vector<RowIndex>::const_iterator it = fBegin ; it != byFirst.end() ; ++it ){
+	unsigned j = it->second ;
+	if( j > i && ll[j] >= lf[i] + overlap && passCuts( i, j ) ) 
+	  pairs.push_back( std::make_pair( i, j ) ) ;
+      }
+    }
+
+    std::sort( pairs.begin(), pairs.end() ) ;
+
+    unsigned nPairs = ( n > 1 ? n * ( n - 1 ) / 2 : 0 ) ;
+
+    return nPairs - pairs.size() ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  void findCircleMergeCandidates( const std::vector< nnclu::Element<lcio::Track>* >& segs, 
+				  std::vector< std::pair<unsigned,unsigned> >& pairs, float dCut ){
+
+    pairs.clear() ;
+
+    const unsigned n = segs.size() ;
+
+    // --- circle centers and search radius dCut * |r| ( TrackCircleDistance uses the radius of the first track ) 
+    std::vector<double> cx( n ), cy( n ), rad( n ) ;
+    std::vector<unsigned> idx ;
+    idx.reserve( n ) ;
+
+    for( unsigned i=0 ; i<n ; ++i ){
+
+      const lcio::Track* trk = segs[i]->first ;
+      const TrackInfoStruct* ti = trk->ext<TrackInfo>() ;
+
+      TrackInfoStruct c ;
+      if( ti ) c = *ti ;
+      if( ! c.hasCircle ) c.setCircle( trk ) ;
+
+      cx[i]  = c.x0 ;
+      cy[i]  = c.y0 ;
+      rad[i] = dCut * std::abs( c.r ) ;
+
+      // tracks w/o a finite circle center are never merged
+      if( std::isfinite( cx[i] ) && std::isfinite( cy[i] ) && std::isfinite( rad[i] ) )
+	idx.push_back( i ) ;
+    }
+
+    if( idx.size() < 2 ) 
+      return ;
+
+    // --- grid cell size: median search radius 
+    std::vector<double> radSorted ;
+    radSorted.reserve( idx.size() ) ;
+    for( unsigned k=0 ; k<idx.size() ; ++k ) 
+      radSorted.push_back( rad[ idx[k] ] ) ;
+    std::nth_element( radSorted.begin(), radSorted.begin() + radSorted.size() / 2, radSorted.end() ) ;
+
+    double h = radSorted[ radSorted.size() / 2 ] ;
+    if( !( h > 1.e-3 ) ) h = 1.e-3 ;
+
+    typedef std::pair<long long, long long> Cell ;
+    std::vector<Cell> cell( n ) ;
+    for( unsigned k=0 ; k<idx.size() ; ++k ){
+      unsigned i = idx[k] ;
+      cell[i] = Cell( (long long) std::floor( cx[i] / h ), (long long) std::floor( cy[i] / h ) ) ;
+    }
+
+    // --- sort the segments in grid cells 
+    std::vector<unsigned> sorted( idx ) ;
+    std::sort( sorted.begin(), sorted.end(), [&]( unsigned a, unsigned b ){ return cell[a] < cell[b] ; } ) ;
+
+    std::vector<Cell> sortedCell( sorted.size() ) ;
+    for( unsigned k=0 ; k<sorted.size() ; ++k ) 
+      sortedCell[k] = cell[ sorted[k] ] ;
+
+    // test with a slightly larger radius - the exact cut is applied by TrackCircleDistance
+    const double tolerance = 1.0001 ;
+
+    for( unsigned k=0 ; k<idx.size() ; ++k ){
+
+      unsigned i = idx[k] ;
+      double r2 = rad[i] * rad[i] * tolerance ;
+
+      long long nc = (long long) std::ceil( rad[i] / h ) ;
+
+      if( 2 * nc + 1 > (long long) idx.size() ){ // search region larger than number of segments -> test all
+
+	for( unsigned m=k+1 ; m<idx.size() ; ++m ){
+	  unsigned j = idx[m] ;
+	  double dx = cx[i] - cx[j] , dy = cy[i] - cy[j] ;
+	  if( dx*dx + dy*dy <= r2 ) 
+	    pairs.push_back( std::make_pair( i, j ) ) ;
+	}
+	continue ;
+      }
+
+      for( long long ix = cell[i].first - nc ; ix <= cell[i].first + nc ; ++ix ){
+
+	std::vector<Cell>::iterator b = std::lower_bound( sortedCell.begin(), sortedCell.end(), Cell( ix, cell[i].second - nc ) ) ;
+	std::vector<Cell>::iterator e = std::upper_bound( b, sortedCell.end(), Cell( ix, cell[i].second + nc ) ) ;
+
+	for( ; b != e ; ++b ){
+	  unsigned j = sorted[ b - sortedCell.begin() ] ;
+	  if( j <= i ) continue ;
+	  double dx = cx[i] - cx[j] , dy = cy[i] - cy[j] ;
+	  if( dx*dx + dy*dy <= r2 ) 
+	    pairs.push_back( std::make_pair( i, j ) ) ;
+	}
+      }
+    }
+
+    std::sort( pairs.begin(), pairs.end() ) ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  namespace{
+    
+    /** Hits within maxDist of the circle through the origin with center (cx,cy) that are not yet in a cluster. */
+    void hitsOnCircle( const std::vector<Hit*>& hits, double cx, double cy, double maxDist, std::vector<Hit*>& onCircle ){
+
+      const double R = sqrt( cx*cx + cy*cy ) ;
+      
+      onCircle.clear() ;
+
+      for( unsigned i=0 ; i<hits.size() ; ++i ){
+
+	const DDSurfaces::Vector3D& pos = hits[i]->first->pos ;
+
+	const double dx = pos.x() - cx, dy = pos.y() - cy ;
+
+	if( hits[i]->second == 0 && std::abs( sqrt( dx*dx + dy*dy ) - R ) < maxDist ) 
+	  onCircle.push_back( hits[i] ) ;
+      }
+    }
+
+    /** Keep the hits that are within maxDZ in z of the helix with the axis (cx,cy): the phase around the axis is 
+     *  linear in z ( the slope 1/(R tanLambda) does not change with the energy loss in the transverse plane ). 
+     *  The slope is the median of the slopes between hits that are consecutive in z and the phase at z=0 the 
+     *  circular mean of all hits. The hits are sorted in z. Returns false if no slope could be determined.
+     */
+    bool hitsNearHelix( std::vector<Hit*>& hits, double cx, double cy, double maxDZ ){
+
+      std::sort( hits.begin(), hits.end(), ZSort() ) ;
+
+      const unsigned n = hits.size() ;
+
+      std::vector<double> phase( n ) ;
+      for( unsigned i=0 ; i<n ; ++i ){
+	const DDSurfaces::Vector3D& pos = hits[i]->first->pos ;
+	phase[i] = atan2( pos.y() - cy , pos.x() - cx ) ;
+      }
+
+      // slopes between consecutive hits that are far enough apart in z to measure it and close enough to be unambiguous
+      const double dzMin = 0.25 * maxDZ ;
+      std::vector<double> slopes ;
+      slopes.reserve( n ) ;
+
+      for( unsigned i=1 ; i<n ; ++i ){
+
+	const double dz = hits[i]->first->pos.z() - hits[i-1]->first->pos.z() ;
+	const double dp = remainder( phase[i] - phase[i-1] , 2. * M_PI ) ;
+
+	if( dz >= dzMin && std::abs( dp ) < 0.5 * M_PI ) 
+	  slopes.push_back( dp / dz ) ;
+      }
+
+      if( slopes.empty() ) 
+	return false ;
+
+      std::nth_element( slopes.begin(), slopes.begin() + slopes.size() / 2 , slopes.end() ) ;
+      const double slope = slopes[ slopes.size() / 2 ] ;
+
+      double s = 0., c = 0. ;
+      for( unsigned i=0 ; i<n ; ++i ){
+	s += sin( phase[i] - slope * hits[i]->first->pos.z() ) ;
+	c += cos( phase[i] - slope * hits[i]->first->pos.z() ) ;
+      }
+      const double phase0 = atan2( s, c ) ;
+
+      // the distance in z to the nearest turn of the helix 
+      unsigned m = 0 ;
+      for( unsigned i=0 ; i<n ; ++i ){
+
+	const double dp = remainder( phase[i] - slope * hits[i]->first->pos.z() - phase0 , 2. * M_PI ) ;
+
+	if( std::abs( dp ) <= std::abs( slope ) * maxDZ ) 
+	  hits[ m++ ] = hits[i] ;
+      }
+      hits.resize( m ) ;
+
+      return true ;
+    }
+  }
+
+  unsigned findLoopers( HitListVector& hitsInLayer, const LooperFinderParams& p, Clusterer::cluster_list& cluList, ClupaWorkspace& ws ){
+
+    const int nPhi = p.nPhiBins ;
+    const int nR   = int( p.rMax / p.rBinSize ) + 1 ;
+    const double dPhi = 2. * M_PI / nPhi ;
+
+    std::vector<unsigned>& votes = ws.houghVotes ;
+    votes.assign( nPhi * nR , 0 ) ;
+
+    HitVec& hits = ws.windowHits ;
+    ws.prepare( hits, ws.nncluHits.size() ) ;
+
+    for( unsigned l=0 ; l<hitsInLayer.size() ; ++l )
+      for( unsigned i=0 ; i<hitsInLayer[l].size() ; ++i )
+	hits.push_back( hitsInLayer[l][i] ) ;
+
+    //--- only the outer rows vote: loopers have most of their hits there and the inner rows are dominated by other tracks
+    const int minVoteLayer = int( ( 1. - p.outerRowFraction ) * hitsInLayer.size() ) ;
+
+    //--- the circle through the origin and the hit at (r,phi) with its center at azimuth phiC has the radius r / ( 2 cos( phi - phiC ) )
+    for( unsigned i=0 ; i<hits.size() ; ++i ){
+
+      if( hits[i]->first->layer < minVoteLayer ) 
+	continue ;
+
+      const DDSurfaces::Vector3D& pos = hits[i]->first->pos ;
+
+      const double r   = pos.rho() ;
+      const double phi = pos.phi() ;
+      
+      if( r <= 0. || r >= 2. * p.rMax ) 
+	continue ;
+
+      const double cosMin = r / ( 2. * p.rMax ) ;
+      const double dMax   = acos( cosMin ) ;
+      
+      const int k0 = int( std::floor( ( phi - dMax ) / dPhi ) ) ;
+      const int k1 = int( std::floor( ( phi + dMax ) / dPhi ) ) ;
+
+      for( int k = k0 ; k <= k1 ; ++k ){
+
+	const double c = cos( phi - ( k + 0.5 ) * dPhi ) ;
+	if( c <= cosMin ) 
+	  continue ;
+
+	const int iR = int( r / ( 2. * c ) / p.rBinSize ) ;
+	if( iR >= nR ) 
+	  continue ;
+
+	const int kk = ( ( k % nPhi ) + nPhi ) % nPhi ;
+	++votes[ kk * nR + iR ] ;
+      }
+    }
+
+    //--- local maxima above threshold - in decreasing order of votes 
+    std::vector<unsigned> peaks ;
+    for( int k=0 ; k<nPhi ; ++k ){
+      for( int iR=0 ; iR<nR ; ++iR ){
+
+	// the votes of a circle are spread over neighbouring bins - the number of hits is checked after the refit 
+	const unsigned v = votes[ k * nR + iR ] ;
+	if( v < p.minVotes ) 
+	  continue ;
+
+	bool isMax = true ;
+	for( int dk=-1 ; dk<=1 && isMax ; ++dk ){
+	  for( int dr=-1 ; dr<=1 && isMax ; ++dr ){
+	    const int kk = ( k + dk + nPhi ) % nPhi, rr = iR + dr ;
+	    if( ( dk || dr ) && rr >= 0 && rr < nR ) // plateaus: the first bin is the maximum
+	      isMax = ( votes[ kk * nR + rr ] < v || ( votes[ kk * nR + rr ] == v && kk * nR + rr > k * nR + iR ) ) ;
+	  }
+	}
+	if( isMax ) 
+	  peaks.push_back( k * nR + iR ) ;
+      }
+    }
+    std::stable_sort( peaks.begin(), peaks.end(), [&]( unsigned a, unsigned b ){ return votes[a] > votes[b] ; } ) ;
+
+    //--- refit the circles and create the segments 
+    unsigned nLooper = 0 ;
+    std::vector<Hit*> onCircle ;
+    onCircle.reserve( hits.size() ) ;
+    std::vector<int> layerCount( hitsInLayer.size() ) ;
+
+    for( unsigned ip=0 ; ip<peaks.size() ; ++ip ){
+
+      const int k  = peaks[ip] / nR ;
+      const int iR = peaks[ip] % nR ;
+
+      double R  = ( iR + 0.5 ) * p.rBinSize ;
+      double cx = R * cos( ( k + 0.5 ) * dPhi ) ;
+      double cy = R * sin( ( k + 0.5 ) * dPhi ) ;
+
+      hitsOnCircle( hits, cx, cy, std::max( p.maxDist, p.rBinSize ), onCircle ) ;
+
+      if( onCircle.size() < p.minHits ) 
+	continue ;
+
+      // least squares fit of a circle through the origin:  c.h = |h|^2 / 2 
+      double a00 = 0., a01 = 0., a11 = 0., b0 = 0., b1 = 0. ;
+      for( unsigned i=0 ; i<onCircle.size() ; ++i ){
+	const DDSurfaces::Vector3D& pos = onCircle[i]->first->pos ;
+	const double x = pos.x(), y = pos.y(), h2 = 0.5 * ( x*x + y*y ) ;
+	a00 += x*x ; a01 += x*y ; a11 += y*y ;
+	b0  += x*h2 ; b1 += y*h2 ;
+      }
+      const double det = a00 * a11 - a01 * a01 ;
+      if( std::abs( det ) < 1.e-9 ) 
+	continue ;
+
+      cx = (  a11 * b0 - a01 * b1 ) / det ;
+      cy = ( -a01 * b0 + a00 * b1 ) / det ;
+
+      hitsOnCircle( hits, cx, cy, p.maxDist, onCircle ) ;
+
+      if( onCircle.size() < p.minHits ) 
+	continue ;
+
+      // foreign hits close to the circle in the transverse plane - sorts the hits in z
+      if( ! hitsNearHelix( onCircle, cx, cy, p.maxDZ ) || onCircle.size() < p.minHits ) 
+	continue ;
+
+      // require a high density of hits per pad row, i.e. several turns 
+      std::fill( layerCount.begin(), layerCount.end(), 0 ) ;
+      unsigned nLayers = 0 ;
+      double zMin = DBL_MAX, zMax = -DBL_MAX ;
+      for( unsigned i=0 ; i<onCircle.size() ; ++i ){
+	if( layerCount[ onCircle[i]->first->layer ]++ == 0 ) ++nLayers ;
+	zMin = std::min( zMin, onCircle[i]->first->pos.z() ) ;
+	zMax = std::max( zMax, onCircle[i]->first->pos.z() ) ;
+      }
+
+      if( double( onCircle.size() ) / nLayers < p.minHitsPerLayer || zMax - zMin < p.minZSpan ) 
+	continue ;
+
+      clupa_out( DEBUG3 ) << "  findLoopers: looper with " << onCircle.size() << " hits in " << nLayers << " pad rows - center (" 
+			      << cx << "," << cy << ") - z range [" << zMin << "," << zMax << "]" << std::endl ;
+
+      //--- z is monotonous along the helix: split the hits sorted in z where the direction in pad row changes
+      unsigned nSeg = 0 ;
+      unsigned first = 0 ;
+      int dir = 0 ;
+
+      for( unsigned i=1 ; i<=onCircle.size() ; ++i ){
+
+	if( i < onCircle.size() ){
+
+	  int dl = onCircle[i]->first->layer - onCircle[i-1]->first->layer ;
+	  int sgn = ( dl > 0 ) - ( dl < 0 ) ;
+
+	  if( dir == 0 ) dir = sgn ;
+
+	  if( sgn == 0 || sgn == dir ) 
+	    continue ;
+	}
+
+	// segment [first,i) is complete
+	if( i - first >= p.minSegmentHits ){
+
+	  CluTrack* clu = new CluTrack( onCircle[first] ) ;
+	  for( unsigned j=first+1 ; j<i ; ++j ) 
+	    clu->addElement( onCircle[j] ) ;
+
+	  cluList.push_back( clu ) ;
+	  ++nSeg ;
+	}
+
+	first = i ;
+	dir = 0 ;
+      }
+
+      if( nSeg ) 
+	++nLooper ;
+    }
+
+    //--- remove the hits of the loopers from the hit lists 
+    if( nLooper ){
+      for( unsigned l=0 ; l<hitsInLayer.size() ; ++l ){
+	HitList& hL = hitsInLayer[l] ;
+	hL.erase( std::remove_if( hL.begin(), hL.end(), []( const Hit* h ){ return h->second != 0 ; } ), hL.end() ) ;
+      }
+    }
+
+    return nLooper ;
+  }
+
+  //-------------------------------------------------------------------------------------------------------------------------
+
+  void SiHitIndex::clear(){
+
+    _input.clear() ;
+    _hits.clear() ;
+    _cellStart.clear() ;
+    _sensorIDs.clear() ;
+    _sensorVec.clear() ;
+    _sensorIndex.clear() ;
+    _ladderIndex.clear() ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void SiHitIndex::build( double cellSize ){
+
+    const unsigned n = _input.size() ;
+
+    _hits.resize( n ) ;
+    _cellStart.clear() ;
+    _sensorIDs.clear() ;
+    _sensorVec.clear() ;
+    _sensorIndex.clear() ;
+    _ladderIndex.clear() ;
+    _tmp.resize( n ) ;
+
+    // --- count the hits per sensor 
+    for( unsigned i=0 ; i<n ; ++i ){
+
+      int id = _input[i]->getCellID0() ;
+
+      std::pair< std::unordered_map<int,unsigned>::iterator, bool > res = _sensorIndex.insert( std::make_pair( id, _sensorVec.size() ) ) ;
+      
+      if( res.second ){
+	Sensor sen ;
+	sen.n = 0 ;
+	_sensorVec.push_back( sen ) ;
+	_sensorIDs.push_back( id ) ;
+      }
+      
+      ++_sensorVec[ res.first->second ].n ;
+      _tmp[i] = res.first->second ;
+    }
+
+    // --- contiguous ranges per sensor 
+    unsigned offset = 0 ;
+    for( unsigned k=0 ; k<_sensorVec.size() ; ++k ){
+      _sensorVec[k].first = offset ;
+      offset += _sensorVec[k].n ;
+      _sensorVec[k].n = 0 ;
+    }
+
+    for( unsigned i=0 ; i<n ; ++i ){
+
+      Sensor& sen = _sensorVec[ _tmp[i] ] ;
+      SiHit& h = _hits[ sen.first + sen.n++ ] ;
+
+      h.hit = _input[i] ;
+      h.order = i ;
+      h.taken = false ;
+      h.u = h.v = 0. ;
+
+      for( unsigned j=0 ; j<3 ; ++j )
+	h.pos[j] = h.hit->getPosition()[j] ;
+
+      const EVENT::TrackerHitPlane* hp = dynamic_cast<const EVENT::TrackerHitPlane*>( h.hit ) ;
+
+      if( hp ){  // getU() : ( theta, phi )
+	h.dir[0] = sin( hp->getU()[0] ) * cos( hp->getU()[1] ) ;
+	h.dir[1] = sin( hp->getU()[0] ) * sin( hp->getU()[1] ) ;
+	h.dir[2] = cos( hp->getU()[0] ) ;
+      } else {
+	h.dir[0] = h.dir[1] = h.dir[2] = 0. ;
+      }
+    }
+
+    // --- (u,v) grid per sensor 
+    for( unsigned k=0 ; k<_sensorVec.size() ; ++k ){
+
+      Sensor& sen = _sensorVec[k] ;
+      SiHit* hits = &_hits[ sen.first ] ;
+
+      sen.indexed = false ;
+      sen.cellOffset = _cellStart.size() ;
+
+      // chain the sensors of the same ladder
+      std::pair< std::unordered_map<int,unsigned>::iterator, bool > lad = _ladderIndex.insert( std::make_pair( ladderKey( _sensorIDs[k] ), k ) ) ;
+      sen.nextOnLadder = ( lad.second ? -1 : int( lad.first->second ) ) ;
+      lad.first->second = k ;
+
+      const EVENT::TrackerHitPlane* hp = dynamic_cast<const EVENT::TrackerHitPlane*>( hits[0].hit ) ;
+      if( ! hp ) 
+	continue ;
+
+      bool sameDir = true ;
+      for( unsigned i=1 ; i<sen.n && sameDir ; ++i )
+	sameDir = ( dynamic_cast<const EVENT::TrackerHitPlane*>( hits[i].hit ) != 0   &&
+		    hits[i].dir[0]*hits[0].dir[0] + hits[i].dir[1]*hits[0].dir[1] + hits[i].dir[2]*hits[0].dir[2] > 1. - 1.e-9 ) ;
+      if( ! sameDir ) 
+	continue ;
+
+      // orthonormal axes in the sensor plane: u and the component of v perpendicular to u
+      const double vth = hp->getV()[0], vph = hp->getV()[1] ;
+      double vRaw[3] = { sin( vth ) * cos( vph ) , sin( vth ) * sin( vph ) , cos( vth ) } ;
+      double uv = 0. ;
+      for( unsigned j=0 ; j<3 ; ++j ){
+	sen.u[j] = hits[0].dir[j] ;
+	sen.origin[j] = hits[0].pos[j] ;
+	uv += vRaw[j] * sen.u[j] ;
+      }
+      double vNorm = 0. ;
+      for( unsigned j=0 ; j<3 ; ++j ){
+	sen.v[j] = vRaw[j] - uv * sen.u[j] ;
+	vNorm += sen.v[j] * sen.v[j] ;
+      }
+      if( vNorm < 1.e-12 ) 
+	continue ;
+      vNorm = sqrt( vNorm ) ;
+      for( unsigned j=0 ; j<3 ; ++j )
+	sen.v[j] /= vNorm ;
+
+      double uMax = -DBL_MAX, vMax = -DBL_MAX ;
+      sen.uMin = sen.vMin = DBL_MAX ;
+
+      for( unsigned i=0 ; i<sen.n ; ++i ){
+	SiHit& h = hits[i] ;
+	double d[3] = { h.pos[0] - sen.origin[0], h.pos[1] - sen.origin[1], h.pos[2] - sen.origin[2] } ;
+	h.u = d[0]*sen.u[0] + d[1]*sen.u[1] + d[2]*sen.u[2] ;
+	h.v = d[0]*sen.v[0] + d[1]*sen.v[1] + d[2]*sen.v[2] ;
+	sen.uMin = std::min( sen.uMin, h.u ) ; uMax = std::max( uMax, h.u ) ;
+	sen.vMin = std::min( sen.vMin, h.v ) ; vMax = std::max( vMax, h.v ) ;
+      }
+
+      // limit the number of cells to a few per hit 
+      sen.cell = cellSize ;
+      for(;;){
+	sen.nu = int( ( uMax - sen.uMin ) / sen.cell ) + 1 ;
+	sen.nv = int( ( vMax - sen.vMin ) / sen.cell ) + 1 ;
+	if( double( sen.nu ) * sen.nv <= 4. * sen.n + 16. ) 
+	  break ;
+	sen.cell *= 2. ;
+      }
+
+      // stable counting sort of the hits into the cells ( iu * nv + iv )
+      const unsigned nCell = sen.nu * sen.nv ;
+      _cellStart.resize( sen.cellOffset + nCell + 1 , 0 ) ;
+      unsigned* start = &_cellStart[ sen.cellOffset ] ;
+
+      _tmp.resize( sen.n ) ;
+      for( unsigned i=0 ; i<sen.n ; ++i ){
+	int iu = std::min( sen.nu - 1, int( ( hits[i].u - sen.uMin ) / sen.cell ) ) ;
+	int iv = std::min( sen.nv - 1, int( ( hits[i].v - sen.vMin ) / sen.cell ) ) ;
+	_tmp[i] = iu * sen.nv + iv ;
+	++start[ _tmp[i] + 1 ] ;
+      }
+      for( unsigned c=0 ; c<nCell ; ++c ) 
+	start[c+1] += start[c] ;
+
+      _buf.assign( hits, hits + sen.n ) ;
+      for( unsigned i=0 ; i<sen.n ; ++i )       // start[c] is used as insertion cursor ...
+	hits[ start[ _tmp[i] ]++ ] = _buf[i] ;
+      for( unsigned c=nCell ; c>0 ; --c )        // ... and is the end of cell c afterwards 
+	start[c] = start[c-1] ;
+      start[0] = 0 ;
+
+      sen.indexed = true ;
+    }
+
+    _input.clear() ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  SiHitIndex::SiHit* SiHitIndex::closest( int sensorID, const double* point, bool isStrip, double maxDist2, double& dist2 ){
+
+    dist2 = DBL_MAX ;
+    SiHit* best = 0 ;
+
+    std::unordered_map<int,unsigned>::const_iterator it = _sensorIndex.find( sensorID ) ;
+
+    if( it != _sensorIndex.end() ) 
+      searchSensor( _sensorVec[ it->second ], point, isStrip, maxDist2, best, dist2 ) ;
+
+    return best ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  SiHitIndex::SiHit* SiHitIndex::closestOnLadder( int key, const double* point, bool isStrip, double maxDist2, double& dist2 ){
+
+    dist2 = DBL_MAX ;
+    SiHit* best = 0 ;
+
+    std::unordered_map<int,unsigned>::const_iterator it = _ladderIndex.find( key ) ;
+
+    if( it != _ladderIndex.end() ) 
+      for( int k = it->second ; k >= 0 ; k = _sensorVec[k].nextOnLadder )
+	searchSensor( _sensorVec[k], point, isStrip, maxDist2, best, dist2 ) ;
+
+    return best ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  int SiHitIndex::ladderKey( int cellID0 ){
+
+    static const int mask = [](){
+      UTIL::BitField64 bf( UTIL::LCTrackerCellID::encoding_string() ) ;
+      return ~int( bf[ UTIL::LCTrackerCellID::side() ].mask() | bf[ UTIL::LCTrackerCellID::sensor() ].mask() ) ;
+    }() ;
+
+    return cellID0 & mask ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void SiHitIndex::searchSensor( const Sensor& sen, const double* point, bool isStrip, double maxDist2, SiHit*& best, double& dist2 ){
+
+    SiHit* hits = &_hits[ sen.first ] ;
+
+    auto test = [&]( SiHit& h ){
+      
+      if( h.taken ) 
+	return ;
+
+      double d[3] = { point[0] - h.pos[0], point[1] - h.pos[1], point[2] - h.pos[2] } ;
+      double d2 ;
+
+      if( isStrip ){ 
+	double du = d[0]*h.dir[0] + d[1]*h.dir[1] + d[2]*h.dir[2] ;
+	d2 = du * du ;
+      } else {
+	d2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2] ;
+      }
+
+      if( d2 > maxDist2 ) 
+	return ;
+
+      if( d2 < dist2 || ( best && d2 == dist2 && h.order < best->order ) ){
+	best = &h ;
+	dist2 = d2 ;
+      }
+    } ;
+
+    if( ! sen.indexed ){
+
+      for( unsigned i=0 ; i<sen.n ; ++i ) 
+	test( hits[i] ) ;
+
+      return ;
+    }
+
+    // search the cells within the maximum distance ( plus a margin for the precision of the directions )
+    const double r = sqrt( maxDist2 ) + 1.e-2 ;
+    double d[3] = { point[0] - sen.origin[0], point[1] - sen.origin[1], point[2] - sen.origin[2] } ;
+    double pu = d[0]*sen.u[0] + d[1]*sen.u[1] + d[2]*sen.u[2] ;
+    double pv = d[0]*sen.v[0] + d[1]*sen.v[1] + d[2]*sen.v[2] ;
+
+    int iu0 = std::max( 0,           int( std::floor( ( pu - r - sen.uMin ) / sen.cell ) ) ) ;
+    int iu1 = std::min( sen.nu - 1,  int( std::floor( ( pu + r - sen.uMin ) / sen.cell ) ) ) ;
+
+    // strips only measure u
+    int iv0 = ( isStrip ? 0          : std::max( 0,          int( std::floor( ( pv - r - sen.vMin ) / sen.cell ) ) ) ) ;
+    int iv1 = ( isStrip ? sen.nv - 1 : std::min( sen.nv - 1, int( std::floor( ( pv + r - sen.vMin ) / sen.cell ) ) ) ) ;
+
+    if( iv0 > iv1 ) 
+      return ;
+
+    const unsigned* start = &_cellStart[ sen.cellOffset ] ;
+
+    for( int iu = iu0 ; iu <= iu1 ; ++iu )
+      for( unsigned i = start[ iu * sen.nv + iv0 ], end = start[ iu * sen.nv + iv1 + 1 ] ; i < end ; ++i ) 
+	test( hits[i] ) ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  unsigned SiHitIndex::nHits( int sensorID ) const {
+
+    std::unordered_map<int,unsigned>::const_iterator it = _sensorIndex.find( sensorID ) ;
+
+    return ( it == _sensorIndex.end() ? 0 : _sensorVec[ it->second ].n ) ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void SiLadderTable::addLayers( const DD4hep::DDRec::SurfaceMap& surfaces, int detID ){
+
+    lcio::BitField64 encoder( lcio::LCTrackerCellID::encoding_string() ) ;
+
+    // extent of the sensors of a ladder: along the tangent of the ladder plane and in z
+    struct Extent{ double wMin, wMax, zMin, zMax ; } ;
+
+    std::vector< std::map<int,Ladder> > layers ;
+    std::vector< std::map<int,Extent> > extents ;
+
+    for( DD4hep::DDRec::SurfaceMap::const_iterator it = surfaces.begin() ; it != surfaces.end() ; ++it ){
+
+      const DDSurfaces::ISurface* surf = it->second ;
+
+      if( ! surf->type().isSensitive() )
+	continue ;
+
+      encoder.setValue( surf->id() ) ;
+
+      if( int( encoder[ lcio::LCTrackerCellID::subdet() ] ) != detID )
+	continue ;
+
+      const int layer  = encoder[ lcio::LCTrackerCellID::layer()  ] ;
+      const int module = encoder[ lcio::LCTrackerCellID::module() ] ;
+
+      if( layer < 0 )
+	continue ;
+
+      if( unsigned( layer ) >= layers.size() ){
+	layers.resize( layer + 1 ) ;
+	extents.resize( layer + 1 ) ;
+      }
+
+      const DDSurfaces::Vector3D o = surf->origin() ;
+      const DDSurfaces::Vector3D n = surf->normal() ;
+      const DDSurfaces::Vector3D u = surf->u() ;
+      const DDSurfaces::Vector3D v = surf->v() ;
+
+      const double lu = 0.5 * surf->length_along_u() ;
+      const double lv = 0.5 * surf->length_along_v() ;
+
+      double nx = n.x(), ny = n.y() ;
+      const double nt = std::sqrt( nx * nx + ny * ny ) ;
+      if( nt == 0. )
+	continue ;
+      nx /= nt ; ny /= nt ;
+
+      double dist = nx * o.x() + ny * o.y() ;
+      if( dist < 0. ){  // normal pointing outwards
+	nx = -nx ; ny = -ny ; dist = -dist ;
+      }
+
+      const double tx = -ny, ty = nx ;
+      const double w  = tx * o.x() + ty * o.y() ;
+      const double hw = std::abs( tx * u.x() + ty * u.y() ) * lu + std::abs( tx * v.x() + ty * v.y() ) * lv ;
+      const double hz = std::abs( u.z() ) * lu + std::abs( v.z() ) * lv ;
+
+      std::map<int,Extent>::iterator ext = extents[layer].find( module ) ;
+
+      if( ext == extents[layer].end() ){  // first sensor of the ladder defines the plane
+
+	Ladder& lad = layers[layer][module] ;
+	lad.nx = nx ;
+	lad.ny = ny ;
+	lad.dist = dist / dd4hep::mm ;
+
+	Extent e = { w - hw, w + hw, o.z() - hz, o.z() + hz } ;
+	extents[layer][module] = e ;
+
+      } else {
+
+	Extent& e = ext->second ;
+	e.wMin = std::min( e.wMin, w - hw ) ;
+	e.wMax = std::max( e.wMax, w + hw ) ;
+	e.zMin = std::min( e.zMin, o.z() - hz ) ;
+	e.zMax = std::max( e.zMax, o.z() + hz ) ;
+      }
+    }
+
+    for( unsigned l=0 ; l < layers.size() ; ++l ){
+
+      for( std::map<int,Ladder>::iterator it = layers[l].begin() ; it != layers[l].end() ; ++it ){
+
+	const Extent& e = extents[l][ it->first ] ;
+	Ladder& lad = it->second ;
+
+	lad.offset    = 0.5 * ( e.wMin + e.wMax ) / dd4hep::mm ;
+	lad.halfWidth = 0.5 * ( e.wMax - e.wMin ) / dd4hep::mm ;
+	lad.zMin      = e.zMin / dd4hep::mm ;
+	lad.zMax      = e.zMax / dd4hep::mm ;
+      }
+
+      _layers.push_back( layers[l] ) ;
+      _detIDs.push_back( detID ) ;
+      _layerNums.push_back( l ) ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  int SiLadderTable::inwardDirection( const lcio::TrackState& ts ){
+
+    // radial component of the momentum direction at the point of closest approach to the reference point
+    const double phi = ts.getPhi() ;
+    const float* ref = ts.getReferencePoint() ;
+
+    return ( ref[0] * cos( phi ) + ref[1] * sin( phi ) > 0. ? -1 : 1 ) ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  int SiLadderTable::intersect( const lcio::TrackState& ts, unsigned lx, int direction, double tolerance, double* point ) const {
+
+    const double d0 = ts.getD0(), phi = ts.getPhi(), om = ts.getOmega(), z0 = ts.getZ0(), tanL = ts.getTanLambda() ;
+    const float* ref = ts.getReferencePoint() ;
+
+    if( om == 0. || lx >= _layers.size() ) 
+      return -1 ;
+
+    const double R  = 1. / om ;
+    const double xc = ref[0] + ( R - d0 ) * sin( phi ) ;
+    const double yc = ref[1] + ( d0 - R ) * cos( phi ) ;
+
+    const std::map<int,Ladder>& ladders = _layers[lx] ;
+
+    int module = -1 ;
+    double sMin = DBL_MAX ;
+
+    for( std::map<int,Ladder>::const_iterator it = ladders.begin() ; it != ladders.end() ; ++it ){
+
+      const Ladder& lad = it->second ;
+
+      // circle - line intersection: the line is at distance delta from the center of the circle
+      const double delta = lad.dist - ( lad.nx * xc + lad.ny * yc ) ;
+      const double root2 = R * R - delta * delta ;
+
+      if( root2 < 0. ) 
+	continue ;
+
+      const double root = sqrt( root2 ) ;
+      const double tx = -lad.ny, ty = lad.nx ;
+
+      for( int sign = -1 ; sign <= 1 ; sign += 2 ){
+
+	const double px = xc + delta * lad.nx + sign * root * tx ;
+	const double py = yc + delta * lad.ny + sign * root * ty ;
+
+	if( std::abs( px * tx + py * ty - lad.offset ) > lad.halfWidth + tolerance ) 
+	  continue ;
+
+	// path length from the reference point - within half a turn 
+	double dPhi = phi - atan2( -( px - xc ) / R , ( py - yc ) / R ) ;
+	while( dPhi >   M_PI ) dPhi -= 2. * M_PI ;
+	while( dPhi <= -M_PI ) dPhi += 2. * M_PI ;
+	
+	double s = dPhi / om ;
+
+	// only intersections in the direction of the extrapolation - at most one turn
+	if( s * direction < 0. )
+	  s += direction * 2. * M_PI / std::abs( om ) ;
+
+	const double pz = ref[2] + z0 + tanL * s ;
+
+	if( pz < lad.zMin - tolerance || pz > lad.zMax + tolerance ) 
+	  continue ;
+
+	if( std::abs( s ) < sMin ){
+	  sMin = std::abs( s ) ;
+	  module = it->first ;
+	  point[0] = px ; point[1] = py ; point[2] = pz ;
+	}
+      }
+    }
+
+    return module ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  unsigned TPCDomains::index( const DDSurfaces::Vector3D& pos ) const {
+
+    unsigned iz = ( _nZ > 1 && pos.z() > 0. ? 1 : 0 ) ;
+
+    if( _nPhi < 2 ) 
+      return iz ;
+
+    int ip = int( ( pos.phi() + M_PI ) / ( 2. * M_PI ) * _nPhi ) ;
+
+    ip = std::min( std::max( ip, 0 ), int( _nPhi ) - 1 ) ;
+
+    return iz * _nPhi + ip ;
+  }
+
+  double TPCDomains::boundaryDistance( const DDSurfaces::Vector3D& pos ) const {
+
+    double dist = 1e99 ;
+
+    if( _nZ > 1 )  // the cathode 
+      dist = std::abs( pos.z() ) ;
+
+    if( _nPhi > 1 ){
+
+      const double width = 2. * M_PI / _nPhi ;
+
+      double dPhi = std::fmod( pos.phi() + M_PI , width ) ;
+
+      dPhi = std::min( dPhi , width - dPhi ) ;
+
+      dist = std::min( dist , pos.rho() * dPhi ) ;
+    }
+
+    return dist ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  void splitIntoDomains( const HitListVector& hitsInLayer, const TPCDomains& domains, ClupaWorkspace& ws ){
+
+    const unsigned nDom = domains.size() ;
+    const unsigned nLayers = hitsInLayer.size() ;
+
+    if( ws.domains.size() != nDom ) 
+      ws.domains.resize( nDom ) ;
+
+    for( unsigned d=0 ; d<nDom ; ++d )
+      ws.domains[d].prepareLayers( ws.domains[d].hitsInLayer, nLayers ) ;
+
+    for( unsigned l=0 ; l<nLayers ; ++l ){
+      for( HitList::const_iterator it = hitsInLayer[l].begin(), end = hitsInLayer[l].end() ; it != end ; ++it ){
+
+	ws.domains[ domains.index( (*it)->first->pos ) ].hitsInLayer[l].push_back( *it ) ;
+      }
+    }
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  std::string ClupaWorkspace::statistics() const {
+
+    size_t nLayerHits = 0 ;
+    for( unsigned i=0,n=hitsInLayer.size() ; i<n ; ++i) nLayerHits += hitsInLayer[i].capacity() ;
+    
+    size_t nBytes = clupaHits.capacity() * sizeof( ClupaHit ) + hitStore.capacity() * sizeof( Hit ) 
+      + ( nncluHits.capacity() + windowHits.capacity() + seedHits.capacity() + nLayerHits ) * sizeof( Hit* ) ;
+    
+    unsigned nReusedAll = nReused ;
+    unsigned nGrownAll  = nGrown ;
+
+    for( unsigned d=0 ; d < domains.size() ; ++d ){
+
+      const ClupaDomainBuffers& db = domains[d] ;
+
+      for( unsigned i=0,n=db.hitsInLayer.size() ; i<n ; ++i) nBytes += db.hitsInLayer[i].capacity() * sizeof( Hit* ) ;
+
+      nBytes += ( db.windowHits.capacity() + db.seedHits.capacity() ) * sizeof( Hit* ) ;
+
+      nReusedAll += db.nReused ;
+      nGrownAll  += db.nGrown ;
+    }
+
+    unsigned nTot = nReusedAll + nGrownAll ;
+
+    std::stringstream s ;
+    s << " ClupaWorkspace: " << nEvents << " events -  buffers re-used: " << nReusedAll << " , grown: " << nGrownAll
+      << " ( " << ( nTot ? 100. * nReusedAll / nTot : 0. ) << " % re-used ) \n"
+      << "   capacity: clupaHits " << clupaHits.capacity() << " , hits " << hitStore.capacity() 
+      << " , window hits " << windowHits.capacity() << " , pad rows " << hitsInLayer.size() 
+      << " , hits in rows " << nLayerHits << " , domains " << domains.size() << "  - total " << nBytes / 1024 << " kByte \n" ;
+    
+    return s.str() ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  void TimeBudget::stageNames( unsigned mask, std::vector<std::string>& names ){
+
+    static const char* stageName[ NStages ] = { "SeedingLoops", "GlobalReclustering", "MergeSplitSegments", "MergeCurlerSegments" } ;
+
+    names.clear() ;
+
+    for( unsigned i=0 ; i < NStages ; ++i )
+      if( mask & ( 1u << i ) ) 
+	names.push_back( stageName[i] ) ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  void ClupaContextPool::add( ClupaEventContext* ctx ){
+
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    _all.push_back( ctx ) ;
+    _free.push_back( ctx ) ;
+
+    _cond.notify_one() ;
+  }
+
+  ClupaEventContext* ClupaContextPool::acquire(){
+
+    std::unique_lock<std::mutex> lock( _mutex ) ;
+
+    if( _all.empty() )
+      throw EVENT::Exception( " ClupaContextPool::acquire() : no event context in pool " ) ;
+
+    _cond.wait( lock, [this](){ return !_free.empty() ; } ) ;
+
+    ClupaEventContext* ctx = _free.back() ;
+    _free.pop_back() ;
+
+    return ctx ;
+  }
+
+  void ClupaContextPool::release( ClupaEventContext* ctx ){
+
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    _free.push_back( ctx ) ;
+
+    _cond.notify_one() ;
+  }
+
+  void ClupaContextPool::clear(){
+
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    for( unsigned i=0,n=_all.size() ; i<n ; ++i )
+      delete _all[i] ;
+
+    _all.clear() ;
+    _free.clear() ;
+  }
+
 }//namespace
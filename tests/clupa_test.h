@@ -0,0 +1,32 @@
+#ifndef clupa_test_h
+#define clupa_test_h 1
+
+#include <iostream>
+
+/** Minimal helpers for the unit tests of the pattern recognition ( ctest ): the tests are plain executables 
+ *  that need no input files - every failed check is printed to std::cerr and the test fails ( clupa_test::result() ) 
+ *  if any check failed.
+ */
+namespace clupa_test{
+
+  inline unsigned& nFailed() { static unsigned n = 0 ; return n ; }
+
+  inline int result( const char* name ){
+
+    if( nFailed() ) 
+      std::cerr << name << ": " << nFailed() << " checks failed " << std::endl ;
+    else
+      std::cout << name << ": all checks passed " << std::endl ;
+
+    return nFailed() ? 1 : 0 ;
+  }
+}
+
+#define CLUPA_CHECK( cond ) \
+  do{ if( !( cond ) ){ ++clupa_test::nFailed() ; std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " << #cond << std::endl ; } }while(0)
+
+#define CLUPA_CHECK_EQUAL( a, b ) \
+  do{ if( !( (a) == (b) ) ){ ++clupa_test::nFailed() ; std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " << #a << " == " << #b \
+						    << " ( " << (a) << " != " << (b) << " ) " << std::endl ; } }while(0)
+
+#endif
@@ -0,0 +1,144 @@
+/** Unit test of the running cluster summary of the clupatra clusters ( nnclu::ClusterSummary<ClupaHit> ):
+ *  the summary has to agree with the hits in the cluster after adding, merging, sorting and clearing.
+ */
+#include "clupatra_new.h"
+#include "clupa_test.h"
+
+#include <map>
+#include <vector>
+
+using namespace clupatra_new ;
+
+namespace{
+
+  /** check the summary against the hits of the cluster */
+  void checkSummary( const CluTrack& clu ){
+
+    const nnclu::ClusterSummary<ClupaHit>& s = clu.summary() ;
+
+    std::map<int,unsigned> count ;
+    double zMin = DBL_MAX, zMax = -DBL_MAX ;
+    bool out = true, in = true ;
+    int prev = 0 ;
+
+    for( CluTrack::const_iterator it = clu.begin() ; it != clu.end() ; ++it ){
+
+      int l = (*it)->first->layer ;
+      ++count[l] ;
+
+      zMin = std::min( zMin, (*it)->first->pos.z() ) ;
+      zMax = std::max( zMax, (*it)->first->pos.z() ) ;
+
+      if( it != clu.begin() ){
+	out = out && l >= prev ;
+	in  = in  && l <= prev ;
+      }
+      prev = l ;
+    }
+
+    CLUPA_CHECK_EQUAL( s.nHit, clu.size() ) ;
+    CLUPA_CHECK_EQUAL( s.layerCounts.size(), count.size() ) ;
+
+    std::map<unsigned,unsigned> mult ;
+    unsigned nDup = 0 ;
+    for( std::map<int,unsigned>::const_iterator it = count.begin() ; it != count.end() ; ++it ){
+      CLUPA_CHECK_EQUAL( s.hitsInLayer( it->first ), it->second ) ;
+      ++mult[ it->second ] ;
+      if( it->second > 1 ) nDup += it->second ;
+    }
+    for( std::map<unsigned,unsigned>::const_iterator it = mult.begin() ; it != mult.end() ; ++it )
+      CLUPA_CHECK_EQUAL( s.nLayersWithNHits( it->first ), it->second ) ;
+
+    CLUPA_CHECK_EQUAL( s.nDuplicate(), nDup ) ;
+
+    if( clu.empty() ) 
+      return ;
+
+    CLUPA_CHECK_EQUAL( s.firstLayer, count.begin()->first ) ;
+    CLUPA_CHECK_EQUAL( s.lastLayer,  count.rbegin()->first ) ;
+    CLUPA_CHECK_EQUAL( s.zMin, zMin ) ;
+    CLUPA_CHECK_EQUAL( s.zMax, zMax ) ;
+
+    // the summary may only claim an order that the hits have
+    CLUPA_CHECK( !s.sortedOut || out ) ;
+    CLUPA_CHECK( !s.sortedIn  || in ) ;
+  }
+}
+
+
+int main(){
+
+  // hits in 300 layers ( more than the pad rows of the ILD TPC ), up to 40 hits per layer 
+  std::vector<ClupaHit> clupaHits ;
+  for( int l=0 ; l<300 ; ++l ){
+    for( int k=0, n = ( l % 7 == 0 ? 40 : l % 3 + 1 ) ; k<n ; ++k ){
+      ClupaHit h ;
+      h.layer = l ;
+      h.pos = DDSurfaces::Vector3D( 400. + 4. * l, 0.1 * k, -1000. + 3. * l + 0.5 * k ) ;
+      clupaHits.push_back( h ) ;
+    }
+  }
+
+  std::vector<Hit> hits ;
+  hits.reserve( clupaHits.size() ) ;
+  for( unsigned i=0 ; i<clupaHits.size() ; ++i )
+    hits.push_back( Hit( &clupaHits[i] ) ) ;
+
+  //---- hits added outwards in layer
+  CluTrack c0( &hits[0] ) ;
+  for( unsigned i=1 ; i<hits.size() ; ++i )
+    c0.addElement( &hits[i] ) ;
+
+  checkSummary( c0 ) ;
+  CLUPA_CHECK( c0.summary().sortedOut ) ;
+  CLUPA_CHECK( ! c0.summary().sortedIn ) ;
+  CLUPA_CHECK_EQUAL( c0.summary().hitsInLayer( 280 ), 40u ) ;  // no layer is dropped
+  CLUPA_CHECK_EQUAL( c0.summary().nLayersWithNHits( 40 ), 43u ) ;
+
+  //---- hits added in arbitrary layer order ( every 7th hit from the end ) 
+  c0.freeElements() ;
+  c0.clear() ;
+  checkSummary( c0 ) ;
+  CLUPA_CHECK_EQUAL( c0.summary().nHit, 0u ) ;
+
+  CluTrack c1 ;
+  CluTrack c2 ;
+  for( unsigned i=0 ; i<hits.size() ; ++i ){
+    unsigned k = ( hits.size() - 1 ) - ( i * 7 ) % hits.size() ;
+    if( hits[k].second == 0 ) 
+      ( k % 2 ? c1 : c2 ).addElement( &hits[k] ) ;
+  }
+  checkSummary( c1 ) ;
+  checkSummary( c2 ) ;
+
+  //---- sorting updates the order flags
+  sortLayers( &c1, true ) ;
+  checkSummary( c1 ) ;
+  CLUPA_CHECK( c1.summary().sortedOut ) ;
+
+  sortLayers( &c1, false ) ;
+  checkSummary( c1 ) ;
+  CLUPA_CHECK( c1.summary().sortedIn ) ;
+
+  c1.reverse() ;
+  checkSummary( c1 ) ;
+  CLUPA_CHECK( c1.summary().sortedOut ) ;
+
+  //---- merging 
+  unsigned n1 = c1.size(), n2 = c2.size() ;
+  c1.mergeClusters( &c2 ) ;
+  checkSummary( c1 ) ;
+  CLUPA_CHECK_EQUAL( c1.size(), n1 + n2 ) ;
+  CLUPA_CHECK_EQUAL( c2.summary().nHit, 0u ) ;
+
+  //---- the multiplicities as used by split_multiplicity 
+  std::vector<int> mult( 7 ) ;
+  getHitMultiplicities( &c1, mult ) ;
+  CLUPA_CHECK_EQUAL( unsigned( mult[0] ), c1.summary().layerCounts.size() ) ;
+  CLUPA_CHECK_EQUAL( unsigned( mult[6] ), c1.summary().nLayersWithNHits( 40 ) ) ;
+  CLUPA_CHECK_EQUAL( unsigned( mult[1] ), c1.summary().nLayersWithNHits( 1 ) ) ;
+
+  c1.freeElements() ;
+
+  return clupa_test::result( "testClusterSummary" ) ;
+}
@@ -0,0 +1,206 @@
+/** Unit test of the geometric domains of the TPC ( TPCDomains, splitIntoDomains ): every hit is in exactly 
+ *  one domain with the order of the hits in the pad rows kept, and the end points of the segments of a track 
+ *  that crosses a domain boundary are within the margin for the stitching.
+ */
+#include "clupatra_new.h"
+#include "ClupatraReconstructor.h"
+#include "clupa_test.h"
+
+#include "UTIL/BitField64.h"
+#include "UTIL/LCTrackerConf.h"
+
+#include <vector>
+#include <map>
+#include <random>
+
+using namespace clupatra_new ;
+
+namespace{
+
+  const unsigned nLayers = 50 ;
+  const double rInner = 400. ;
+  const double rowPitch = 6. ;
+  const double driftLength = 2000. ;
+
+  /** hit view of the hits with the pad row encoded in the cellID */
+  struct Hits{
+
+    Hits() : encoder( UTIL::LCTrackerCellID::encoding_string() ) {}
+
+    UTIL::BitField64 encoder ;
+    std::vector<double> pos ;
+    std::vector<int>    cellID0 ;
+    std::vector<float>  cov ;
+
+    void add( int layer, double phi, double z ){
+
+      const double r = rInner + rowPitch * layer ;
+      pos.push_back( r * std::cos( phi ) ) ;
+      pos.push_back( r * std::sin( phi ) ) ;
+      pos.push_back( z ) ;
+
+      encoder.reset() ;
+      encoder[ UTIL::LCTrackerCellID::subdet() ] = UTIL::ILDDetID::TPC ;
+      encoder[ UTIL::LCTrackerCellID::layer() ]  = layer ;
+      cellID0.push_back( encoder.lowWord() ) ;
+
+      cov.insert( cov.end(), 6, 0.1 ) ;
+    }
+
+    clupatra::TPCHitView view() const {
+      clupatra::TPCHitView v ;
+      v.n       = cellID0.size() ;
+      v.pos     = &pos[0] ;
+      v.cellID0 = &cellID0[0] ;
+      v.cov     = &cov[0] ;
+      return v ;
+    }
+  } ;
+
+  /** every hit of the pad rows is in exactly one domain - the one of its position - in the original order */
+  void checkSplit( const ClupaWorkspace& ws, const TPCDomains& domains ){
+
+    CLUPA_CHECK_EQUAL( ws.domains.size(), domains.size() ) ;
+
+    // position of the hits in their pad row
+    std::map<const Hit*,unsigned> rowIndex ;
+    for( unsigned l=0 ; l < ws.hitsInLayer.size() ; ++l )
+      for( unsigned i=0 ; i < ws.hitsInLayer[l].size() ; ++i )
+	rowIndex[ ws.hitsInLayer[l][i] ] = i ;
+
+    std::map<const Hit*,unsigned> nFound ;
+
+    for( unsigned d=0 ; d < ws.domains.size() ; ++d ){
+
+      const HitListVector& hLV = ws.domains[d].hitsInLayer ;
+      CLUPA_CHECK_EQUAL( hLV.size(), ws.hitsInLayer.size() ) ;
+
+      for( unsigned l=0 ; l < hLV.size() ; ++l ){
+	for( unsigned i=0 ; i < hLV[l].size() ; ++i ){
+
+	  const Hit* h = hLV[l][i] ;
+	  ++nFound[h] ;
+
+	  CLUPA_CHECK_EQUAL( domains.index( h->first->pos ), d ) ;
+	  CLUPA_CHECK_EQUAL( h->first->layer, int( l ) ) ;
+	  CLUPA_CHECK( rowIndex.count( h ) ) ;
+
+	  if( i > 0 ) 
+	    CLUPA_CHECK( rowIndex[ hLV[l][i-1] ] < rowIndex[h] ) ;
+	}
+      }
+    }
+
+    CLUPA_CHECK_EQUAL( nFound.size(), rowIndex.size() ) ;
+    for( std::map<const Hit*,unsigned>::const_iterator it = nFound.begin() ; it != nFound.end() ; ++it )
+      CLUPA_CHECK_EQUAL( it->second, 1u ) ;
+  }
+}
+
+
+int main(){
+
+  //---- the domains and the distance to their boundaries 
+  TPCDomains none( false, 0, 20. ) ;
+  CLUPA_CHECK_EQUAL( none.size(), 1u ) ;
+  CLUPA_CHECK_EQUAL( none.index( DDSurfaces::Vector3D( 500., 500., -100. ) ), 0u ) ;
+  CLUPA_CHECK( ! none.nearBoundary( DDSurfaces::Vector3D( 500., 0., 0. ) ) ) ;
+
+  TPCDomains halves( true, 1, 20. ) ;
+  CLUPA_CHECK_EQUAL( halves.size(), 2u ) ;
+  CLUPA_CHECK_EQUAL( halves.index( DDSurfaces::Vector3D( 500., 0., -1. ) ), 0u ) ;
+  CLUPA_CHECK_EQUAL( halves.index( DDSurfaces::Vector3D( 500., 0.,  1. ) ), 1u ) ;
+  CLUPA_CHECK( std::fabs( halves.boundaryDistance( DDSurfaces::Vector3D( 500., 0., -15. ) ) - 15. ) < 1e-9 ) ;
+  CLUPA_CHECK(   halves.nearBoundary( DDSurfaces::Vector3D( 500., 0., 15. ) ) ) ;
+  CLUPA_CHECK( ! halves.nearBoundary( DDSurfaces::Vector3D( 500., 0., 25. ) ) ) ;
+
+  const unsigned nPhi = 6 ;
+  TPCDomains sectors( true, nPhi, 20. ) ;
+  CLUPA_CHECK_EQUAL( sectors.size(), 2 * nPhi ) ;
+
+  const double width = 2. * M_PI / nPhi ;
+  for( unsigned k=0 ; k < nPhi ; ++k ){
+
+    // points on both sides of the boundary at -pi + k * width, at r = 1000 mm and far from the cathode
+    const double phiB = -M_PI + k * width ;
+    DDSurfaces::Vector3D before( 1000. * std::cos( phiB - 0.01 ), 1000. * std::sin( phiB - 0.01 ), 500. ) ;
+    DDSurfaces::Vector3D after(  1000. * std::cos( phiB + 0.01 ), 1000. * std::sin( phiB + 0.01 ), 500. ) ;
+
+    CLUPA_CHECK_EQUAL( sectors.index( after ), nPhi + k ) ;
+    CLUPA_CHECK_EQUAL( sectors.index( before ), nPhi + ( k + nPhi - 1 ) % nPhi ) ;
+    CLUPA_CHECK( std::fabs( sectors.boundaryDistance( after ) - 10. ) < 0.01 ) ;
+    CLUPA_CHECK( std::fabs( sectors.boundaryDistance( before ) - 10. ) < 0.01 ) ;
+
+    // the center of the sector is far from the boundaries
+    DDSurfaces::Vector3D center( 1000. * std::cos( phiB + 0.5 * width ), 1000. * std::sin( phiB + 0.5 * width ), -500. ) ;
+    CLUPA_CHECK_EQUAL( sectors.index( center ), k ) ;
+    CLUPA_CHECK( ! sectors.nearBoundary( center ) ) ;
+  }
+
+  //---- random hits: every hit is in exactly one domain in the order of the pad row 
+  std::mt19937 rng( 815 ) ;
+  std::uniform_int_distribution<int> layerDist( 0, nLayers - 1 ) ;
+  std::uniform_real_distribution<double> phiDist( -M_PI, M_PI ) ;
+  std::uniform_real_distribution<double> zDist( -driftLength, driftLength ) ;
+
+  Hits random ;
+  for( unsigned i=0 ; i < 3000 ; ++i )
+    random.add( layerDist( rng ), phiDist( rng ), ( i % 50 ? zDist( rng ) : 0. ) ) ;  // some hits on the cathode
+
+  ClupaWorkspace ws ;
+  ingestTPCHits( random.view(), ws, nLayers, driftLength, 10, 1 ) ;
+  CLUPA_CHECK_EQUAL( ws.nncluHits.size(), 3000u ) ;
+
+  splitIntoDomains( ws.hitsInLayer, sectors, ws ) ;
+  checkSplit( ws, sectors ) ;
+
+  // the workspace is re-used with a different number of domains
+  splitIntoDomains( ws.hitsInLayer, halves, ws ) ;
+  checkSplit( ws, halves ) ;
+
+  splitIntoDomains( ws.hitsInLayer, none, ws ) ;
+  checkSplit( ws, none ) ;
+
+  //---- a straight track that crosses the boundary of two sectors at phi=0: the segments in the two
+  //     domains end next to the boundary, so that they are stitched 
+  Hits track ;
+  for( unsigned l=0 ; l < nLayers ; ++l ){
+    const double r = rInner + rowPitch * l ;
+    const double y = -100. + 4. * l ;              // the line y = -100 mm + 4 * layer crosses phi=0 at layer 25
+    track.add( l, std::asin( y / r ), 300. + l ) ;
+  }
+
+  ClupaWorkspace wsTrk ;
+  ingestTPCHits( track.view(), wsTrk, nLayers, driftLength, 10, 1 ) ;
+  splitIntoDomains( wsTrk.hitsInLayer, sectors, wsTrk ) ;
+  checkSplit( wsTrk, sectors ) ;
+
+  // the track has hits in two domains - the end points of the two segments at the boundary
+  std::map<unsigned, std::pair<int,int> > rows ; // first and last row of the segment in every domain
+  for( unsigned d=0 ; d < wsTrk.domains.size() ; ++d )
+    for( unsigned l=0 ; l < nLayers ; ++l )
+      if( ! wsTrk.domains[d].hitsInLayer[l].empty() ){
+	if( ! rows.count( d ) ) rows[d].first = l ;
+	rows[d].second = l ;
+      }
+
+  CLUPA_CHECK_EQUAL( rows.size(), 2u ) ;
+  if( rows.size() == 2 ){
+
+    const std::pair<int,int>& inner = rows.begin()->second ;
+    const std::pair<int,int>& outer = rows.rbegin()->second ;
+
+    const Hit* innerEnd   = wsTrk.domains[ rows.begin()->first  ].hitsInLayer[ inner.second ].front() ;
+    const Hit* outerStart = wsTrk.domains[ rows.rbegin()->first ].hitsInLayer[ outer.first ].front() ;
+
+    CLUPA_CHECK_EQUAL( inner.second + 1, outer.first ) ;
+    CLUPA_CHECK( sectors.nearBoundary( innerEnd->first->pos ) ) ;
+    CLUPA_CHECK( sectors.nearBoundary( outerStart->first->pos ) ) ;
+
+    // ... but not the other ends
+    CLUPA_CHECK( ! sectors.nearBoundary( wsTrk.domains[ rows.begin()->first ].hitsInLayer[ inner.first ].front()->first->pos ) ) ;
+    CLUPA_CHECK( ! sectors.nearBoundary( wsTrk.domains[ rows.rbegin()->first ].hitsInLayer[ outer.second ].front()->first->pos ) ) ;
+  }
+
+  return clupa_test::result( "testDomains" ) ;
+}
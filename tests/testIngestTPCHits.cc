@@ -0,0 +1,165 @@
+/** Unit test of the ingestion of the TPC hits ( ingestTPCHits, rebinTPCHits ): the hits of every pad row 
+ *  have to be sorted in z, hits with the same z in input order, independent of the number of threads and 
+ *  of whether the view has hit handles or only arrays.
+ */
+#include "clupatra_new.h"
+#include "ClupatraReconstructor.h"
+#include "clupa_test.h"
+
+#include "IMPL/TrackerHitImpl.h"
+#include "UTIL/BitField64.h"
+#include "UTIL/LCTrackerConf.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+
+using namespace clupatra_new ;
+
+namespace{
+
+  const unsigned nLayers = 20 ;
+  const double driftLength = 1000. ;
+
+  /** input index of the clustering hit */
+  unsigned inputIndex( const ClupaWorkspace& ws, const Hit* h ){
+    return h->first - &ws.clupaHits[0] ;
+  }
+
+  /** (layer,z,input index) of all hits that are expected to be used, in the expected order */
+  struct Expected{
+    int layer ;
+    double z ;
+    unsigned index ;
+    bool operator<( const Expected& o ) const {
+      return layer < o.layer || ( layer == o.layer && ( z < o.z || ( z == o.z && index < o.index ) ) ) ;
+    }
+  } ;
+
+  /** check the hit lists, the clupa hits and the buckets of the workspace */
+  void checkWorkspace( const ClupaWorkspace& ws, const std::vector<Expected>& expected, const std::vector<double>& pos, int nZBins ){
+
+    CLUPA_CHECK_EQUAL( ws.nncluHits.size(), expected.size() ) ;
+    CLUPA_CHECK_EQUAL( ws.hitsInLayer.size(), nLayers ) ;
+
+    unsigned k = 0 ;
+    for( unsigned l=0 ; l < ws.hitsInLayer.size() ; ++l ){
+      for( unsigned i=0 ; i < ws.hitsInLayer[l].size() && k < expected.size() ; ++i, ++k ){
+
+	const Hit* h = ws.hitsInLayer[l][i] ;
+	CLUPA_CHECK_EQUAL( inputIndex( ws, h ), expected[k].index ) ;
+	CLUPA_CHECK_EQUAL( h->first->layer, int( l ) ) ;
+	CLUPA_CHECK( h == ws.nncluHits[k] ) ;
+	CLUPA_CHECK( h->first->lcioHit->ext<GHit>() == h ) ;
+      }
+    }
+    CLUPA_CHECK_EQUAL( k, expected.size() ) ;
+
+    // clupa hit i is input hit i 
+    for( unsigned i=0 ; i < ws.clupaHits.size() ; ++i )
+      CLUPA_CHECK_EQUAL( ws.clupaHits[i].pos.z(), pos[ 3 * i + 2 ] ) ;
+
+    // the buckets point to the hits with the layer and zIndex 
+    const unsigned nZ = nZBins ;
+    CLUPA_CHECK_EQUAL( ws.bucketStart.size(), nLayers * nZ + 1 ) ;
+    for( unsigned b=0 ; b < nLayers * nZ && b + 1 < ws.bucketStart.size() ; ++b ){
+      for( unsigned j = ws.bucketStart[b] ; j < ws.bucketStart[b+1] ; ++j ){
+	const ClupaHit* ch = ws.nncluHits[j]->first ;
+	CLUPA_CHECK_EQUAL( unsigned( ch->layer ), b / nZ ) ;
+	CLUPA_CHECK_EQUAL( unsigned( std::min( std::max( ch->zIndex, 0 ), int( nZ ) - 1 ) ), b % nZ ) ;
+      }
+    }
+  }
+}
+
+
+int main(){
+
+  UTIL::BitField64 encoder( UTIL::LCTrackerCellID::encoding_string() ) ;
+
+  std::mt19937 rng( 4711 ) ;
+  std::uniform_int_distribution<int> layerDist( 0, nLayers + 1 ) ;   // some hits outside of the pad rows
+  std::uniform_real_distribution<double> zDist( -1.1 * driftLength, 1.1 * driftLength ) ;
+
+  const unsigned nHit = 5000 ;
+
+  std::vector<double> pos( 3 * nHit ) ;
+  std::vector<int>    cellID0( nHit ) ;
+  std::vector<float>  cov( 6 * nHit, 0.1 ) ;
+  std::vector<Expected> expected ;
+
+  for( unsigned i=0 ; i<nHit ; ++i ){
+
+    int layer = layerDist( rng ) ;
+
+    // every 10th hit has the same z as the previous hit 
+    double z = ( i % 10 == 9 ? pos[ 3 * ( i - 1 ) + 2 ] : std::floor( zDist( rng ) ) ) ;
+
+    pos[ 3 * i     ] = 400. + 5. * layer ;
+    pos[ 3 * i + 1 ] = 0. ;
+    pos[ 3 * i + 2 ] = z ;
+
+    encoder.reset() ;
+    encoder[ UTIL::LCTrackerCellID::subdet() ] = UTIL::ILDDetID::TPC ;
+    encoder[ UTIL::LCTrackerCellID::layer() ]  = layer ;
+    cellID0[i] = encoder.lowWord() ;
+
+    if( unsigned( layer ) < nLayers && std::fabs( z ) <= driftLength ){
+      Expected e = { layer, z, i } ;
+      expected.push_back( e ) ;
+    }
+  }
+  std::sort( expected.begin(), expected.end() ) ;
+
+  clupatra::TPCHitView view ;
+  view.n       = nHit ;
+  view.pos     = &pos[0] ;
+  view.cellID0 = &cellID0[0] ;
+  view.cov     = &cov[0] ;
+
+  //---- view w/o handles - one and four threads 
+  for( unsigned nThreads = 1 ; nThreads <= 4 ; nThreads += 3 ){
+
+    ClupaWorkspace ws ;
+    unsigned nUsed = ingestTPCHits( view, ws, nLayers, driftLength, 10, nThreads ) ;
+
+    CLUPA_CHECK_EQUAL( nUsed, expected.size() ) ;
+    checkWorkspace( ws, expected, pos, 10 ) ;
+
+    //---- re-binning in z gives the same hits and buckets as the ingestion with the new binning 
+    rebinTPCHits( ws, nLayers, driftLength, 37 ) ;
+    checkWorkspace( ws, expected, pos, 37 ) ;
+
+    ClupaWorkspace ws37 ;
+    ingestTPCHits( view, ws37, nLayers, driftLength, 37, nThreads ) ;
+    CLUPA_CHECK( ws.bucketStart == ws37.bucketStart ) ;
+    for( unsigned k=0 ; k < expected.size() ; ++k )
+      CLUPA_CHECK_EQUAL( ws.clupaHits[ expected[k].index ].zIndex, ws37.clupaHits[ expected[k].index ].zIndex ) ;
+
+    //---- the workspace is re-used for the next event
+    ingestTPCHits( view, ws, nLayers, driftLength, 10, nThreads ) ;
+    checkWorkspace( ws, expected, pos, 10 ) ;
+  }
+
+  //---- view with hit handles only 
+  std::vector<IMPL::TrackerHitImpl> lcioHits( nHit ) ;
+  std::vector<EVENT::TrackerHit*> handles( nHit ) ;
+  for( unsigned i=0 ; i<nHit ; ++i ){
+    lcioHits[i].setCellID0( cellID0[i] ) ;
+    lcioHits[i].setPosition( &pos[ 3 * i ] ) ;
+    lcioHits[i].setCovMatrix( &cov[ 6 * i ] ) ;
+    handles[i] = &lcioHits[i] ;
+  }
+
+  clupatra::TPCHitView hView ;
+  hView.n      = nHit ;
+  hView.handle = &handles[0] ;
+
+  ClupaWorkspace ws ;
+  CLUPA_CHECK_EQUAL( ingestTPCHits( hView, ws, nLayers, driftLength, 10, 2 ), expected.size() ) ;
+  checkWorkspace( ws, expected, pos, 10 ) ;
+  for( unsigned i=0 ; i < ws.clupaHits.size() ; ++i )
+    CLUPA_CHECK( ws.clupaHits[i].lcioHit == handles[i] ) ;
+
+  return clupa_test::result( "testIngestTPCHits" ) ;
+}
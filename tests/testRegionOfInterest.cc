@@ -0,0 +1,163 @@
+/** Unit test of the region of interest ( RegionOfInterest ): cones around static directions and seed momenta,
+ *  the range in z, and the selection of the TPC hits in ingestTPCHits - including an event w/o seeds, for 
+ *  which no hit is used unless there are static cones.
+ */
+#include "clupatra_new.h"
+#include "ClupatraReconstructor.h"
+#include "clupa_test.h"
+
+#include "UTIL/BitField64.h"
+#include "UTIL/LCTrackerConf.h"
+
+#include <vector>
+#include <random>
+
+using namespace clupatra ;
+
+namespace{
+
+  const unsigned nLayers = 100 ;
+  const double driftLength = 2000. ;
+
+  /** point at distance r in the direction (theta,phi) */
+  std::vector<double> point( double r, double theta, double phi ){
+    std::vector<double> p( 3 ) ;
+    p[0] = r * std::sin( theta ) * std::cos( phi ) ;
+    p[1] = r * std::sin( theta ) * std::sin( phi ) ;
+    p[2] = r * std::cos( theta ) ;
+    return p ;
+  }
+
+  /** number of hits that are used by ingestTPCHits with the region of interest - and check that these are the
+   *  hits that the region contains
+   */
+  unsigned nUsed( const std::vector<double>& pos, const std::vector<int>& cellID0, const RegionOfInterest& roi ){
+
+    std::vector<float> cov( 2 * pos.size(), 0.1 ) ;
+
+    TPCHitView view ;
+    view.n       = cellID0.size() ;
+    view.pos     = &pos[0] ;
+    view.cellID0 = &cellID0[0] ;
+    view.cov     = &cov[0] ;
+
+    clupatra_new::ClupaWorkspace ws ;
+    unsigned n = clupatra_new::ingestTPCHits( view, ws, nLayers, driftLength, 10, 2, &roi ) ;
+
+    unsigned nInside = 0 ;
+    for( unsigned i=0 ; i < view.n ; ++i )
+      if( roi.contains( &pos[ 3 * i ] ) ) 
+	++nInside ;
+
+    CLUPA_CHECK_EQUAL( n, nInside ) ;
+    CLUPA_CHECK_EQUAL( ws.nncluHits.size(), n ) ;
+    for( unsigned i=0 ; i < ws.nncluHits.size() ; ++i )
+      CLUPA_CHECK( roi.contains( &pos[ 3 * ( ws.nncluHits[i]->first - &ws.clupaHits[0] ) ] ) ) ;
+
+    return n ;
+  }
+}
+
+
+int main(){
+
+  //---- the default region contains everything 
+  RegionOfInterest all ;
+  CLUPA_CHECK( all.empty() ) ;
+  CLUPA_CHECK( all.contains( &point( 1000., 0.3, 2. )[0] ) ) ;
+
+  //---- a cone of 0.1 rad around (theta,phi) = (1,0.5)
+  RegionOfInterest cone ;
+  cone.addCone( 1., 0.5, 0.1 ) ;
+  CLUPA_CHECK( ! cone.empty() ) ;
+  CLUPA_CHECK(   cone.contains( &point( 1000., 1.,   0.5  )[0] ) ) ;
+  CLUPA_CHECK(   cone.contains( &point( 1000., 1.09, 0.5  )[0] ) ) ;
+  CLUPA_CHECK( ! cone.contains( &point( 1000., 1.11, 0.5  )[0] ) ) ;
+  CLUPA_CHECK( ! cone.contains( &point( 1000., 1.,   0.65 )[0] ) ) ;
+  CLUPA_CHECK( ! cone.contains( &point( 1000., M_PI - 1., 0.5 + M_PI )[0] ) ) ; // the opposite direction
+
+  //---- the range in z 
+  RegionOfInterest zRange ;
+  zRange.zMin = -100. ;
+  zRange.zMax =  200. ;
+  CLUPA_CHECK( ! zRange.empty() ) ;
+  double inZ[3]  = { 500., 0., 199. } ;
+  double outZ[3] = { 500., 0., 201. } ;
+  double below[3] = { 500., 0., -101. } ;
+  CLUPA_CHECK(   zRange.contains( inZ ) ) ;
+  CLUPA_CHECK( ! zRange.contains( outZ ) ) ;
+  CLUPA_CHECK( ! zRange.contains( below ) ) ;
+
+  //---- seeds: a cone around every seed momentum 
+  const double seeds[6] = { 1., 0., 0.,   0., 0., -5. } ;
+  RegionOfInterest seeded ;
+  seeded.addSeeds( 2, seeds, 3, 0.2 ) ;
+  CLUPA_CHECK_EQUAL( seeded.cones.size(), 2u ) ;
+  CLUPA_CHECK( ! seeded.excludeAll ) ;
+  CLUPA_CHECK(   seeded.contains( &point( 800., 0.5 * M_PI, 0.1 )[0] ) ) ;
+  CLUPA_CHECK(   seeded.contains( &point( 800., M_PI - 0.1, 2. )[0] ) ) ;
+  CLUPA_CHECK( ! seeded.contains( &point( 800., 0.5 * M_PI, M_PI )[0] ) ) ;
+
+  // the stride of the momenta
+  const double strided[8] = { 0., 1., 0., 99.,   0., 0., 1., 99. } ;
+  RegionOfInterest seededStride ;
+  seededStride.addSeeds( 2, strided, 4, 0.2 ) ;
+  CLUPA_CHECK(   seededStride.contains( &point( 800., 0.5 * M_PI, 0.5 * M_PI )[0] ) ) ;
+  CLUPA_CHECK(   seededStride.contains( &point( 800., 0.05, 1. )[0] ) ) ;
+  CLUPA_CHECK( ! seededStride.contains( &point( 800., 0.5 * M_PI, 0. )[0] ) ) ;
+
+  //---- an empty seed collection: no hit is inside ...
+  RegionOfInterest noSeeds ;
+  noSeeds.addSeeds( 0, 0, 3, 0.2 ) ;
+  CLUPA_CHECK( noSeeds.excludeAll ) ;
+  CLUPA_CHECK( ! noSeeds.empty() ) ;
+  CLUPA_CHECK( ! noSeeds.contains( &point( 800., 1., 1. )[0] ) ) ;
+
+  // ... unless there are static cones
+  RegionOfInterest staticCone( cone ) ;
+  staticCone.addSeeds( 0, 0, 3, 0.2 ) ;
+  CLUPA_CHECK( ! staticCone.excludeAll ) ;
+  CLUPA_CHECK_EQUAL( staticCone.cones.size(), 1u ) ;
+  CLUPA_CHECK( staticCone.contains( &point( 1000., 1., 0.5 )[0] ) ) ;
+
+  //---- the TPC hits that are used in ingestTPCHits
+  UTIL::BitField64 encoder( UTIL::LCTrackerCellID::encoding_string() ) ;
+
+  std::mt19937 rng( 31 ) ;
+  std::uniform_int_distribution<int> layerDist( 0, nLayers - 1 ) ;
+  std::uniform_real_distribution<double> thetaDist( 0.1, M_PI - 0.1 ) ;
+  std::uniform_real_distribution<double> phiDist( -M_PI, M_PI ) ;
+
+  std::vector<double> pos ;
+  std::vector<int> cellID0 ;
+  for( unsigned i=0 ; i < 4000 ; ++i ){
+
+    const int layer = layerDist( rng ) ;
+    const double r = 400. + 10. * layer ;
+    const double theta = ( i % 4 ? thetaDist( rng ) : 1. + 0.05 * ( thetaDist( rng ) - 0.5 * M_PI ) ) ; // some hits in the cone
+    const double phi   = ( i % 4 ? phiDist( rng ) : 0.5 + 0.05 * phiDist( rng ) / M_PI ) ;
+
+    // at radius r in the transverse plane
+    pos.push_back( r * std::cos( phi ) ) ;
+    pos.push_back( r * std::sin( phi ) ) ;
+    pos.push_back( std::max( -driftLength, std::min( driftLength, r / std::tan( theta ) ) ) ) ;
+
+    encoder.reset() ;
+    encoder[ UTIL::LCTrackerCellID::subdet() ] = UTIL::ILDDetID::TPC ;
+    encoder[ UTIL::LCTrackerCellID::layer() ]  = layer ;
+    cellID0.push_back( encoder.lowWord() ) ;
+  }
+
+  CLUPA_CHECK_EQUAL( nUsed( pos, cellID0, all ), 4000u ) ;
+  CLUPA_CHECK_EQUAL( nUsed( pos, cellID0, noSeeds ), 0u ) ;
+
+  const unsigned nCone = nUsed( pos, cellID0, staticCone ) ;
+  CLUPA_CHECK( nCone >= 1000 && nCone < 4000 ) ;
+
+  const unsigned nZ = nUsed( pos, cellID0, zRange ) ;
+  CLUPA_CHECK( nZ > 0 && nZ < 4000 ) ;
+
+  nUsed( pos, cellID0, seeded ) ;
+
+  return clupa_test::result( "testRegionOfInterest" ) ;
+}
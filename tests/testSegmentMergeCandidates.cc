@@ -0,0 +1,182 @@
+/** Unit test of the pre-selection of the pairs of split track segments for the TrackSegmentMerger 
+ *  ( findSegmentMergeCandidates ): the pairs have to be the same as the ones found by testing all pairs, 
+ *  and the default cut in phi must not reject the segments of non-curling tracks from the IP.
+ */
+#include "clupatra_new.h"
+#include "ClupatraReconstructor.h"
+#include "clupa_test.h"
+
+#include "IMPL/TrackImpl.h"
+#include "IMPL/TrackerHitImpl.h"
+#include "UTIL/BitField64.h"
+#include "UTIL/LCTrackerConf.h"
+
+#include <deque>
+#include <vector>
+#include <random>
+
+using namespace clupatra_new ;
+
+namespace{
+
+  typedef nnclu::Element<lcio::Track> TrackElement ;
+  typedef std::pair<unsigned,unsigned> Pair ;
+
+  // pad rows of the ILD TPC
+  const int    nRows = 220 ;
+  const double rInner = 385. ;
+  const double rowPitch = 6. ;
+
+  /** track segments with a first and a last hit - the hits store their pad row in the cellID */
+  struct Segments{
+
+    Segments() : encoder( UTIL::LCTrackerCellID::encoding_string() ) {}
+
+    UTIL::BitField64 encoder ;
+    std::deque<IMPL::TrackerHitImpl> hits ;
+    std::deque<IMPL::TrackImpl>      tracks ;
+    std::deque<TrackElement>         elements ;
+    std::vector<TrackElement*>       segs ;
+
+    IMPL::TrackerHitImpl* hit( int row, double phi ){
+
+      const double r = rInner + rowPitch * row ;
+      const double pos[3] = { r * std::cos( phi ), r * std::sin( phi ), 0. } ;
+
+      encoder.reset() ;
+      encoder[ UTIL::LCTrackerCellID::subdet() ] = UTIL::ILDDetID::TPC ;
+      encoder[ UTIL::LCTrackerCellID::layer() ]  = row ;
+
+      hits.push_back( IMPL::TrackerHitImpl() ) ;
+      hits.back().setCellID0( encoder.lowWord() ) ;
+      hits.back().setPosition( pos ) ;
+      return &hits.back() ;
+    }
+
+    void add( int firstRow, double firstPhi, int lastRow, double lastPhi, double tanL ){
+
+      tracks.push_back( IMPL::TrackImpl() ) ;
+      IMPL::TrackImpl& trk = tracks.back() ;
+      trk.setTanLambda( tanL ) ;
+      trk.addHit( hit( firstRow, firstPhi ) ) ;
+      trk.addHit( hit( lastRow, lastPhi ) ) ;
+
+      elements.push_back( TrackElement( &trk ) ) ;
+      segs.push_back( &elements.back() ) ;
+    }
+  } ;
+
+  double deltaPhi( double a, double b ){
+    double d = std::fabs( a - b ) ;
+    return ( d > M_PI ? 2. * M_PI - d : d ) ;
+  }
+
+  /** all pairs that pass the overlap rule of the TrackSegmentMerger and the cuts */
+  void allPairs( const std::vector<TrackElement*>& segs, float maxDeltaPhi, float minTanL, std::vector<Pair>& pairs ){
+
+    static const CellIDField layerID( UTIL::LCTrackerCellID::encoding_string(), UTIL::LCTrackerCellID::layer() ) ;
+
+    const int overlap = TrackSegmentMerger::overlapRows ;
+
+    pairs.clear() ;
+
+    for( unsigned i=0 ; i<segs.size() ; ++i ){
+      for( unsigned j=i+1 ; j<segs.size() ; ++j ){
+
+	const lcio::TrackerHitVec& hi = segs[i]->first->getTrackerHits() ;
+	const lcio::TrackerHitVec& hj = segs[j]->first->getTrackerHits() ;
+
+	int lfi = layerID( hi.front() ), lli = layerID( hi.back() ) ;
+	int lfj = layerID( hj.front() ), llj = layerID( hj.back() ) ;
+
+	if( lfi + overlap <= llj  &&  lfj + overlap <= lli ) 
+	  continue ;
+
+	if( maxDeltaPhi > 0. ){
+
+	  float ti = segs[i]->first->getTanLambda(), tj = segs[j]->first->getTanLambda() ;
+	  if( ti * tj < 0. && std::fabs( ti ) > minTanL && std::fabs( tj ) > minTanL ) 
+	    continue ;
+
+	  double dMin = M_PI ;
+	  const lcio::TrackerHit* ei[2] = { hi.front(), hi.back() } ;
+	  const lcio::TrackerHit* ej[2] = { hj.front(), hj.back() } ;
+	  for( unsigned a=0 ; a<2 ; ++a )
+	    for( unsigned b=0 ; b<2 ; ++b )
+	      dMin = std::min( dMin, deltaPhi( std::atan2( ei[a]->getPosition()[1], ei[a]->getPosition()[0] ), 
+					       std::atan2( ej[b]->getPosition()[1], ej[b]->getPosition()[0] ) ) ) ;
+	  if( dMin > maxDeltaPhi ) 
+	    continue ;
+	}
+	pairs.push_back( Pair( i, j ) ) ;
+      }
+    }
+  }
+}
+
+
+int main(){
+
+  std::mt19937 rng( 1234 ) ;
+  std::uniform_int_distribution<int> rowDist( 0, nRows - 1 ) ;
+  std::uniform_real_distribution<double> phiDist( -M_PI, M_PI ) ;
+  std::uniform_real_distribution<double> tanLDist( -2., 2. ) ;
+
+  //---- random segments: the index has to give the same pairs as testing all pairs 
+  for( unsigned n : { 0u, 1u, 2u, 10u, 300u } ){
+
+    Segments s ;
+    for( unsigned i=0 ; i<n ; ++i ){
+      int r0 = rowDist( rng ), r1 = rowDist( rng ) ;
+      double tanL = ( i % 5 == 0 ? 0.01 * tanLDist( rng ) : tanLDist( rng ) ) ; // some with |tanL| < minTanL 
+      double phi0 = phiDist( rng ) ;
+      s.add( std::min( r0, r1 ), phi0, std::max( r0, r1 ), phi0 + 0.3 * phiDist( rng ), tanL ) ;
+    }
+
+    for( float maxDeltaPhi : { 0.f, 0.5f, 1.0f } ){
+
+      std::vector<Pair> pairs, expected ;
+      unsigned nPruned = findSegmentMergeCandidates( s.segs, pairs, maxDeltaPhi ) ;
+      allPairs( s.segs, maxDeltaPhi, 0.05, expected ) ;
+
+      CLUPA_CHECK( pairs == expected ) ;
+      CLUPA_CHECK_EQUAL( nPruned + pairs.size(), ( n > 1 ? n * ( n - 1 ) / 2 : 0 ) ) ;
+    }
+  }
+
+  //---- segments of non-curling tracks from the IP, split at a random pad row: the default cut keeps them 
+  const clupatra::ReconstructorConfig cfg ;
+  CLUPA_CHECK( cfg.segmentMergeMaxDeltaPhi > 0. ) ;
+
+  Segments s ;
+  std::uniform_real_distribution<double> omegaDist( -cfg.trackIsCurlerOmega, cfg.trackIsCurlerOmega ) ;
+
+  const unsigned nTrk = 200 ;
+  for( unsigned t=0 ; t<nTrk ; ++t ){
+
+    double omega = omegaDist( rng ) ;
+    if( std::fabs( omega ) < 1.e-6 ) omega = 1.e-6 ;
+
+    // azimuth of the hit at radius r on the circle through the origin: phi0 + asin( r * omega / 2 )
+    const double phi0 = phiDist( rng ) ;
+    auto phiAt = [&]( int row ){ return phi0 + std::asin( 0.5 * ( rInner + rowPitch * row ) * omega ) ; } ;
+
+    int split = rowDist( rng ) ;
+    int gap   = std::min( nRows - 1 - split, int( rowDist( rng ) / 10 ) ) ;
+    double tanL = tanLDist( rng ) ;
+
+    s.add( 0, phiAt( 0 ), split, phiAt( split ), tanL ) ;
+    s.add( split + gap, phiAt( split + gap ), nRows - 1, phiAt( nRows - 1 ), tanL ) ;
+  }
+
+  std::vector<Pair> pairs ;
+  findSegmentMergeCandidates( s.segs, pairs, cfg.segmentMergeMaxDeltaPhi ) ;
+
+  for( unsigned t=0 ; t<nTrk ; ++t )
+    CLUPA_CHECK( std::binary_search( pairs.begin(), pairs.end(), Pair( 2 * t, 2 * t + 1 ) ) ) ;
+
+  // ... and prunes the pairs of other tracks 
+  CLUPA_CHECK( pairs.size() < nTrk * ( 2 * nTrk - 1 ) / 2 ) ;
+
+  return clupa_test::result( "testSegmentMergeCandidates" ) ;
+}
@@ -0,0 +1,252 @@
+/** Unit test of the stitching of the windows of the StreamReconstructor: the tracks of a window are faked 
+ *  from the true track of the hits ( in cellID1 ), so that the test needs no MarlinTrk system and no geometry. 
+ *  No hit may be used by two emitted tracks and tracks crossing the end of a window must not be split.
+ */
+#include "ClupatraStreamReconstructor.h"
+#include "clupa_test.h"
+
+#include "UTIL/BitField64.h"
+#include "UTIL/LCTrackerConf.h"
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <random>
+
+using namespace clupatra ;
+
+namespace{
+
+  const unsigned minHits = 5 ;
+
+  /** Stream reconstructor that finds the tracks of a window by the true track id of the hits. */
+  class FakeStream : public StreamReconstructor{
+  public:
+
+    FakeStream( const TPCGeometry& geo, const StreamConfig& scfg ) : 
+      StreamReconstructor( ReconstructorConfig(), geo, scfg ) {}
+
+  protected:
+
+    virtual void reconstructWindowHits( const TPCHitView& view, ReconstructionResult& result ){
+
+      std::map<int, std::vector<unsigned> > trkHits ;
+      for( unsigned i=0 ; i < view.n ; ++i )
+	if( view.cellID1[ i * view.cellIDStride ] > 0 )
+	  trkHits[ view.cellID1[ i * view.cellIDStride ] ].push_back( i ) ;
+
+      for( std::map<int, std::vector<unsigned> >::const_iterator it = trkHits.begin() ; it != trkHits.end() ; ++it ){
+
+	if( it->second.size() < minHits ) 
+	  continue ;
+
+	TrackResult tr ;
+	tr.hits = it->second ;
+
+	// one state at the first hit - in the window coordinates
+	TrackParameters tp = TrackParameters() ;
+	tp.location = lcio::TrackState::AtFirstHit ;
+	std::copy( view.pos + tr.hits[0] * view.posStride, view.pos + tr.hits[0] * view.posStride + 3, tp.referencePoint ) ;
+	tr.states.push_back( tp ) ;
+
+	result.trackResults.push_back( tr ) ;
+      }
+    }
+  } ;
+
+  /** hits of the stream with their true track */
+  struct StreamHits{
+
+    StreamHits() : encoder( UTIL::LCTrackerCellID::encoding_string() ) {}
+
+    UTIL::BitField64 encoder ;
+    std::vector<double> z ;
+    std::vector<int>    layer ;
+    std::vector<int>    track ;  // 0 : noise
+
+    void add( int l, double zHit, int trk ){
+      z.push_back( zHit ) ;
+      layer.push_back( l ) ;
+      track.push_back( trk ) ;
+    }
+
+    /** add the hits to the stream in slices of 'slice' mm in z ( in z order ) and reconstruct - returns the
+     *  stream indices of the hits 
+     */
+    std::vector<unsigned> run( StreamReconstructor& stream, double slice, std::vector<TrackResult>& tracks, unsigned& maxBuffered ){
+
+      std::vector<unsigned> order( z.size() ) ;
+      for( unsigned i=0 ; i < order.size() ; ++i ) order[i] = i ;
+      std::stable_sort( order.begin(), order.end(), [&]( unsigned a, unsigned b ){ return z[a] < z[b] ; } ) ;
+
+      std::vector<unsigned> streamIndex( z.size() ) ;
+      unsigned nAdded = 0 ;
+      maxBuffered = 0 ;
+
+      for( unsigned k=0 ; k < order.size() ; ){
+
+	std::vector<double> pos ;
+	std::vector<int>    cellIDs ;
+	std::vector<float>  cov ;
+
+	const double zEnd = z[ order[k] ] + slice ;
+
+	for( ; k < order.size() && z[ order[k] ] < zEnd ; ++k ){
+
+	  const unsigned i = order[k] ;
+	  const double r = 400. + 6. * layer[i] ;
+	  pos.push_back( r ) ; pos.push_back( 0.1 * track[i] ) ; pos.push_back( z[i] ) ;
+
+	  encoder.reset() ;
+	  encoder[ UTIL::LCTrackerCellID::subdet() ] = UTIL::ILDDetID::TPC ;
+	  encoder[ UTIL::LCTrackerCellID::layer() ]  = layer[i] ;
+	  cellIDs.push_back( encoder.lowWord() ) ;
+	  cellIDs.push_back( track[i] ) ;
+
+	  cov.insert( cov.end(), 6, 0.1 ) ;
+
+	  streamIndex[i] = nAdded++ ;
+	}
+
+	TPCHitView view ;
+	view.n            = cov.size() / 6 ;
+	view.pos          = &pos[0] ;
+	view.cellID0      = &cellIDs[0] ;
+	view.cellID1      = &cellIDs[1] ;
+	view.cellIDStride = 2 ;
+	view.cov          = &cov[0] ;
+
+	stream.addHits( view ) ;
+	stream.process( tracks ) ;
+
+	maxBuffered = std::max( maxBuffered, stream.nBuffered() ) ;
+      }
+
+      stream.flush( tracks ) ;
+
+      return streamIndex ;
+    }
+  } ;
+
+  /** number of emitted tracks with hits of every true track - checks that no hit is used twice and that the
+   *  hits of the emitted tracks belong to one true track
+   */
+  std::map<int,unsigned> checkTracks( const StreamHits& hits, const std::vector<unsigned>& streamIndex, const std::vector<TrackResult>& tracks ){
+
+    std::vector<int> trueTrack( streamIndex.size() ) ;
+    std::vector<double> zHit( streamIndex.size() ) ;
+    for( unsigned i=0 ; i < streamIndex.size() ; ++i ){
+      trueTrack[ streamIndex[i] ] = hits.track[i] ;
+      zHit[ streamIndex[i] ] = hits.z[i] ;
+    }
+
+    std::vector<unsigned> nUsed( streamIndex.size(), 0 ) ;
+    std::map<int,unsigned> nFound ;
+
+    for( unsigned t=0 ; t < tracks.size() ; ++t ){
+
+      const TrackResult& tr = tracks[t] ;
+      CLUPA_CHECK( ! tr.hits.empty() ) ;
+      if( tr.hits.empty() ) continue ;
+
+      for( unsigned j=0 ; j < tr.hits.size() ; ++j ){
+	++nUsed[ tr.hits[j] ] ;
+	CLUPA_CHECK_EQUAL( trueTrack[ tr.hits[j] ], trueTrack[ tr.hits[0] ] ) ;
+      }
+      ++nFound[ trueTrack[ tr.hits[0] ] ] ;
+
+      // the track states are in the stream coordinate
+      CLUPA_CHECK( std::fabs( tr.states[0].referencePoint[2] - zHit[ tr.hits[0] ] ) < 1e-3 * ( 1. + std::fabs( zHit[ tr.hits[0] ] ) ) ) ;
+    }
+
+    for( unsigned i=0 ; i < nUsed.size() ; ++i )
+      CLUPA_CHECK( nUsed[i] <= 1 ) ;
+
+    return nFound ;
+  }
+}
+
+
+int main(){
+
+  TPCGeometry geo ;
+  geo.rMin        = 385. ;
+  geo.rMax        = 1716. ;
+  geo.driftLength = 2250. ;
+  geo.nPadRows    = 220 ;
+  geo.bField      = 3.5 ;
+
+  StreamConfig scfg ;
+  scfg.windowLength = 1000. ;
+  scfg.overlap      = 400. ;   // step of 600 mm
+
+  std::mt19937 rng( 2718 ) ;
+  std::uniform_real_distribution<double> zDist( 0., 20000. ) ;
+  std::uniform_int_distribution<int> layerDist( 0, 219 ) ;
+
+  //---- tracks shorter than half a step: every track is emitted once with all its hits 
+  {
+    std::uniform_real_distribution<double> extentDist( 10., 290. ) ;
+
+    StreamHits hits ;
+    const int nTrk = 300 ;
+    for( int t=1 ; t <= nTrk ; ++t ){
+
+      const double z0 = zDist( rng ), extent = extentDist( rng ) ;
+      const int nHit = 30 ;
+      for( int j=0 ; j < nHit ; ++j )
+	hits.add( j, z0 + extent * j / ( nHit - 1 ), t ) ;
+    }
+    for( unsigned i=0 ; i < 2000 ; ++i )
+      hits.add( layerDist( rng ), zDist( rng ), 0 ) ;
+
+    FakeStream stream( geo, scfg ) ;
+    std::vector<TrackResult> tracks ;
+    unsigned maxBuffered = 0 ;
+
+    std::vector<unsigned> streamIndex = hits.run( stream, 150., tracks, maxBuffered ) ;
+
+    std::map<int,unsigned> nFound = checkTracks( hits, streamIndex, tracks ) ;
+
+    CLUPA_CHECK_EQUAL( tracks.size(), unsigned( nTrk ) ) ;
+    CLUPA_CHECK_EQUAL( nFound.size(), unsigned( nTrk ) ) ;
+    for( std::map<int,unsigned>::const_iterator it = nFound.begin() ; it != nFound.end() ; ++it )
+      CLUPA_CHECK_EQUAL( it->second, 1u ) ;
+
+    for( unsigned t=0 ; t < tracks.size() ; ++t )
+      CLUPA_CHECK_EQUAL( tracks[t].hits.size(), 30u ) ;
+
+    CLUPA_CHECK_EQUAL( stream.nForced(), 0u ) ;
+    CLUPA_CHECK( stream.nWindows() > 20000. / 600. - 1 ) ;
+    CLUPA_CHECK_EQUAL( stream.nBuffered(), 0u ) ;
+
+    // the memory is bounded by the hits of a window ( ~1/10 of the hits per 2000 mm )
+    CLUPA_CHECK( maxBuffered < streamIndex.size() / 10 ) ;
+  }
+
+  //---- tracks longer than the overlap are emitted before they are complete - but no hit twice 
+  {
+    std::uniform_real_distribution<double> extentDist( 500., 900. ) ;
+
+    StreamHits hits ;
+    for( int t=1 ; t <= 50 ; ++t ){
+
+      const double z0 = zDist( rng ), extent = extentDist( rng ) ;
+      for( int j=0 ; j < 100 ; ++j )
+	hits.add( j, z0 + extent * j / 99., t ) ;
+    }
+
+    FakeStream stream( geo, scfg ) ;
+    std::vector<TrackResult> tracks ;
+    unsigned maxBuffered = 0 ;
+
+    std::vector<unsigned> streamIndex = hits.run( stream, 150., tracks, maxBuffered ) ;
+
+    checkTracks( hits, streamIndex, tracks ) ;
+
+    CLUPA_CHECK( stream.nForced() > 0 ) ;
+    CLUPA_CHECK( tracks.size() >= 50 ) ;
+  }
+
+  return clupa_test::result( "testStreamStitching" ) ;
+}
@@ -0,0 +1,74 @@
+/** Unit test of the TimeBudget of the reconstruction: no limit for a budget <= 0, the budget is exceeded after 
+ *  the given time and the degraded stages are recorded - also from concurrent threads - and named. 
+ */
+#include "clupatra_new.h"
+#include "clupa_test.h"
+
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+
+using namespace clupatra_new ;
+
+
+int main(){
+
+  //---- no limit 
+  TimeBudget unlimited( 0. ) ;
+  TimeBudget negative( -1. ) ;
+  std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) ) ;
+
+  CLUPA_CHECK( ! unlimited.exceeded() ) ;
+  CLUPA_CHECK( ! negative.exceeded() ) ;
+  CLUPA_CHECK_EQUAL( unlimited.skipped(), 0u ) ;
+
+  //---- a budget of 10 ms is not exceeded right away but after 20 ms 
+  TimeBudget budget( 0.01 ) ;
+  CLUPA_CHECK( ! budget.exceeded() ) ;
+
+  std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) ) ;
+  CLUPA_CHECK( budget.exceeded() ) ;
+
+  TimeBudget large( 3600. ) ;
+  CLUPA_CHECK( ! large.exceeded() ) ;
+
+  //---- skipped stages 
+  budget.skip( TimeBudget::GlobalReclustering ) ;
+  budget.skip( TimeBudget::GlobalReclustering ) ;
+  budget.skip( TimeBudget::MergeCurlerSegments ) ;
+  CLUPA_CHECK_EQUAL( budget.skipped(), unsigned( TimeBudget::GlobalReclustering | TimeBudget::MergeCurlerSegments ) ) ;
+
+  // the threads of one event record their stages concurrently
+  TimeBudget shared( 0. ) ;
+  std::vector<std::thread> threads ;
+  for( unsigned i=0 ; i < TimeBudget::NStages ; ++i )
+    threads.push_back( std::thread( [&shared,i](){
+	  for( unsigned k=0 ; k < 1000 ; ++k )
+	    shared.skip( TimeBudget::Stage( 1u << i ) ) ;
+	} ) ) ;
+  for( unsigned i=0 ; i < threads.size() ; ++i )
+    threads[i].join() ;
+
+  CLUPA_CHECK_EQUAL( shared.skipped(), ( 1u << TimeBudget::NStages ) - 1 ) ;
+
+  //---- names of the stages 
+  std::vector<std::string> names( 1, "old" ) ;
+
+  TimeBudget::stageNames( 0, names ) ;
+  CLUPA_CHECK( names.empty() ) ;
+
+  TimeBudget::stageNames( budget.skipped(), names ) ;
+  CLUPA_CHECK_EQUAL( names.size(), 2u ) ;
+  CLUPA_CHECK( names.size() == 2 && names[0] == "GlobalReclustering" && names[1] == "MergeCurlerSegments" ) ;
+
+  TimeBudget::stageNames( shared.skipped(), names ) ;
+  CLUPA_CHECK_EQUAL( names.size(), unsigned( TimeBudget::NStages ) ) ;
+  CLUPA_CHECK( names.size() == 4 && names[0] == "SeedingLoops" && names[2] == "MergeSplitSegments" ) ;
+
+  // bits beyond the known stages are ignored
+  TimeBudget::stageNames( 1u << TimeBudget::NStages, names ) ;
+  CLUPA_CHECK( names.empty() ) ;
+
+  return clupa_test::result( "testTimeBudget" ) ;
+}